@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "capture.h"
+
+#define PREFIX                  "capture: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+
+#define RING_SIZE               (1 << 20) /*must be a power of two*/
+#define RING_MASK               (RING_SIZE - 1)
+#define WRITER_PERIOD_NS        2000000
+
+int g_captureEnabled = 0;
+
+static uint8_t g_ring[RING_SIZE];
+static _Atomic size_t g_ringHead = 0; /*written by the producer only*/
+static _Atomic size_t g_ringTail = 0; /*written by the writer only*/
+static atomic_int g_writerStop = 0;
+
+static FILE *g_captureFile = NULL;
+static pthread_t g_writer;
+static uint64_t g_captureStart = 0;
+
+static uint64_t now(clockid_t clock)
+{
+    struct timespec t;
+
+    clock_gettime(clock, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void putValue(uint8_t *data, uint64_t value, int size)
+{
+    int i;
+
+    for(i = 0; i < size; i++)
+    {
+        data[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+static uint64_t getValue(const uint8_t *data, int size)
+{
+    uint64_t value = 0;
+
+    while(size-- > 0)
+    {
+        value = (value << 8) | data[size];
+    }
+
+    return value;
+}
+
+/******************************************************************************
+ * ring
+ */
+
+static void ringPut(size_t *head, const void *data, size_t size)
+{
+    size_t offset = *head & RING_MASK;
+    size_t first = (size > RING_SIZE - offset) ? RING_SIZE - offset : size;
+
+    memcpy(&g_ring[offset], data, first);
+    memcpy(g_ring, (const uint8_t *)data + first, size - first);
+    *head += size;
+}
+
+static int flushRing(void)
+{
+    size_t tail = atomic_load_explicit(&g_ringTail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&g_ringHead, memory_order_acquire);
+
+    while(tail != head)
+    {
+        size_t offset = tail & RING_MASK;
+        size_t size = head - tail;
+
+        if(size > RING_SIZE - offset)
+        {
+            size = RING_SIZE - offset;
+        }
+
+        if(fwrite(&g_ring[offset], 1, size, g_captureFile) != size)
+        {
+            ERROR("failed to write %zu bytes to capture file\n", size);
+            return -1;
+        }
+
+        tail += size;
+        atomic_store_explicit(&g_ringTail, tail, memory_order_release);
+    }
+
+    return 0;
+}
+
+static void *writer(void *arg)
+{
+    struct timespec period = { .tv_sec = 0, .tv_nsec = WRITER_PERIOD_NS };
+
+    (void)arg;
+
+    while(!atomic_load(&g_writerStop))
+    {
+        if(flushRing() != 0)
+        {
+            break;
+        }
+
+        nanosleep(&period, NULL);
+    }
+
+    flushRing();
+    return NULL;
+}
+
+int capture_open(const char *filename)
+{
+    uint8_t header[CAPTURE_HEADER_SIZE];
+
+    if((g_captureFile = fopen(filename, "wb")) == NULL)
+    {
+        ERROR("failed to open \"%s\" file for writing\n", filename);
+        return -1;
+    }
+
+    memcpy(header, CAPTURE_MAGIC, 8);
+    putValue(&header[8], CAPTURE_VERSION, 4);
+    putValue(&header[12], 0, 4);
+    putValue(&header[16], now(CLOCK_REALTIME), 8);
+
+    if(fwrite(header, 1, sizeof(header), g_captureFile) != sizeof(header))
+    {
+        ERROR("failed to write capture file header\n");
+        fclose(g_captureFile);
+        g_captureFile = NULL;
+        return -1;
+    }
+
+    g_captureStart = now(CLOCK_MONOTONIC);
+    atomic_store(&g_writerStop, 0);
+
+    if(pthread_create(&g_writer, NULL, writer, NULL) != 0)
+    {
+        ERROR("failed to start capture writer\n");
+        fclose(g_captureFile);
+        g_captureFile = NULL;
+        return -1;
+    }
+
+    g_captureEnabled = 1;
+    return 0;
+}
+
+void capture_close(void)
+{
+    if(!g_captureEnabled)
+    {
+        return;
+    }
+
+    g_captureEnabled = 0;
+    atomic_store(&g_writerStop, 1);
+    pthread_join(g_writer, NULL);
+    fclose(g_captureFile);
+    g_captureFile = NULL;
+}
+
+void capture_recordVector(int direction, const struct iovec *vector, int count)
+{
+    uint8_t record[CAPTURE_RECORD_SIZE];
+    uint64_t timestamp = now(CLOCK_MONOTONIC) - g_captureStart;
+    size_t size = 0;
+    size_t head;
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        size += vector[i].iov_len;
+    }
+
+    if(size > 0xffff)
+    {
+        ERROR("burst of %zu bytes is too large to capture\n", size);
+        return;
+    }
+
+    /*the writer drains the ring in the background; only wait if it is full*/
+    while(RING_SIZE - (atomic_load_explicit(&g_ringHead, memory_order_relaxed) - atomic_load_explicit(&g_ringTail, memory_order_acquire)) < sizeof(record) + size)
+    {
+        sched_yield();
+    }
+
+    putValue(&record[0], timestamp, 8);
+    record[8] = direction;
+    record[9] = 0;
+    putValue(&record[10], size, 2);
+
+    head = atomic_load_explicit(&g_ringHead, memory_order_relaxed);
+    ringPut(&head, record, sizeof(record));
+
+    for(i = 0; i < count; i++)
+    {
+        ringPut(&head, vector[i].iov_base, vector[i].iov_len);
+    }
+
+    atomic_store_explicit(&g_ringHead, head, memory_order_release);
+}
+
+int capture_load(const char *filename, uint8_t **content, CAPTURE_RECORD **records, size_t *recordCnt)
+{
+    FILE *file;
+    long fileSize;
+    long offset = CAPTURE_HEADER_SIZE;
+
+    *content = NULL;
+    *records = NULL;
+    *recordCnt = 0;
+
+    if((file = fopen(filename, "rb")) == NULL)
+    {
+        ERROR("failed to open \"%s\" file for reading\n", filename);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if(fileSize < CAPTURE_HEADER_SIZE || (*content = malloc(fileSize)) == NULL || fread(*content, 1, fileSize, file) != (size_t)fileSize)
+    {
+        ERROR("failed to read capture file \"%s\"\n", filename);
+        fclose(file);
+        free(*content);
+        *content = NULL;
+        return -1;
+    }
+    fclose(file);
+
+    if(memcmp(*content, CAPTURE_MAGIC, 8) != 0 || getValue(&(*content)[8], 4) != CAPTURE_VERSION)
+    {
+        ERROR("\"%s\" is not a version %d capture file\n", filename, CAPTURE_VERSION);
+        free(*content);
+        *content = NULL;
+        return -1;
+    }
+
+    while(offset + CAPTURE_RECORD_SIZE <= fileSize)
+    {
+        const uint8_t *record = &(*content)[offset];
+        uint32_t size = getValue(&record[10], 2);
+
+        if(offset + CAPTURE_RECORD_SIZE + size > fileSize)
+        {
+            fprintf(stderr, PREFIX "warning: truncated record at offset %ld\n", offset);
+            break;
+        }
+
+        if((*recordCnt & 1023) == 0)
+        {
+            CAPTURE_RECORD *temp = realloc(*records, (*recordCnt + 1024) * sizeof(CAPTURE_RECORD));
+
+            if(temp == NULL)
+            {
+                ERROR("realloc() fail\n");
+                free(*records);
+                free(*content);
+                *records = NULL;
+                *content = NULL;
+                *recordCnt = 0;
+                return -1;
+            }
+            *records = temp;
+        }
+
+        (*records)[*recordCnt].timestamp = getValue(record, 8);
+        (*records)[*recordCnt].direction = record[8];
+        (*records)[*recordCnt].size = size;
+        (*records)[*recordCnt].data = &record[CAPTURE_RECORD_SIZE];
+        (*recordCnt)++;
+        offset += CAPTURE_RECORD_SIZE + size;
+    }
+
+    return 0;
+}
+
+#ifdef CAPTURE_STANDALONE
+
+/******************************************************************************
+ * offline analyzer
+ *
+ * The host side bursts are split back into boot mode commands by their
+ * framing; everything the device sends until the next command is taken as
+ * that command's response. Turnaround is measured from the host write of the
+ * last command byte to the read of the first response byte.
+ */
+
+#include <getopt.h>
+
+typedef struct {
+    uint64_t start;              /*timestamp of the burst holding the first byte*/
+    uint64_t end;                /*timestamp of the burst holding the last byte*/
+    const uint8_t *data;
+    uint32_t size;
+    uint64_t responseStart;
+    uint64_t responseEnd;
+    uint32_t responseSize;
+    uint8_t response[8];
+} COMMAND;
+
+static int commandLength(const uint8_t *data, size_t available)
+{
+    switch(data[0])
+    {
+        case 0x10: /*device selection*/
+        case 0x11: /*clock mode selection*/
+        case 0x3f: /*new bit rate selection*/
+            return (available < 2) ? 0 : 3 + data[1];
+        case 0x50: /*256-byte programming*/
+            if(available < 5)
+            {
+                return 0;
+            }
+            return (getValue(&data[1], 4) == 0xffffffff) ? 6 : 262;
+        default:
+            return 1;
+    }
+}
+
+static int compareTurnaround(const void *a, const void *b)
+{
+    const COMMAND *ca = *(const COMMAND **)a;
+    const COMMAND *cb = *(const COMMAND **)b;
+    uint64_t ta = ca->responseStart - ca->end;
+    uint64_t tb = cb->responseStart - cb->end;
+
+    return (ta > tb) - (ta < tb);
+}
+
+static uint32_t pageAddress(const COMMAND *command)
+{
+    /*bytes 1..4 of the command, big-endian*/
+    return (command->data[1] << 24) | (command->data[2] << 16) | (command->data[3] << 8) | command->data[4];
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-v] [-g <gap ms>] <capture file>\n"
+            "  -v            list every command with its response\n"
+            "  -g <gap ms>   report idle gaps longer than this (default 20 ms)\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int verbose = 0;
+    double gapMs = 20.0;
+    int option;
+    size_t i;
+    size_t j;
+
+    while((option = getopt(argc, argv, "vg:")) != -1)
+    {
+        switch(option)
+        {
+            case 'v':
+                verbose = 1;
+                break;
+            case 'g':
+                gapMs = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if(argc - optind != 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    uint8_t *content;
+    CAPTURE_RECORD *records;
+    size_t recordCnt;
+    size_t txSize = 0;
+    size_t rxSize = 0;
+
+    if(capture_load(argv[optind], &content, &records, &recordCnt) != 0)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < recordCnt; i++)
+    {
+        *(records[i].direction == CAPTURE_TX ? &txSize : &rxSize) += records[i].size;
+    }
+
+    /*host stream, reassembled*/
+    uint8_t *tx = malloc(txSize ? txSize : 1);
+    uint64_t *txTimestamp = malloc((txSize ? txSize : 1) * sizeof(uint64_t));
+    size_t k = 0;
+
+    if(tx == NULL || txTimestamp == NULL)
+    {
+        ERROR("malloc() fail\n");
+        return -1;
+    }
+
+    for(i = 0; i < recordCnt; i++)
+    {
+        if(records[i].direction == CAPTURE_TX)
+        {
+            for(j = 0; j < records[i].size; j++, k++)
+            {
+                tx[k] = records[i].data[j];
+                txTimestamp[k] = records[i].timestamp;
+            }
+        }
+    }
+
+    /*commands*/
+    COMMAND *commands = calloc(txSize ? txSize : 1, sizeof(COMMAND));
+    size_t commandCnt = 0;
+
+    if(commands == NULL)
+    {
+        ERROR("calloc() fail\n");
+        return -1;
+    }
+
+    for(k = 0; k < txSize; )
+    {
+        int length = commandLength(&tx[k], txSize - k);
+
+        if(length == 0 || (size_t)length > txSize - k)
+        {
+            length = txSize - k; /*truncated command at the end of the capture*/
+        }
+
+        commands[commandCnt].start = txTimestamp[k];
+        commands[commandCnt].end = txTimestamp[k + length - 1];
+        commands[commandCnt].data = &tx[k];
+        commands[commandCnt].size = length;
+        commandCnt++;
+        k += length;
+    }
+
+    /*responses: device bytes received after a command's last burst and before the next command*/
+    for(i = 0, j = 0; i < recordCnt; i++)
+    {
+        if(records[i].direction != CAPTURE_RX)
+        {
+            continue;
+        }
+
+        while(j + 1 < commandCnt && commands[j + 1].start <= records[i].timestamp)
+        {
+            j++;
+        }
+
+        if(commandCnt == 0 || records[i].timestamp < commands[j].end)
+        {
+            continue;
+        }
+
+        COMMAND *command = &commands[j];
+        for(k = 0; k < records[i].size; k++, command->responseSize++)
+        {
+            if(command->responseSize < sizeof(command->response))
+            {
+                command->response[command->responseSize] = records[i].data[k];
+            }
+        }
+
+        if(command->responseStart == 0)
+        {
+            command->responseStart = records[i].timestamp;
+        }
+        command->responseEnd = records[i].timestamp;
+    }
+
+    uint64_t span = recordCnt ? records[recordCnt - 1].timestamp - records[0].timestamp : 0;
+    printf("capture: %zu bursts, %zu bytes sent, %zu bytes received, %zu commands over %.3f ms\n",
+           recordCnt, txSize, rxSize, commandCnt, span / 1e6);
+
+    if(verbose)
+    {
+        printf("\ncommands:\n");
+        for(i = 0; i < commandCnt; i++)
+        {
+            printf("  %12.3f ms  0x%.2x  %3u bytes", commands[i].start / 1e6, commands[i].data[0], commands[i].size);
+            if(commands[i].data[0] == 0x50 && commands[i].size >= 5)
+            {
+                printf("  @%.8x", pageAddress(&commands[i]));
+            }
+
+            if(commands[i].responseSize == 0)
+            {
+                printf("  -> no response\n");
+                continue;
+            }
+
+            printf("  -> %.3f ms:", (commands[i].responseStart - commands[i].end) / 1e6);
+            for(k = 0; k < commands[i].responseSize && k < sizeof(commands[i].response); k++)
+            {
+                printf(" %.2x", commands[i].response[k]);
+            }
+            printf("%s\n", commands[i].responseSize > sizeof(commands[i].response) ? " ..." : "");
+        }
+    }
+
+    /*gaps*/
+    printf("\ngaps longer than %.1f ms:\n", gapMs);
+    int gapCnt = 0;
+    for(i = 1; i < recordCnt; i++)
+    {
+        uint64_t gap = records[i].timestamp - records[i - 1].timestamp;
+
+        if(gap > gapMs * 1e6)
+        {
+            printf("  %12.3f ms  %10.3f ms idle before %s burst of %u bytes (first byte 0x%.2x)\n",
+                   records[i - 1].timestamp / 1e6, gap / 1e6, records[i].direction == CAPTURE_TX ? "host" : "device",
+                   records[i].size, records[i].size ? records[i].data[0] : 0);
+            gapCnt++;
+        }
+    }
+    if(gapCnt == 0)
+    {
+        printf("  none\n");
+    }
+
+    /*retransmissions: a command sent again right after an identical one*/
+    printf("\nretransmissions:\n");
+    int retransmissionCnt = 0;
+    for(i = 1; i < commandCnt; i++)
+    {
+        if(commands[i].size != commands[i - 1].size || memcmp(commands[i].data, commands[i - 1].data, commands[i].size) != 0)
+        {
+            continue;
+        }
+
+        for(j = i; j + 1 < commandCnt && commands[j + 1].size == commands[i].size && memcmp(commands[j + 1].data, commands[i].data, commands[i].size) == 0; j++);
+
+        printf("  %12.3f ms  0x%.2x", commands[i - 1].start / 1e6, commands[i].data[0]);
+        if(commands[i].data[0] == 0x50 && commands[i].size >= 5)
+        {
+            printf(" @%.8x", pageAddress(&commands[i]));
+        }
+        printf(" sent %zu times over %.3f ms\n", j - i + 2, (commands[j].end - commands[i - 1].start) / 1e6);
+        retransmissionCnt += j - i + 1;
+        i = j;
+    }
+    if(retransmissionCnt == 0)
+    {
+        printf("  none\n");
+    }
+
+    /*per-page turnaround*/
+    COMMAND **pages = malloc((commandCnt ? commandCnt : 1) * sizeof(COMMAND *));
+    size_t pageCnt = 0;
+    uint64_t turnaroundTotal = 0;
+
+    if(pages == NULL)
+    {
+        ERROR("malloc() fail\n");
+        return -1;
+    }
+
+    for(i = 0; i < commandCnt; i++)
+    {
+        if(commands[i].data[0] == 0x50 && commands[i].size == 262 && commands[i].responseSize > 0)
+        {
+            pages[pageCnt++] = &commands[i];
+            turnaroundTotal += commands[i].responseStart - commands[i].end;
+        }
+    }
+
+    printf("\npage turnaround:\n");
+    if(pageCnt == 0)
+    {
+        printf("  no pages\n");
+    }
+    else
+    {
+        uint64_t first = pages[0]->start;
+        uint64_t last = pages[pageCnt - 1]->responseEnd;
+
+        qsort(pages, pageCnt, sizeof(COMMAND *), compareTurnaround);
+
+        printf("  %zu pages, %.1f pages/s, turnaround min %.3f ms, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               pageCnt, (last > first) ? pageCnt / ((last - first) / 1e9) : 0.0,
+               (pages[0]->responseStart - pages[0]->end) / 1e6,
+               turnaroundTotal / 1e6 / pageCnt,
+               (pages[pageCnt / 2]->responseStart - pages[pageCnt / 2]->end) / 1e6,
+               (pages[(pageCnt * 99) / 100]->responseStart - pages[(pageCnt * 99) / 100]->end) / 1e6,
+               (pages[pageCnt - 1]->responseStart - pages[pageCnt - 1]->end) / 1e6);
+
+        printf("  slowest:");
+        for(i = pageCnt; i > 0 && i + 5 > pageCnt; i--)
+        {
+            printf(" %.8x (%.3f ms)", pageAddress(pages[i - 1]), (pages[i - 1]->responseStart - pages[i - 1]->end) / 1e6);
+        }
+        printf("\n");
+    }
+
+    free(pages);
+    free(commands);
+    free(txTimestamp);
+    free(tx);
+    free(records);
+    free(content);
+    return 0;
+}
+
+#endif /* CAPTURE_STANDALONE */
@@ -0,0 +1,98 @@
+/**
+ * timestamped binary capture of all serial traffic
+ *
+ * capture file format (little-endian)
+ *
+ * offset         size (bytes)    description
+ * --------------------------------------------------------------------
+ * 0              8               magic "RX63NCAP"
+ * 8              4               version (1)
+ * 12             4               reserved
+ * 16             8               CLOCK_REALTIME of the capture start, in ns
+ * 24             12 + length0    first record
+ * ...
+ * --------------------------------------------------------------------
+ *
+ * record
+ *
+ * offset         size (bytes)    description
+ * --------------------------------------------------------------------
+ * 0              8               CLOCK_MONOTONIC ns since the capture start
+ * 8              1               direction (CAPTURE_TX or CAPTURE_RX)
+ * 9              1               reserved
+ * 10             2               length of the byte burst
+ * 12             length          bytes as written to or read from the port
+ * --------------------------------------------------------------------
+ *
+ * Records are appended to a lock-free single-producer ring by the thread
+ * doing the serial I/O and written to the file by a background thread.
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define CAPTURE_MAGIC           "RX63NCAP"
+#define CAPTURE_VERSION         1
+#define CAPTURE_HEADER_SIZE     24
+#define CAPTURE_RECORD_SIZE     12
+
+enum {
+    CAPTURE_TX,
+    CAPTURE_RX
+};
+
+typedef struct {
+    uint64_t timestamp;
+    int direction;
+    uint32_t size;
+    const uint8_t *data;
+} CAPTURE_RECORD;
+
+extern int g_captureEnabled;
+
+/**
+ * start capturing into filename
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int capture_open(const char *filename);
+
+/**
+ * flush all pending records and stop the writer
+ */
+void capture_close(void);
+
+void capture_recordVector(int direction, const struct iovec *vector, int count);
+
+/**
+ * load all records of a capture file
+ *
+ * content - receives the file content the records point into
+ * records - receives the records
+ * recordCnt - receives the number of records
+ *
+ * 0 if successful, non-zero otherwise
+ *
+ * note: free() records and content when done
+ */
+int capture_load(const char *filename, uint8_t **content, CAPTURE_RECORD **records, size_t *recordCnt);
+
+static inline void capture_vector(int direction, const struct iovec *vector, int count)
+{
+    if(__builtin_expect(g_captureEnabled, 0))
+        capture_recordVector(direction, vector, count);
+}
+
+static inline void capture_data(int direction, const void *data, int size)
+{
+    if(__builtin_expect(g_captureEnabled, 0) && size > 0)
+    {
+        struct iovec vector = { .iov_base = (void *)data, .iov_len = size };
+        capture_recordVector(direction, &vector, 1);
+    }
+}
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,922 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "daemon.h"
+
+#define PREFIX                  "rx63nprogd: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+#define LOG(...)                fprintf(stdout, PREFIX __VA_ARGS__)
+
+#define IMAGE_CACHE_SIZE        16
+#define REQUEST_SIZE            (2 * PATH_MAX + 2)
+#define REQUEST_TIMEOUT_SEC     1
+#define MAX_PENDING_CLIENTS     32
+
+/*framed image, addressed by the hash of the file content*/
+typedef struct {
+    int used;
+    pid_t loader;               /*process parsing and framing the image, 0 once the frames are in*/
+    FILE *loaded;               /*while loading: the hash and frames written by the loader*/
+    uint64_t hash;
+    dev_t device;               /*identity of the file last seen with this content*/
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    PAGECACHE *frames;          /*one reference; every queued job holds another*/
+    uint64_t lastUsed;
+} IMAGE_ENTRY;
+
+typedef struct JOB {
+    int id;
+    int client;
+    char *deviceName;
+    char *imageName;
+    IMAGE_ENTRY *image;         /*image being loaded for the job, NULL once it has its frames*/
+    PAGECACHE *frames;          /*released once the job has been forked*/
+    pid_t pid;                  /*0 while queued*/
+    uint64_t submitted;
+    struct JOB *next;
+} JOB;
+
+/*client whose request line is still being read*/
+typedef struct {
+    int fd;                     /*-1 if the slot is free*/
+    size_t length;
+    uint64_t deadline;
+    char request[REQUEST_SIZE + 1];
+} PENDING_CLIENT;
+
+static IMAGE_ENTRY g_imageCache[IMAGE_CACHE_SIZE];
+static PENDING_CLIENT g_pendingClients[MAX_PENDING_CLIENTS];
+static int g_pendingClientCnt = 0;
+static JOB *g_jobList = NULL;
+static int g_runningJobCnt = 0;
+static int g_nextJobId = 1;
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/******************************************************************************
+ * image cache
+ */
+
+/**
+ * FNV-1a hash of a file's content
+ */
+static int hashFile(const char *filename, off_t size, uint64_t *hash)
+{
+    const uint8_t *content;
+    int file;
+    off_t i;
+
+    *hash = 14695981039346656037ULL;
+
+    if(size == 0)
+    {
+        return 0;
+    }
+
+    if((file = open(filename, O_RDONLY)) < 0)
+    {
+        return -1;
+    }
+
+    content = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(content == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < size; i++)
+    {
+        *hash = (*hash ^ content[i]) * 1099511628211ULL;
+    }
+
+    munmap((void *)content, size);
+    return 0;
+}
+
+/**
+ * in a child of the daemon, close the connections of the clients other than
+ * the one of job, which may be NULL, so they see the end of their job when the
+ * daemon closes them
+ */
+static void closeClients(const JOB *job)
+{
+    const JOB *other;
+    int i;
+
+    for(i = 0; i < MAX_PENDING_CLIENTS; i++)
+    {
+        if(g_pendingClients[i].fd >= 0)
+        {
+            close(g_pendingClients[i].fd);
+        }
+    }
+
+    for(other = g_jobList; other != NULL; other = other->next)
+    {
+        if(other != job)
+        {
+            close(other->client);
+        }
+    }
+}
+
+/**
+ * hash, parse and frame an image in a loader process and write the hash and
+ * the frames to file; never returns
+ *
+ * The daemon itself never opens the image, so the jobs it forks meanwhile
+ * share no stream or file offset with the loader.
+ */
+static void loadImage(const char *filename, off_t size, int file)
+{
+    PAGECACHE *frames = NULL;
+    IntelHex image;
+    uint64_t hash;
+
+    if(hashFile(filename, size, &hash) == 0 &&
+       intelHex_convert(intelHex_fileFormat(filename), filename, NULL, INTEL_HEX_FORMAT_BIN, NULL, &image, 0) == 0)
+    {
+        /*only the frames are kept, the jobs never look at the parsed image*/
+        frames = pagecache_create(&image);
+    }
+
+    /*exit handlers, e.g. the stats report, belong to the sessions*/
+    _exit(frames != NULL && pwrite(file, &hash, sizeof(hash), 0) == sizeof(hash) && pagecache_save(frames, file, sizeof(hash)) == 0 ? 0 : 1);
+}
+
+/**
+ * find the framed image for a file, or start loading it if the file has not
+ * been seen unchanged; the entry returned may still be loading
+ *
+ * hit - receives whether the image came from the cache
+ */
+static IMAGE_ENTRY *getImage(const char *filename, int *hit)
+{
+    IMAGE_ENTRY *entry = NULL;
+    struct stat status;
+    int i;
+
+    *hit = 1;
+
+    if(stat(filename, &status) != 0)
+    {
+        return NULL;
+    }
+
+    /*same file, unchanged since it was last hashed*/
+    for(i = 0; i < IMAGE_CACHE_SIZE; i++)
+    {
+        entry = &g_imageCache[i];
+
+        if(entry->used && entry->device == status.st_dev && entry->inode == status.st_ino && entry->size == status.st_size &&
+           entry->modified.tv_sec == status.st_mtim.tv_sec && entry->modified.tv_nsec == status.st_mtim.tv_nsec)
+        {
+            *hit = (entry->loader == 0);
+            entry->lastUsed = now();
+            return entry;
+        }
+    }
+
+    *hit = 0;
+    entry = NULL;
+
+    /*a free slot, or else the least recently used image; queued jobs keep their frames*/
+    for(i = 0; i < IMAGE_CACHE_SIZE; i++)
+    {
+        if(!g_imageCache[i].used)
+        {
+            entry = &g_imageCache[i];
+            break;
+        }
+
+        if(g_imageCache[i].loader == 0 && (entry == NULL || g_imageCache[i].lastUsed < entry->lastUsed))
+        {
+            entry = &g_imageCache[i];
+        }
+    }
+
+    if(entry == NULL || (entry->loaded = tmpfile()) == NULL)
+    {
+        return NULL;
+    }
+
+    if(entry->used)
+    {
+        pagecache_release(entry->frames);
+        entry->used = 0;
+    }
+
+    entry->device = status.st_dev;
+    entry->inode = status.st_ino;
+    entry->size = status.st_size;
+    entry->modified = status.st_mtim;
+    entry->lastUsed = now();
+    entry->frames = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if((entry->loader = fork()) < 0)
+    {
+        entry->loader = 0;
+        fclose(entry->loaded);
+        entry->loaded = NULL;
+        return NULL;
+    }
+
+    if(entry->loader == 0)
+    {
+        closeClients(NULL);
+        loadImage(filename, status.st_size, fileno(entry->loaded));
+    }
+
+    entry->used = 1;
+    return entry;
+}
+
+/**
+ * take the frames of an image whose loader exited
+ *
+ * the entry holding the frames, which is another one when an image with the
+ * same content is cached already, NULL if the image failed to load
+ */
+static IMAGE_ENTRY *finishImageLoad(IMAGE_ENTRY *entry, int succeeded)
+{
+    IMAGE_ENTRY *other;
+    int file = fileno(entry->loaded);
+    int i;
+
+    entry->loader = 0;
+
+    if(!succeeded || pread(file, &entry->hash, sizeof(entry->hash), 0) != sizeof(entry->hash) ||
+       (entry->frames = pagecache_load(file, sizeof(entry->hash))) == NULL)
+    {
+        entry->used = 0;
+    }
+
+    fclose(entry->loaded);
+    entry->loaded = NULL;
+
+    if(!entry->used)
+    {
+        return NULL;
+    }
+
+    /*same content under another name or a new timestamp*/
+    for(i = 0; i < IMAGE_CACHE_SIZE; i++)
+    {
+        other = &g_imageCache[i];
+
+        if(other != entry && other->used && other->loader == 0 && other->hash == entry->hash)
+        {
+            other->device = entry->device;
+            other->inode = entry->inode;
+            other->size = entry->size;
+            other->modified = entry->modified;
+            other->lastUsed = entry->lastUsed;
+
+            pagecache_release(entry->frames);
+            entry->used = 0;
+            return other;
+        }
+    }
+
+    return entry;
+}
+
+static void cleanupImageCache(void)
+{
+    int i;
+
+    for(i = 0; i < IMAGE_CACHE_SIZE; i++)
+    {
+        /*nobody waits for the image any more*/
+        if(g_imageCache[i].loader != 0)
+        {
+            kill(g_imageCache[i].loader, SIGKILL);
+            waitpid(g_imageCache[i].loader, NULL, 0);
+            g_imageCache[i].loader = 0;
+        }
+        else if(g_imageCache[i].used)
+        {
+            pagecache_release(g_imageCache[i].frames);
+        }
+        g_imageCache[i].used = 0;
+
+        if(g_imageCache[i].loaded != NULL)
+        {
+            fclose(g_imageCache[i].loaded);
+            g_imageCache[i].loaded = NULL;
+        }
+    }
+}
+
+/******************************************************************************
+ * jobs
+ */
+
+static void finishJob(JOB *job, int status)
+{
+    JOB **link;
+
+    dprintf(job->client, PREFIX "job %d finished with status %d\n", job->id, status);
+    LOG("job %d on %s finished with status %d after %.1f ms\n", job->id, job->deviceName, status, (now() - job->submitted) / 1e6);
+
+    for(link = &g_jobList; *link != job; link = &(*link)->next);
+    *link = job->next;
+
+    if(job->pid == 0)
+    {
+        pagecache_release(job->frames);
+    }
+
+    close(job->client);
+    free(job->deviceName);
+    free(job->imageName);
+    free(job);
+}
+
+static void runJob(JOB *job, DAEMON_SESSION session, int listener, int signals, const sigset_t *mask)
+{
+    int status;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if((job->pid = fork()) < 0)
+    {
+        dprintf(job->client, PREFIX "error: fork() fail\n");
+        job->pid = 0;
+        finishJob(job, -1);
+        return;
+    }
+
+    if(job->pid > 0)
+    {
+        /*the child has its own copy of the reference*/
+        pagecache_release(job->frames);
+        g_runningJobCnt++;
+        LOG("job %d started on %s\n", job->id, job->deviceName);
+        return;
+    }
+
+    /*child: the session talks to the client directly*/
+    sigprocmask(SIG_UNBLOCK, mask, NULL);
+    close(listener);
+    close(signals);
+
+    closeClients(job);
+
+    dup2(job->client, STDOUT_FILENO);
+    dup2(job->client, STDERR_FILENO);
+    close(job->client);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    status = session(job->deviceName, job->frames);
+    exit(status == 0 ? 0 : 1);
+}
+
+/**
+ * start queued jobs in submission order, one per port, up to maxJobs
+ */
+static void startJobs(int maxJobs, DAEMON_SESSION session, int listener, int signals, const sigset_t *mask)
+{
+    JOB *job;
+    JOB *next;
+
+    for(job = g_jobList; job != NULL && g_runningJobCnt < maxJobs; job = next)
+    {
+        JOB *other;
+
+        next = job->next;
+
+        /*running, or waiting for its image*/
+        if(job->pid != 0 || job->image != NULL)
+        {
+            continue;
+        }
+
+        for(other = g_jobList; other != job; other = other->next)
+        {
+            if(strcmp(other->deviceName, job->deviceName) == 0)
+            {
+                break;
+            }
+        }
+
+        /*an earlier job, running or queued, has the port*/
+        if(other != job)
+        {
+            continue;
+        }
+
+        runJob(job, session, listener, signals, mask);
+    }
+}
+
+/**
+ * give a job the frames of its image
+ */
+static void attachImage(JOB *job, IMAGE_ENTRY *entry, int hit)
+{
+    job->image = NULL;
+    job->frames = pagecache_retain(entry->frames);
+
+    dprintf(job->client, PREFIX "job %d for %s, %u pages %s (%.3f ms)\n", job->id, job->deviceName, job->frames->frameCnt,
+            hit ? "cached" : "framed", (now() - job->submitted) / 1e6);
+    LOG("job %d queued for %s, image %s %s\n", job->id, job->deviceName, job->imageName, hit ? "cached" : "framed");
+}
+
+/**
+ * queue the job of a complete request line, ended by end
+ */
+static void queueJob(int client, char *request, char *end)
+{
+    char *separator;
+    IMAGE_ENTRY *entry;
+    JOB *job;
+    JOB **link;
+    int hit;
+
+    if((separator = memchr(request, '\t', end - request)) == NULL)
+    {
+        dprintf(client, PREFIX "error: expected <device> TAB <image> LF\n" PREFIX "job 0 finished with status -1\n");
+        close(client);
+        return;
+    }
+    *separator = '\0';
+    *end = '\0';
+
+    if((job = calloc(1, sizeof(JOB))) == NULL || (job->deviceName = strdup(request)) == NULL || (job->imageName = strdup(separator + 1)) == NULL)
+    {
+        if(job != NULL)
+        {
+            free(job->deviceName);
+        }
+        free(job);
+        close(client);
+        return;
+    }
+    job->id = g_nextJobId++;
+    job->client = client;
+    job->submitted = now();
+
+    for(link = &g_jobList; *link != NULL; link = &(*link)->next);
+    *link = job;
+
+    if((entry = getImage(job->imageName, &hit)) == NULL)
+    {
+        dprintf(client, PREFIX "error: failed to load image %s\n", job->imageName);
+        finishJob(job, -1);
+        return;
+    }
+
+    if(entry->loader != 0)
+    {
+        job->image = entry;
+        LOG("job %d queued for %s, image %s loading\n", job->id, job->deviceName, job->imageName);
+        return;
+    }
+
+    attachImage(job, entry, hit);
+}
+
+/**
+ * hand the image of a loader that exited to the jobs waiting for it
+ */
+static void publishImage(IMAGE_ENTRY *loaded, int succeeded)
+{
+    IMAGE_ENTRY *entry = finishImageLoad(loaded, succeeded);
+    JOB *job;
+    JOB *next;
+
+    for(job = g_jobList; job != NULL; job = next)
+    {
+        next = job->next;
+
+        if(job->image != loaded)
+        {
+            continue;
+        }
+
+        if(entry == NULL)
+        {
+            dprintf(job->client, PREFIX "error: failed to load image %s\n", job->imageName);
+            job->image = NULL;
+            finishJob(job, -1);
+        }
+        else
+        {
+            attachImage(job, entry, entry != loaded);
+        }
+    }
+}
+
+/**
+ * reap exited jobs and image loaders
+ */
+static void reapChildren(void)
+{
+    pid_t pid;
+    int status;
+    int i;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        JOB *job;
+
+        for(job = g_jobList; job != NULL && job->pid != pid; job = job->next);
+
+        if(job != NULL)
+        {
+            g_runningJobCnt--;
+            finishJob(job, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            continue;
+        }
+
+        for(i = 0; i < IMAGE_CACHE_SIZE; i++)
+        {
+            if(g_imageCache[i].loader == pid)
+            {
+                publishImage(&g_imageCache[i], WIFEXITED(status) && WEXITSTATUS(status) == 0);
+                break;
+            }
+        }
+    }
+}
+
+static void rejectClient(PENDING_CLIENT *pending, const char *reason)
+{
+    dprintf(pending->fd, PREFIX "error: %s\n" PREFIX "job 0 finished with status -1\n", reason);
+    close(pending->fd);
+    pending->fd = -1;
+    g_pendingClientCnt--;
+}
+
+/**
+ * accept a client, whose request is read as it arrives
+ */
+static void acceptClient(int listener)
+{
+    int client;
+    int i;
+
+    if((client = accept(listener, NULL, NULL)) < 0)
+    {
+        return;
+    }
+
+    for(i = 0; g_pendingClients[i].fd >= 0; i++);
+
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    g_pendingClients[i].fd = client;
+    g_pendingClients[i].length = 0;
+    g_pendingClients[i].deadline = now() + REQUEST_TIMEOUT_SEC * 1000000000ULL;
+    g_pendingClientCnt++;
+}
+
+/**
+ * read what a client has sent of its request and queue the job once the line
+ * is complete
+ */
+static void readRequest(PENDING_CLIENT *pending)
+{
+    ssize_t size = read(pending->fd, &pending->request[pending->length], REQUEST_SIZE - pending->length);
+    char *end;
+    int client;
+
+    if(size < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+        return;
+    }
+
+    if(size <= 0)
+    {
+        rejectClient(pending, "expected <device> TAB <image> LF");
+        return;
+    }
+
+    pending->length += size;
+    if((end = memchr(pending->request, '\n', pending->length)) == NULL)
+    {
+        if(pending->length == REQUEST_SIZE)
+        {
+            rejectClient(pending, "expected <device> TAB <image> LF");
+        }
+        return;
+    }
+
+    client = pending->fd;
+    pending->fd = -1;
+    g_pendingClientCnt--;
+
+    /*the session writes its output to the client as a blocking stdout*/
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+    queueJob(client, pending->request, end);
+}
+
+/******************************************************************************
+ * daemon
+ */
+
+static int openListener(const char *socketPath)
+{
+    struct sockaddr_un address;
+    int listener;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        ERROR("socket path too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    if((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        ERROR("socket() fail\n");
+        return -1;
+    }
+
+    /*a socket nobody answers on is left over from a daemon that died*/
+    if(connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0)
+    {
+        ERROR("a daemon is already listening on %s\n", socketPath);
+        close(listener);
+        return -1;
+    }
+    close(listener);
+    unlink(socketPath);
+
+    if((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+       bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        ERROR("failed to listen on %s: %s\n", socketPath, strerror(errno));
+        if(listener >= 0)
+        {
+            close(listener);
+        }
+        return -1;
+    }
+
+    return listener;
+}
+
+int daemon_run(const char *socketPath, int maxJobs, DAEMON_SESSION session)
+{
+    struct pollfd fds[2 + MAX_PENDING_CLIENTS];
+    PENDING_CLIENT *polled[2 + MAX_PENDING_CLIENTS];
+    sigset_t mask;
+    int stopping = 0;
+    int listener;
+    int signals;
+    int i;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    /*a client that goes away must not kill the session flashing its board*/
+    signal(SIGPIPE, SIG_IGN);
+
+    for(i = 0; i < MAX_PENDING_CLIENTS; i++)
+    {
+        g_pendingClients[i].fd = -1;
+    }
+
+    if((listener = openListener(socketPath)) < 0)
+    {
+        return -1;
+    }
+
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if((signals = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+    {
+        ERROR("signalfd() fail\n");
+        close(listener);
+        unlink(socketPath);
+        return -1;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    LOG("listening on %s, up to %d jobs at once\n", socketPath, maxJobs);
+
+    while(!stopping || g_runningJobCnt > 0)
+    {
+        uint64_t time = now();
+        int timeout = -1;
+        int fdCnt = 2;
+
+        /*new clients wait in the listen backlog while every pending slot is taken*/
+        fds[0].fd = (stopping || g_pendingClientCnt == MAX_PENDING_CLIENTS) ? -1 : listener;
+        fds[0].events = POLLIN;
+        fds[1].fd = signals;
+        fds[1].events = POLLIN;
+
+        for(i = 0; i < MAX_PENDING_CLIENTS; i++)
+        {
+            PENDING_CLIENT *pending = &g_pendingClients[i];
+            int remaining;
+
+            if(pending->fd < 0)
+            {
+                continue;
+            }
+
+            remaining = (pending->deadline > time) ? (pending->deadline - time + 999999) / 1000000 : 0;
+            if(timeout < 0 || remaining < timeout)
+            {
+                timeout = remaining;
+            }
+
+            fds[fdCnt].fd = pending->fd;
+            fds[fdCnt].events = POLLIN;
+            polled[fdCnt++] = pending;
+        }
+
+        if(poll(fds, fdCnt, timeout) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+
+            if(read(signals, &info, sizeof(info)) == sizeof(info) && info.ssi_signo != SIGCHLD && !stopping)
+            {
+                LOG("stopping, waiting for %d running jobs\n", g_runningJobCnt);
+                stopping = 1;
+            }
+            reapChildren();
+        }
+
+        for(i = 2; i < fdCnt; i++)
+        {
+            if(polled[i]->fd < 0)
+            {
+                continue;
+            }
+
+            if(stopping)
+            {
+                rejectClient(polled[i], "daemon stopped");
+            }
+            else if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                readRequest(polled[i]);
+            }
+            else if(now() >= polled[i]->deadline)
+            {
+                rejectClient(polled[i], "expected <device> TAB <image> LF");
+            }
+        }
+
+        if(!stopping && (fds[0].revents & POLLIN))
+        {
+            acceptClient(listener);
+        }
+
+        if(!stopping)
+        {
+            startJobs(maxJobs, session, listener, signals, &mask);
+        }
+    }
+
+    /*jobs still queued never started*/
+    while(g_jobList != NULL)
+    {
+        dprintf(g_jobList->client, PREFIX "error: daemon stopped\n");
+        finishJob(g_jobList, -1);
+    }
+
+    for(i = 0; i < MAX_PENDING_CLIENTS; i++)
+    {
+        if(g_pendingClients[i].fd >= 0)
+        {
+            rejectClient(&g_pendingClients[i], "daemon stopped");
+        }
+    }
+
+    close(signals);
+    close(listener);
+    unlink(socketPath);
+    cleanupImageCache();
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return 0;
+}
+
+/******************************************************************************
+ * client
+ */
+
+int daemon_submit(const char *socketPath, const char *deviceName, const char *imageName)
+{
+    struct sockaddr_un address;
+    char devicePath[PATH_MAX];
+    char imagePath[PATH_MAX];
+    char line[1024];
+    size_t length = 0;
+    int status = -1;
+    int server;
+
+    /*the daemon has its own working directory, and a port has one queue whatever link names it*/
+    if(realpath(deviceName, devicePath) == NULL)
+    {
+        snprintf(devicePath, sizeof(devicePath), "%s", deviceName);
+    }
+
+    if(realpath(imageName, imagePath) == NULL)
+    {
+        ERROR("image %s not found\n", imageName);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+    if((server = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(server, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        ERROR("no daemon listening on %s\n", socketPath);
+        if(server >= 0)
+        {
+            close(server);
+        }
+        return -1;
+    }
+
+    if(dprintf(server, "%s\t%s\n", devicePath, imagePath) < 0)
+    {
+        ERROR("failed to submit the job\n");
+        close(server);
+        return -1;
+    }
+
+    while(1)
+    {
+        ssize_t size = read(server, &line[length], sizeof(line) - 1 - length);
+        char *start = line;
+        char *end;
+
+        if(size <= 0)
+        {
+            break;
+        }
+        length += size;
+
+        /*pass the output through line by line, picking out the result*/
+        while((end = memchr(start, '\n', &line[length] - start)) != NULL)
+        {
+            int jobId;
+
+            *end = '\0';
+            if(sscanf(start, PREFIX "job %d finished with status %d", &jobId, &status) != 2)
+            {
+                printf("%s\n", start);
+            }
+            start = end + 1;
+        }
+
+        length = &line[length] - start;
+        memmove(line, start, length);
+
+        /*a line longer than the buffer is passed on in pieces*/
+        if(length == sizeof(line) - 1)
+        {
+            fwrite(line, 1, length, stdout);
+            length = 0;
+        }
+    }
+
+    close(server);
+    return status;
+}
@@ -0,0 +1,56 @@
+/**
+ * flashing daemon
+ *
+ * Serves flashing jobs over a Unix stream socket. A client connects and sends
+ * one request line:
+ *
+ *   <device path> TAB <image path> LF
+ *
+ * The daemon streams the session output back as it is produced and ends with
+ *
+ *   rx63nprogd: job <id> finished with status <status> LF
+ *
+ * then closes the connection. Status 0 means success.
+ *
+ * Images are framed into page caches kept in a content-addressed cache, so a
+ * job on an image that was already flashed starts without reading, parsing or
+ * framing it. A new image is hashed, parsed and framed in a loader process,
+ * and requests are read as they arrive, so neither a large image nor a slow
+ * client holds up the jobs on other ports. Each job runs in a child process forked from the daemon and
+ * reads the shared frames; jobs on different ports run concurrently, and jobs
+ * on the same port are queued.
+ */
+
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include "pagecache.h"
+
+#define DAEMON_DEFAULT_JOBS     8
+
+/**
+ * session run for every job, in the job's child process
+ *
+ * 0 if successful, non-zero otherwise
+ */
+typedef int (*DAEMON_SESSION)(const char *deviceName, const PAGECACHE *frames);
+
+/**
+ * serve jobs until SIGINT or SIGTERM
+ *
+ * socketPath - path of the Unix socket to listen on
+ * maxJobs - maximum number of jobs running at once
+ * session - function that flashes one device
+ *
+ * 0 if stopped by a signal, non-zero if the daemon could not start
+ */
+int daemon_run(const char *socketPath, int maxJobs, DAEMON_SESSION session);
+
+/**
+ * submit a job to a daemon and copy its output to stdout
+ *
+ * status of the job, or -1 if the daemon could not be reached
+ */
+int daemon_submit(const char *socketPath, const char *deviceName, const char *imageName);
+
+#endif /* DAEMON_H_ */
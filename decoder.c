@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+
+/*
+ * response shape of every command; commands not listed answer with a single
+ * status byte
+ */
+static const DECODER_RULE g_rules[256] = {
+    [0x10] = { .frameReply = 0,    .errorReply = 0x90 }, /*device selection*/
+    [0x11] = { .frameReply = 0,    .errorReply = 0x91 }, /*clock mode selection*/
+    [0x20] = { .frameReply = 0x30, .errorReply = 0xa0 }, /*supported device inquiry*/
+    [0x21] = { .frameReply = 0x31, .errorReply = 0xa1 }, /*clock mode inquiry*/
+    [0x22] = { .frameReply = 0x32, .errorReply = 0xa2 }, /*multiplication ratio inquiry*/
+    [0x23] = { .frameReply = 0x33, .errorReply = 0xa3 }, /*operating frequency inquiry*/
+    [0x24] = { .frameReply = 0x34, .errorReply = 0xa4 }, /*user boot area information inquiry*/
+    [0x25] = { .frameReply = 0x35, .errorReply = 0xa5 }, /*user area information inquiry*/
+    [0x26] = { .frameReply = 0x36, .errorReply = 0xa6, .sizeBytes = 2 }, /*block information inquiry*/
+    [0x27] = { .frameReply = 0x37, .errorReply = 0xa7 }, /*programming size inquiry*/
+    [0x2a] = { .frameReply = 0x3a, .errorReply = 0xaa }, /*data area inquiry*/
+    [0x2b] = { .frameReply = 0x3b, .errorReply = 0xab }, /*data area information inquiry*/
+    [0x3f] = { .frameReply = 0,    .errorReply = 0xbf }, /*new bit rate selection*/
+    [0x4f] = { .frameReply = 0x5f, .errorReply = 0xcf }, /*boot program status inquiry*/
+    [0x50] = { .frameReply = 0,    .errorReply = 0xd0 }, /*256-byte programming*/
+    /*
+     * 0x40 answers 0x26 or 0x16 and, despite the specification, only one
+     * byte on error; 0x55 answers 0xe6 or 0xff
+     */
+};
+
+void decoder_start(DECODER *decoder, unsigned char command, void *buffer, int capacity)
+{
+    decoder->rule = &g_rules[command];
+    decoder->buffer = buffer;
+    decoder->capacity = capacity;
+    decoder->length = 0;
+    decoder->expected = 1;
+    decoder->status = (capacity < 1) ? DECODER_OVERFLOW : DECODER_MORE;
+}
+
+/**
+ * length of the reply byte and size field of a frame response
+ */
+static int frameHeader(const DECODER_RULE *rule)
+{
+    return 1 + ((rule->sizeBytes != 0) ? rule->sizeBytes : 1);
+}
+
+/**
+ * work out the next expected length once the current one has been received
+ */
+static void advance(DECODER *decoder)
+{
+    const uint8_t *buffer = decoder->buffer;
+    int isFrame = decoder->rule->frameReply != 0 && buffer[0] == decoder->rule->frameReply;
+    int header = frameHeader(decoder->rule);
+
+    if(decoder->length == 1 && (isFrame || decoder_isError(decoder)))
+    {
+        decoder->expected = isFrame ? header : 2;
+    }
+    else if(decoder->length == header && isFrame)
+    {
+        int size = 0;
+        int i;
+
+        /*big-endian size field*/
+        for(i = 1; i < header; i++)
+        {
+            size = (size << 8) | buffer[i];
+        }
+
+        decoder->expected = header + size + 1;
+    }
+    else
+    {
+        if(isFrame)
+        {
+            uint8_t sum = 0;
+            int i;
+
+            for(i = 0; i < decoder->length; i++)
+            {
+                sum += buffer[i];
+            }
+
+            decoder->status = (sum == 0) ? DECODER_DONE : DECODER_CHECKSUM;
+        }
+        else
+        {
+            decoder->status = DECODER_DONE;
+        }
+        return;
+    }
+
+    if(decoder->expected > decoder->capacity)
+    {
+        decoder->status = DECODER_OVERFLOW;
+    }
+}
+
+int decoder_feed(DECODER *decoder, const void *data, int size)
+{
+    int consumed = 0;
+
+    while(consumed < size && decoder->status == DECODER_MORE)
+    {
+        int count = decoder->expected - decoder->length;
+        uint8_t *tail = &decoder->buffer[decoder->length];
+
+        if(count > size - consumed)
+        {
+            count = size - consumed;
+        }
+
+        if((const uint8_t *)data + consumed != tail)
+        {
+            memmove(tail, (const uint8_t *)data + consumed, count);
+        }
+
+        decoder->length += count;
+        consumed += count;
+
+        if(decoder->length == decoder->expected)
+        {
+            advance(decoder);
+        }
+    }
+
+    return consumed;
+}
+
+#ifdef DECODER_STANDALONE
+#include <time.h>
+
+static uint32_t g_random = 2463534242u;
+
+static uint32_t nextRandom(void)
+{
+    g_random ^= g_random << 13;
+    g_random ^= g_random >> 17;
+    g_random ^= g_random << 5;
+    return g_random;
+}
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * build a random response to command, returning its length
+ */
+static int makeResponse(unsigned char command, uint8_t *response, DECODER_STATUS *status)
+{
+    const DECODER_RULE *rule = &g_rules[command];
+    uint32_t shape = nextRandom() % 4;
+    uint8_t sum = 0;
+    int header;
+    int size;
+    int i;
+
+    *status = DECODER_DONE;
+
+    if(shape == 0 && rule->errorReply != 0)
+    {
+        response[0] = rule->errorReply;
+        response[1] = nextRandom();
+        return 2;
+    }
+
+    if(rule->frameReply == 0)
+    {
+        /*any status byte but the error code*/
+        do
+        {
+            response[0] = nextRandom();
+        } while(rule->errorReply != 0 && response[0] == rule->errorReply);
+        return 1;
+    }
+
+    /*a wide size field also gets sizes past 255*/
+    header = frameHeader(rule);
+    size = nextRandom() % ((header > 2) ? 290 : 256);
+    response[0] = rule->frameReply;
+    for(i = 1; i < header; i++)
+    {
+        response[i] = size >> (8 * (header - 1 - i));
+    }
+    for(i = 0; i < size + header; i++)
+    {
+        if(i >= header)
+        {
+            response[i] = nextRandom();
+        }
+        sum += response[i];
+    }
+    response[size + header] = -sum;
+
+    /*one in four frames is corrupted*/
+    if(shape == 1)
+    {
+        response[header + nextRandom() % (size + 1)] ^= 1 + nextRandom() % 255;
+        *status = DECODER_CHECKSUM;
+    }
+
+    return size + header + 1;
+}
+
+/**
+ * decode responses fed in random fragments, followed by the start of the next
+ * response, and check that the decoder stops exactly at the end of each one
+ */
+static int fuzz(int rounds)
+{
+    static const unsigned char commands[] = { 0x00, 0x06, 0x10, 0x11, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x2b, 0x3f, 0x40, 0x42, 0x43, 0x4f, 0x50, 0x55 };
+    uint8_t stream[512];
+    uint8_t buffer[300];
+    int failures = 0;
+    int round;
+
+    for(round = 0; round < rounds; round++)
+    {
+        unsigned char command = commands[nextRandom() % sizeof(commands)];
+        DECODER_STATUS expectedStatus;
+        int length = makeResponse(command, stream, &expectedStatus);
+        int streamLength = length + 1 + nextRandom() % 8;
+        int capacity = (nextRandom() % 8 == 0) ? 1 + nextRandom() % length : (int)sizeof(buffer);
+        int consumed = 0;
+        DECODER decoder;
+        int i;
+
+        for(i = length; i < streamLength; i++)
+        {
+            stream[i] = nextRandom();
+        }
+
+        if(capacity < length)
+        {
+            expectedStatus = DECODER_OVERFLOW;
+        }
+
+        decoder_start(&decoder, command, buffer, capacity);
+        while(consumed < streamLength && decoder.status == DECODER_MORE)
+        {
+            consumed += decoder_feed(&decoder, &stream[consumed], 1 + nextRandom() % (streamLength - consumed));
+        }
+
+        if(decoder.status != expectedStatus ||
+           (expectedStatus != DECODER_OVERFLOW && (consumed != length || decoder.length != length || memcmp(buffer, stream, length) != 0)))
+        {
+            fprintf(stderr, "round %d: command %.2x, length %d, capacity %d: status %d (expected %d), consumed %d\n",
+                    round, command, length, capacity, decoder.status, expectedStatus, consumed);
+            failures++;
+        }
+    }
+
+    printf("fuzz: %d rounds, %d failures\n", rounds, failures);
+    return failures;
+}
+
+/**
+ * decode a block information reply built by hand, whose 264 data bytes need
+ * both bytes of its size field
+ */
+static int blockInformation(void)
+{
+    uint8_t stream[300];
+    uint8_t buffer[300];
+    int length = 264 + 4;
+    uint8_t sum = 0;
+    DECODER decoder;
+    int consumed;
+    int i;
+
+    stream[0] = 0x36;
+    stream[1] = 264 >> 8;
+    stream[2] = 264 & 0xff;
+    for(i = 0; i < length - 1; i++)
+    {
+        if(i >= 3)
+        {
+            stream[i] = nextRandom();
+        }
+        sum += stream[i];
+    }
+    stream[length - 1] = -sum;
+    stream[length] = 0x06;
+
+    decoder_start(&decoder, 0x26, buffer, sizeof(buffer));
+    consumed = decoder_feed(&decoder, stream, length + 1);
+
+    if(decoder.status != DECODER_DONE || consumed != length)
+    {
+        fprintf(stderr, "block information: status %d, consumed %d of %d\n", decoder.status, consumed, length);
+        return -1;
+    }
+
+    printf("block information: %d byte reply decoded\n", length);
+    return 0;
+}
+
+/**
+ * decode throughput of a response with size data bytes (0 for a status byte),
+ * fed in fragments of the given length
+ */
+static void benchmark(unsigned char command, int size, int fragment)
+{
+    static uint8_t stream[300];
+    uint8_t buffer[300];
+    int length = 1;
+    int iterations;
+    uint64_t start;
+    uint64_t elapsed;
+    int i;
+
+    stream[0] = 0x06;
+    if(size > 0)
+    {
+        uint8_t sum = g_rules[command].frameReply + size;
+
+        stream[0] = g_rules[command].frameReply;
+        stream[1] = size;
+        for(i = 2; i < size + 2; i++)
+        {
+            sum += (stream[i] = nextRandom());
+        }
+        stream[size + 2] = -sum;
+        length = size + 3;
+    }
+    iterations = 20000000 / length;
+
+    start = now();
+    for(i = 0; i < iterations; i++)
+    {
+        DECODER decoder;
+        int offset = 0;
+
+        decoder_start(&decoder, command, buffer, sizeof(buffer));
+        while(decoder.status == DECODER_MORE)
+        {
+            offset += decoder_feed(&decoder, &stream[offset], (length - offset < fragment) ? length - offset : fragment);
+        }
+
+        if(decoder.status != DECODER_DONE)
+        {
+            fprintf(stderr, "benchmark: decoding failed\n");
+            return;
+        }
+    }
+    elapsed = now() - start;
+
+    printf("benchmark: command %.2x, %3d byte response in %3d byte fragments: %7.1f ns/response, %7.1f MB/s\n",
+           command, length, fragment, (double)elapsed / iterations, (double)length * iterations * 1e3 / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 200000;
+
+    if(fuzz(rounds) != 0 || blockInformation() != 0)
+    {
+        return -1;
+    }
+
+    benchmark(0x50, 0, 1);
+    benchmark(0x20, 10, 1);
+    benchmark(0x20, 10, 300);
+    benchmark(0x25, 17, 1);
+    benchmark(0x25, 17, 300);
+    benchmark(0x25, 255, 1);
+    benchmark(0x25, 255, 300);
+
+    return 0;
+}
+#endif
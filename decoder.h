@@ -0,0 +1,68 @@
+/**
+ * incremental boot mode response decoder
+ *
+ * The response to a command takes one of three shapes. The first byte
+ * received picks the shape, using the command table in decoder.c:
+ *
+ *   status      1 byte                 0x06, 0xe6, 0x26, ...
+ *   error       2 bytes                error code, error byte (0xd0 0x2a, ...)
+ *   frame       size + 3 bytes         reply, size, data[size], checksum
+ *
+ * The size of a frame is one byte, except where the command's rule gives a
+ * wider big-endian size field (2 bytes for the 0x36 block information reply).
+ *
+ * Bytes may be fed in any fragmentation. The decoder never consumes past
+ * the end of the response, and it checks the checksum of frames.
+ */
+
+#ifndef DECODER_H_
+#define DECODER_H_
+
+#include <stdint.h>
+
+typedef enum {
+    DECODER_MORE,               /*the response is incomplete*/
+    DECODER_DONE,               /*the response is complete*/
+    DECODER_OVERFLOW,           /*the response does not fit the buffer*/
+    DECODER_CHECKSUM,           /*the frame checksum is wrong*/
+} DECODER_STATUS;
+
+typedef struct {
+    uint8_t frameReply;         /*first byte of a frame response, 0 if the command has none*/
+    uint8_t errorReply;         /*first byte of an error response, 0 if the command has none*/
+    uint8_t sizeBytes;          /*width of the frame size field, 0 meaning 1*/
+} DECODER_RULE;
+
+typedef struct {
+    const DECODER_RULE *rule;
+    uint8_t *buffer;
+    int capacity;
+    int length;
+    int expected;               /*length known to be needed so far*/
+    DECODER_STATUS status;
+} DECODER;
+
+/**
+ * start decoding the response to command into buffer
+ */
+void decoder_start(DECODER *decoder, unsigned char command, void *buffer, int capacity);
+
+/**
+ * feed received bytes
+ *
+ * data may point at the free part of the decoder buffer, so that bytes can be
+ * received in place.
+ *
+ * number of bytes consumed; fewer than size once the response is complete
+ */
+int decoder_feed(DECODER *decoder, const void *data, int size);
+
+/**
+ * non-zero if the completed response is the command's error response
+ */
+static inline int decoder_isError(const DECODER *decoder)
+{
+    return decoder->rule->errorReply != 0 && decoder->length > 0 && decoder->buffer[0] == decoder->rule->errorReply;
+}
+
+#endif /* DECODER_H_ */
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flashplan.h"
+#include "intelhex/intelhex.h"
+
+#define PREFIX                  "flashplan: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+
+static const uint32_t g_estimateBitRates[FLASHPLAN_ESTIMATE_COUNT] = { 9600, 19200, 38400, 57600, 115200, 230400 };
+
+int flashplan_open(const char *filename, FLASHPLAN *plan)
+{
+    const FLASHPLAN_HEADER *header;
+    struct stat status;
+    void *map;
+    uint32_t i;
+    int file;
+
+    if((file = open(filename, O_RDONLY)) < 0)
+    {
+        ERROR("failed to open \"%s\" file for reading\n", filename);
+        return -1;
+    }
+
+    if(fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(FLASHPLAN_HEADER))
+    {
+        ERROR("\"%s\" is truncated\n", filename);
+        close(file);
+        return -1;
+    }
+
+    map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if(map == MAP_FAILED)
+    {
+        ERROR("failed to map \"%s\"\n", filename);
+        return -1;
+    }
+
+    plan->header = header = map;
+    plan->frames = (const uint8_t *)map + header->headerSize;
+    plan->size = status.st_size;
+
+    if(memcmp(header->magic, FLASHPLAN_MAGIC, 8) != 0 || header->version != FLASHPLAN_VERSION || header->headerSize != sizeof(FLASHPLAN_HEADER))
+    {
+        ERROR("\"%s\" is not a version %d flash plan\n", filename, FLASHPLAN_VERSION);
+        flashplan_close(plan);
+        return -1;
+    }
+
+    if(header->stepCnt > FLASHPLAN_MAX_STEPS || plan->size != header->headerSize + (size_t)header->frameCnt * FLASHPLAN_FRAME_SIZE)
+    {
+        ERROR("\"%s\" is truncated\n", filename);
+        flashplan_close(plan);
+        return -1;
+    }
+
+    for(i = 0; i < header->stepCnt; i++)
+    {
+        if(header->steps[i].firstFrame > header->frameCnt || header->steps[i].frameCnt > header->frameCnt - header->steps[i].firstFrame)
+        {
+            ERROR("\"%s\" has a step outside its frames\n", filename);
+            flashplan_close(plan);
+            return -1;
+        }
+    }
+
+    /*every frame must be a programming command with a valid checksum*/
+    for(i = 0; i < header->frameCnt; i++)
+    {
+        const uint8_t *frame = flashplan_frame(plan, i);
+
+        if(frame[0] != 0x50 || intelHex_byteSum(frame, FLASHPLAN_FRAME_SIZE) != 0)
+        {
+            ERROR("\"%s\" has a corrupted frame %u\n", filename, i);
+            flashplan_close(plan);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void flashplan_close(FLASHPLAN *plan)
+{
+    if(plan->header != NULL)
+    {
+        munmap((void *)plan->header, plan->size);
+        plan->header = NULL;
+        plan->frames = NULL;
+    }
+}
+
+int flashplan_create(FLASHPLAN_WRITER *writer, const char *filename, const uint8_t deviceCode[4])
+{
+    memset(writer, 0, sizeof(FLASHPLAN_WRITER));
+    memcpy(writer->header.magic, FLASHPLAN_MAGIC, 8);
+    writer->header.version = FLASHPLAN_VERSION;
+    writer->header.headerSize = sizeof(FLASHPLAN_HEADER);
+    memcpy(writer->header.deviceCode, deviceCode, 4);
+
+    if((writer->filename = strdup(filename)) == NULL || (writer->tempName = malloc(strlen(filename) + 5)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        free(writer->filename);
+        return -1;
+    }
+
+    /*written next to the plan and renamed over it, so a session never maps a half-written plan*/
+    sprintf(writer->tempName, "%s.tmp", filename);
+    if((writer->file = fopen(writer->tempName, "wb")) == NULL)
+    {
+        ERROR("failed to open \"%s\" file for writing\n", writer->tempName);
+        free(writer->tempName);
+        free(writer->filename);
+        return -1;
+    }
+
+    /*the header is rewritten once the frames are known*/
+    if(fwrite(&writer->header, sizeof(FLASHPLAN_HEADER), 1, writer->file) != 1)
+    {
+        ERROR("failed to write \"%s\"\n", writer->tempName);
+        flashplan_abort(writer);
+        return -1;
+    }
+
+    return 0;
+}
+
+int flashplan_addStep(FLASHPLAN_WRITER *writer, uint8_t selection)
+{
+    FLASHPLAN_STEP *step;
+
+    if(writer->header.stepCnt == FLASHPLAN_MAX_STEPS)
+    {
+        ERROR("too many steps\n");
+        return -1;
+    }
+
+    step = &writer->header.steps[writer->header.stepCnt++];
+    step->selection = selection;
+    step->firstFrame = writer->header.frameCnt;
+    step->frameCnt = 0;
+    return 0;
+}
+
+int flashplan_addFrame(FLASHPLAN_WRITER *writer, const struct iovec *vector, int vectorCnt)
+{
+    size_t size = 0;
+    int i;
+
+    if(writer->header.stepCnt == 0)
+    {
+        ERROR("frame outside of a step\n");
+        return -1;
+    }
+
+    for(i = 0; i < vectorCnt; i++)
+    {
+        size += vector[i].iov_len;
+        if(fwrite(vector[i].iov_base, 1, vector[i].iov_len, writer->file) != vector[i].iov_len)
+        {
+            ERROR("failed to write \"%s\"\n", writer->tempName);
+            return -1;
+        }
+    }
+
+    if(size != FLASHPLAN_FRAME_SIZE)
+    {
+        ERROR("frame of %zu bytes\n", size);
+        return -1;
+    }
+
+    writer->header.steps[writer->header.stepCnt - 1].frameCnt++;
+    writer->header.frameCnt++;
+    return 0;
+}
+
+int flashplan_finish(FLASHPLAN_WRITER *writer)
+{
+    FLASHPLAN_HEADER *header = &writer->header;
+    int failed;
+    int i;
+
+    /*
+     * 8N1 characters: the frames and their one byte ACKs, the selection and
+     * termination commands of every step, and the flash programming time
+     */
+    for(i = 0; i < FLASHPLAN_ESTIMATE_COUNT; i++)
+    {
+        uint64_t bytes = (uint64_t)header->frameCnt * (FLASHPLAN_FRAME_SIZE + 1) + header->stepCnt * (1 + 1 + 6 + 1);
+
+        header->estimates[i].bitRate = g_estimateBitRates[i];
+        header->estimates[i].milliseconds = bytes * 10 * 1000 / g_estimateBitRates[i] + (uint64_t)header->frameCnt * FLASHPLAN_PAGE_PROGRAM_US / 1000;
+    }
+
+    failed = fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(FLASHPLAN_HEADER), 1, writer->file) != 1;
+    failed |= fclose(writer->file) != 0;
+    writer->file = NULL;
+
+    if(failed || rename(writer->tempName, writer->filename) != 0)
+    {
+        ERROR("failed to write \"%s\"\n", writer->filename);
+        flashplan_abort(writer);
+        return -1;
+    }
+
+    free(writer->tempName);
+    free(writer->filename);
+    return 0;
+}
+
+void flashplan_abort(FLASHPLAN_WRITER *writer)
+{
+    if(writer->file != NULL)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+
+    remove(writer->tempName);
+    free(writer->tempName);
+    free(writer->filename);
+}
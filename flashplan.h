@@ -0,0 +1,114 @@
+/**
+ * precompiled flash plan
+ *
+ * A flash plan holds an image already split into programming selections and
+ * framed as 256-byte programming commands, with the page padding, address
+ * and checksum in place. It is compiled once for a device and then mapped by
+ * every session, which writes the frames to the port as they are.
+ *
+ * plan file format (host byte order, like the profile cache)
+ *
+ * offset         size (bytes)                 description
+ * --------------------------------------------------------------------
+ * 0              sizeof(FLASHPLAN_HEADER)     header
+ * headerSize     frameCnt * 262               0x50 frames of all steps, in order
+ * --------------------------------------------------------------------
+ */
+
+#ifndef FLASHPLAN_H_
+#define FLASHPLAN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define FLASHPLAN_MAGIC                 "RX63NPLN"
+#define FLASHPLAN_VERSION               1
+#define FLASHPLAN_FRAME_SIZE            262     /*0x50, address, 256 data bytes, checksum*/
+#define FLASHPLAN_MAX_STEPS             2
+#define FLASHPLAN_ESTIMATE_COUNT        6
+#define FLASHPLAN_PAGE_PROGRAM_US       2000    /*typical 256-byte programming time of the RX63N flash*/
+
+typedef struct {
+    uint8_t selection;                  /*0x42 or 0x43*/
+    uint8_t reserved[3];
+    uint32_t firstFrame;
+    uint32_t frameCnt;
+} FLASHPLAN_STEP;
+
+typedef struct {
+    uint32_t bitRate;
+    uint32_t milliseconds;
+} FLASHPLAN_ESTIMATE;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint8_t deviceCode[4];              /*device the areas were taken from*/
+    uint32_t frameCnt;
+    uint32_t stepCnt;
+    FLASHPLAN_STEP steps[FLASHPLAN_MAX_STEPS];
+    FLASHPLAN_ESTIMATE estimates[FLASHPLAN_ESTIMATE_COUNT];  /*programming time at common bit rates*/
+} FLASHPLAN_HEADER;
+
+/*mapped plan*/
+typedef struct {
+    const FLASHPLAN_HEADER *header;
+    const uint8_t *frames;
+    size_t size;
+} FLASHPLAN;
+
+/*plan being compiled*/
+typedef struct {
+    FILE *file;
+    char *filename;
+    char *tempName;
+    FLASHPLAN_HEADER header;
+} FLASHPLAN_WRITER;
+
+/**
+ * map a plan file and check its header and frame checksums
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int flashplan_open(const char *filename, FLASHPLAN *plan);
+
+void flashplan_close(FLASHPLAN *plan);
+
+static inline const uint8_t *flashplan_frame(const FLASHPLAN *plan, uint32_t index)
+{
+    return &plan->frames[(size_t)index * FLASHPLAN_FRAME_SIZE];
+}
+
+/**
+ * start compiling a plan for the device with the given code
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int flashplan_create(FLASHPLAN_WRITER *writer, const char *filename, const uint8_t deviceCode[4]);
+
+/**
+ * start the next programming selection; frames added after it belong to it
+ */
+int flashplan_addStep(FLASHPLAN_WRITER *writer, uint8_t selection);
+
+/**
+ * append one frame, given as an iovec of FLASHPLAN_FRAME_SIZE bytes in total
+ */
+int flashplan_addFrame(FLASHPLAN_WRITER *writer, const struct iovec *vector, int vectorCnt);
+
+/**
+ * fill in the estimates and the header, and move the plan into place
+ *
+ * 0 if successful, non-zero otherwise; the writer is released either way
+ */
+int flashplan_finish(FLASHPLAN_WRITER *writer);
+
+/**
+ * drop a plan being compiled
+ */
+void flashplan_abort(FLASHPLAN_WRITER *writer);
+
+#endif /* FLASHPLAN_H_ */
@@ -0,0 +1,785 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <signal.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include "fleet.h"
+
+#define PREFIX                  "fleet: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+#define LOG(...)                fprintf(stdout, PREFIX __VA_ARGS__)
+
+#define HUB_NAME_LEN            64
+#define LINE_LEN                256
+#define RATE_MIN_PAGES          8       /*pages programmed before a page rate counts*/
+#define CHECK_INTERVAL_MS       100
+
+typedef enum {
+    BOARD_QUEUED,
+    BOARD_RUNNING,
+    BOARD_DONE,
+} BOARD_STATE;
+
+typedef struct {
+    char *deviceName;
+    char hub[HUB_NAME_LEN];
+    BOARD_STATE state;
+    pid_t pid;
+    int output;                 /*child stdout and stderr, -1 once closed*/
+    int report;                 /*child page records, -1 once closed*/
+    char line[LINE_LEN];
+    int lineLength;
+    int pageCnt;
+    int pageTotal;
+    uint64_t started;
+    uint64_t programmingStarted;
+    uint64_t pageTime;          /*time of the last page record*/
+    uint64_t finished;
+    uint64_t notBefore;         /*earliest start*/
+    int status;
+    int isStraggler;
+} BOARD;
+
+static int g_reportHandle = -1;
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int count)
+{
+    qsort(values, count, sizeof(double), compareDouble);
+    return (count % 2) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+void fleet_page(int pageCnt, int pageTotal)
+{
+    int record[2] = { pageCnt, pageTotal };
+
+    if(g_reportHandle >= 0 && write(g_reportHandle, record, sizeof(record)) != sizeof(record))
+    {
+        g_reportHandle = -1;
+    }
+}
+
+/******************************************************************************
+ * hubs
+ */
+
+/**
+ * non-zero if name is a USB device in sysfs, like 1-2 or 1-2.3.1
+ */
+static int isUsbDevice(const char *name)
+{
+    if(!isdigit((unsigned char)*name))
+    {
+        return 0;
+    }
+    while(isdigit((unsigned char)*name))
+    {
+        name++;
+    }
+
+    if(*name++ != '-' || !isdigit((unsigned char)*name))
+    {
+        return 0;
+    }
+    while(isdigit((unsigned char)*name) || *name == '.')
+    {
+        name++;
+    }
+
+    return *name == '\0';
+}
+
+/**
+ * name the hub a serial port is attached to; ports that are not on USB form a
+ * group of their own
+ */
+static void findHub(const char *deviceName, char *hub)
+{
+    char devicePath[PATH_MAX];
+    char sysfsLink[PATH_MAX];
+    char sysfsPath[PATH_MAX];
+    const char *usbDevice = NULL;
+    char *component;
+    char *separator;
+
+    snprintf(hub, HUB_NAME_LEN, "%s", deviceName);
+
+    if(realpath(deviceName, devicePath) == NULL)
+    {
+        return;
+    }
+
+    snprintf(sysfsLink, sizeof(sysfsLink), "/sys/class/tty/%s/device", strrchr(devicePath, '/') + 1);
+    if(realpath(sysfsLink, sysfsPath) == NULL)
+    {
+        return;
+    }
+
+    /*the USB device is the last component like 1-2.3, its hub is 1-2, or the root hub of bus 1 for 1-2*/
+    for(component = strtok(sysfsPath, "/"); component != NULL; component = strtok(NULL, "/"))
+    {
+        if(isUsbDevice(component))
+        {
+            usbDevice = component;
+        }
+    }
+
+    if(usbDevice == NULL)
+    {
+        return;
+    }
+
+    if((separator = strrchr(usbDevice, '.')) != NULL)
+    {
+        snprintf(hub, HUB_NAME_LEN, "usb %.*s", (int)(separator - usbDevice), usbDevice);
+    }
+    else
+    {
+        snprintf(hub, HUB_NAME_LEN, "usb%.*s", (int)(strchr(usbDevice, '-') - usbDevice), usbDevice);
+    }
+}
+
+/******************************************************************************
+ * boards
+ */
+
+static double pageRate(const BOARD *board, uint64_t t)
+{
+    uint64_t end = (board->state == BOARD_DONE) ? board->pageTime : t;
+
+    if(board->programmingStarted == 0 || board->pageCnt < RATE_MIN_PAGES || end <= board->programmingStarted)
+    {
+        return 0;
+    }
+
+    return board->pageCnt * 1e9 / (end - board->programmingStarted);
+}
+
+static void startBoard(BOARD *board, BOARD *boards, int boardCnt, const PAGECACHE *frames, FLEET_SESSION session)
+{
+    int output[2];
+    int report[2];
+    int i;
+
+    if(pipe(output) != 0 || pipe(report) != 0)
+    {
+        ERROR("pipe() fail\n");
+        board->state = BOARD_DONE;
+        board->status = -1;
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if((board->pid = fork()) < 0)
+    {
+        ERROR("fork() fail\n");
+        close(output[0]);
+        close(output[1]);
+        close(report[0]);
+        close(report[1]);
+        board->state = BOARD_DONE;
+        board->status = -1;
+        return;
+    }
+
+    if(board->pid == 0)
+    {
+        int status;
+
+        for(i = 0; i < boardCnt; i++)
+        {
+            if(boards[i].state == BOARD_RUNNING)
+            {
+                close(boards[i].output);
+                close(boards[i].report);
+            }
+        }
+        close(output[0]);
+        close(report[0]);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        close(output[1]);
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        g_reportHandle = report[1];
+
+        status = session(board->deviceName, frames, board - boards);
+        exit(status == 0 ? 0 : 1);
+    }
+
+    close(output[1]);
+    close(report[1]);
+    board->output = output[0];
+    board->report = report[0];
+    board->state = BOARD_RUNNING;
+    board->started = now();
+}
+
+/**
+ * start queued boards while there is room, preferring the hub with the
+ * fewest sessions running so the load spreads over the hubs
+ */
+static void startBoards(BOARD *boards, int boardCnt, int maxJobs, int maxPerHub, const PAGECACHE *frames, FLEET_SESSION session)
+{
+    while(1)
+    {
+        BOARD *next = NULL;
+        int nextLoad = 0;
+        int runningCnt = 0;
+        int i;
+
+        for(i = 0; i < boardCnt; i++)
+        {
+            runningCnt += (boards[i].state == BOARD_RUNNING);
+        }
+
+        if(runningCnt >= maxJobs)
+        {
+            return;
+        }
+
+        for(i = 0; i < boardCnt; i++)
+        {
+            int load = 0;
+            int j;
+
+            if(boards[i].state != BOARD_QUEUED || boards[i].notBefore > now())
+            {
+                continue;
+            }
+
+            for(j = 0; j < boardCnt; j++)
+            {
+                load += (boards[j].state == BOARD_RUNNING && strcmp(boards[j].hub, boards[i].hub) == 0);
+            }
+
+            if(load < maxPerHub && (next == NULL || load < nextLoad))
+            {
+                next = &boards[i];
+                nextLoad = load;
+            }
+        }
+
+        if(next == NULL)
+        {
+            return;
+        }
+
+        startBoard(next, boards, boardCnt, frames, session);
+    }
+}
+
+/**
+ * pass the child output on, a line at a time with the port in front
+ */
+static void readOutput(BOARD *board)
+{
+    char buffer[1024];
+    ssize_t size = read(board->output, buffer, sizeof(buffer));
+    ssize_t i;
+
+    for(i = 0; i < size; i++)
+    {
+        if(buffer[i] != '\n' && board->lineLength < LINE_LEN - 1)
+        {
+            board->line[board->lineLength++] = buffer[i];
+            continue;
+        }
+
+        printf("%s: %.*s\n", board->deviceName, board->lineLength, board->line);
+        board->lineLength = 0;
+
+        /*a line too long for the buffer is split*/
+        if(buffer[i] != '\n')
+        {
+            board->line[board->lineLength++] = buffer[i];
+        }
+    }
+
+    if(size <= 0)
+    {
+        if(board->lineLength > 0)
+        {
+            printf("%s: %.*s\n", board->deviceName, board->lineLength, board->line);
+            board->lineLength = 0;
+        }
+        close(board->output);
+        board->output = -1;
+    }
+}
+
+static void readReports(BOARD *board)
+{
+    int records[64][2];
+    ssize_t size = read(board->report, records, sizeof(records));
+    uint64_t t = now();
+    int i;
+
+    for(i = 0; i < size / (ssize_t)sizeof(records[0]); i++)
+    {
+        board->pageCnt = records[i][0];
+        board->pageTotal = records[i][1];
+        board->pageTime = t;
+
+        if(records[i][0] == 0)
+        {
+            board->programmingStarted = t;
+        }
+    }
+
+    if(size <= 0)
+    {
+        close(board->report);
+        board->report = -1;
+    }
+}
+
+static void finishBoard(BOARD *board)
+{
+    int status;
+
+    waitpid(board->pid, &status, 0);
+    board->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    board->finished = now();
+    board->state = BOARD_DONE;
+
+    LOG("%s %s after %.1f ms\n", board->deviceName, board->status == 0 ? "finished" : "failed", (board->finished - board->started) / 1e6);
+}
+
+/**
+ * flag boards programming well below the median page rate of the fleet
+ */
+static void checkStragglers(BOARD *boards, int boardCnt)
+{
+    uint64_t t = now();
+    double *rates;
+    double medianRate;
+    int rateCnt = 0;
+    int i;
+
+    if(boardCnt < FLEET_STRAGGLER_BOARDS || (rates = malloc(boardCnt * sizeof(double))) == NULL)
+    {
+        return;
+    }
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        if((rates[rateCnt] = pageRate(&boards[i], t)) > 0)
+        {
+            rateCnt++;
+        }
+    }
+
+    if(rateCnt < FLEET_STRAGGLER_BOARDS)
+    {
+        free(rates);
+        return;
+    }
+
+    medianRate = median(rates, rateCnt);
+    free(rates);
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        double rate = pageRate(&boards[i], t);
+
+        if(rate > 0 && !boards[i].isStraggler && rate < medianRate * FLEET_STRAGGLER_RATIO)
+        {
+            boards[i].isStraggler = 1;
+            LOG("%s is a straggler on %s: %.1f pages/s against a fleet median of %.1f pages/s\n",
+                boards[i].deviceName, boards[i].hub, rate, medianRate);
+        }
+    }
+}
+
+static void printReport(const BOARD *boards, int boardCnt, uint64_t start)
+{
+    const BOARD *slowest = NULL;
+    double *times;
+    double medianTime = 0;
+    int timeCnt = 0;
+    int queuedCnt = 0;
+    int i;
+
+    if((times = malloc((boardCnt + 1) * sizeof(double))) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        return;
+    }
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        queuedCnt += (boards[i].state != BOARD_DONE);
+
+        if(boards[i].state == BOARD_DONE && boards[i].status == 0)
+        {
+            times[timeCnt++] = (boards[i].finished - boards[i].started) / 1e6;
+
+            if(slowest == NULL || boards[i].finished - boards[i].started > slowest->finished - slowest->started)
+            {
+                slowest = &boards[i];
+            }
+        }
+    }
+
+    if(timeCnt > 0)
+    {
+        medianTime = median(times, timeCnt);
+    }
+    free(times);
+
+    LOG("%-24s %-16s %-6s %9s %10s %8s %10s\n", "board", "hub", "status", "pages", "time ms", "pages/s", "vs median");
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        const BOARD *board = &boards[i];
+        double time = (board->finished - board->started) / 1e6;
+        char pages[32];
+
+        snprintf(pages, sizeof(pages), "%d/%d", board->pageCnt, board->pageTotal);
+
+        if(board->state == BOARD_DONE && board->status == 0 && medianTime > 0)
+        {
+            LOG("%-24s %-16s %-6s %9s %10.1f %8.1f %+9.1f%%%s\n", board->deviceName, board->hub, "ok", pages, time,
+                pageRate(board, board->finished), (time - medianTime) * 100 / medianTime, board->isStraggler ? " straggler" : "");
+        }
+        else
+        {
+            LOG("%-24s %-16s %-6s %9s %10.1f %8.1f %10s%s\n", board->deviceName, board->hub, board->state == BOARD_DONE ? "failed" : "queued", pages, time,
+                pageRate(board, board->finished), "-", board->isStraggler ? " straggler" : "");
+        }
+    }
+
+    LOG("%d boards, %d ok, %d failed, %d not started in %.1f ms", boardCnt, timeCnt, boardCnt - timeCnt - queuedCnt, queuedCnt, (now() - start) / 1e6);
+    if(slowest != NULL)
+    {
+        printf(", median board %.1f ms, slowest %s %.1f ms", medianTime, slowest->deviceName, (slowest->finished - slowest->started) / 1e6);
+    }
+    printf("\n");
+}
+
+/**
+ * set up a queued board for a port given as <device> or <device>@<hub>
+ */
+static int initBoard(BOARD *board, const char *port)
+{
+    char *separator;
+
+    memset(board, 0, sizeof(BOARD));
+    board->output = board->report = -1;
+
+    if((board->deviceName = strdup(port)) == NULL)
+    {
+        ERROR("strdup() fail\n");
+        return -1;
+    }
+
+    if((separator = strrchr(board->deviceName, '@')) != NULL)
+    {
+        *separator = '\0';
+        snprintf(board->hub, HUB_NAME_LEN, "%s", separator + 1);
+    }
+    else
+    {
+        findHub(board->deviceName, board->hub);
+    }
+
+    return 0;
+}
+
+/**
+ * wait for output and page records of the running boards, and for events on
+ * an extra handle if it is not -1
+ *
+ * fds - room for 1 + 2 * boardCnt entries
+ *
+ * 1 if the extra handle is readable, 0 if not, -1 if there is nothing to wait for
+ */
+static int pollBoards(BOARD *boards, int boardCnt, struct pollfd *fds, int extra)
+{
+    int fdCnt = 0;
+    int i;
+
+    fds[fdCnt].fd = extra;
+    fds[fdCnt++].events = POLLIN;
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        if(boards[i].output >= 0)
+        {
+            fds[fdCnt].fd = boards[i].output;
+            fds[fdCnt++].events = POLLIN;
+        }
+        if(boards[i].report >= 0)
+        {
+            fds[fdCnt].fd = boards[i].report;
+            fds[fdCnt++].events = POLLIN;
+        }
+    }
+
+    if(fdCnt == 1 && extra < 0)
+    {
+        return -1;
+    }
+
+    if(poll(fds, fdCnt, CHECK_INTERVAL_MS) < 0)
+    {
+        if(errno != EINTR)
+        {
+            ERROR("poll() fail\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    /*fds were filled in board order, so they are walked the same way*/
+    fdCnt = 1;
+    for(i = 0; i < boardCnt; i++)
+    {
+        BOARD *board = &boards[i];
+
+        if(board->output >= 0 && (fds[fdCnt++].revents & (POLLIN | POLLHUP)))
+        {
+            readOutput(board);
+        }
+        if(board->report >= 0 && (fds[fdCnt++].revents & (POLLIN | POLLHUP)))
+        {
+            readReports(board);
+        }
+
+        if(board->state == BOARD_RUNNING && board->output < 0 && board->report < 0)
+        {
+            finishBoard(board);
+        }
+    }
+
+    checkStragglers(boards, boardCnt);
+
+    return (extra >= 0 && (fds[0].revents & POLLIN)) ? 1 : 0;
+}
+
+static int countFailures(BOARD *boards, int boardCnt)
+{
+    int failedCnt = 0;
+    int i;
+
+    for(i = 0; i < boardCnt; i++)
+    {
+        failedCnt += (boards[i].state != BOARD_DONE || boards[i].status != 0);
+        free(boards[i].deviceName);
+    }
+
+    return failedCnt;
+}
+
+int fleet_run(const PAGECACHE *frames, char * const *ports, int portCnt, int maxJobs, int maxPerHub, FLEET_SESSION session)
+{
+    struct pollfd *fds;
+    BOARD *boards;
+    uint64_t start = now();
+    int i;
+
+    boards = calloc(portCnt, sizeof(BOARD));
+    fds = calloc(1 + 2 * portCnt, sizeof(struct pollfd));
+    if(boards == NULL || fds == NULL)
+    {
+        ERROR("calloc() fail\n");
+        free(boards);
+        free(fds);
+        return -1;
+    }
+
+    for(i = 0; i < portCnt; i++)
+    {
+        if(initBoard(&boards[i], ports[i]) < 0)
+        {
+            countFailures(boards, i);
+            free(boards);
+            free(fds);
+            return -1;
+        }
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    LOG("flashing %d boards, up to %d at once and %d per hub\n", portCnt, maxJobs, maxPerHub);
+
+    do
+    {
+        startBoards(boards, portCnt, maxJobs, maxPerHub, frames, session);
+    } while(pollBoards(boards, portCnt, fds, -1) >= 0);
+
+    printReport(boards, portCnt, start);
+
+    free(fds);
+    i = countFailures(boards, portCnt);
+    free(boards);
+    return i;
+}
+
+/******************************************************************************
+ * watch mode
+ */
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void stop(int signalNumber)
+{
+    g_stop = 1;
+}
+
+/**
+ * queue a board for a device node that appeared, unless the same node is
+ * being flashed or was flashed within the cooldown
+ */
+static void watchNode(BOARD **boards, int *boardCnt, int *capacity, struct pollfd **fds, const char *path, int cooldownSec)
+{
+    uint64_t t = now();
+    int i;
+
+    for(i = 0; i < *boardCnt; i++)
+    {
+        const BOARD *board = &(*boards)[i];
+
+        if(strcmp(board->deviceName, path) == 0 &&
+           (board->state != BOARD_DONE || t - board->finished < (uint64_t)cooldownSec * 1000000000ULL))
+        {
+            LOG("%s appeared again, ignored\n", path);
+            return;
+        }
+    }
+
+    if(*boardCnt == *capacity)
+    {
+        int newCapacity = (*capacity == 0) ? 16 : 2 * *capacity;
+        BOARD *newBoards = realloc(*boards, newCapacity * sizeof(BOARD));
+        struct pollfd *newFds;
+
+        if(newBoards == NULL)
+        {
+            ERROR("realloc() fail\n");
+            return;
+        }
+        *boards = newBoards;
+
+        if((newFds = realloc(*fds, (1 + 2 * newCapacity) * sizeof(struct pollfd))) == NULL)
+        {
+            ERROR("realloc() fail\n");
+            return;
+        }
+        *fds = newFds;
+        *capacity = newCapacity;
+    }
+
+    if(initBoard(&(*boards)[*boardCnt], path) < 0)
+    {
+        return;
+    }
+
+    /*give udev time to set up the node before it is opened*/
+    (*boards)[*boardCnt].notBefore = t + FLEET_WATCH_SETTLE_MS * 1000000ULL;
+    LOG("%s appeared, queued on %s\n", path, (*boards)[*boardCnt].hub);
+    (*boardCnt)++;
+}
+
+int fleet_watch(const PAGECACHE *frames, const char *directory, const char *pattern, int maxJobs, int maxPerHub, int cooldownSec,
+                FLEET_SESSION session)
+{
+    struct sigaction action;
+    struct pollfd *fds = NULL;
+    BOARD *boards = NULL;
+    int boardCnt = 0;
+    int capacity = 0;
+    uint64_t start = now();
+    int notify;
+    int failedCnt;
+
+    if((fds = calloc(1, sizeof(struct pollfd))) == NULL)
+    {
+        ERROR("calloc() fail\n");
+        return -1;
+    }
+
+    if((notify = inotify_init1(IN_CLOEXEC)) < 0 || inotify_add_watch(notify, directory, IN_CREATE | IN_MOVED_TO) < 0)
+    {
+        ERROR("failed to watch %s: %s\n", directory, strerror(errno));
+        if(notify >= 0)
+        {
+            close(notify);
+        }
+        free(fds);
+        return -1;
+    }
+
+    /*no SA_RESTART, so the signal ends the poll*/
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    LOG("watching %s for %s, up to %d at once and %d per hub, cooldown %d s\n", directory, pattern, maxJobs, maxPerHub, cooldownSec);
+
+    while(!g_stop)
+    {
+        startBoards(boards, boardCnt, maxJobs, maxPerHub, frames, session);
+
+        if(pollBoards(boards, boardCnt, fds, notify) == 1)
+        {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t size = read(notify, events, sizeof(events));
+            ssize_t offset;
+
+            for(offset = 0; offset < size; offset += sizeof(struct inotify_event) + ((struct inotify_event *)&events[offset])->len)
+            {
+                const struct inotify_event *event = (const struct inotify_event *)&events[offset];
+                char path[PATH_MAX];
+
+                if(event->len > 0 && fnmatch(pattern, event->name, 0) == 0)
+                {
+                    snprintf(path, sizeof(path), "%s/%s", directory, event->name);
+                    watchNode(&boards, &boardCnt, &capacity, &fds, path, cooldownSec);
+                }
+            }
+        }
+    }
+
+    close(notify);
+
+    /*boards still queued are not started, running ones are waited for*/
+    LOG("stopping\n");
+    while(pollBoards(boards, boardCnt, fds, -1) >= 0);
+
+    printReport(boards, boardCnt, start);
+
+    free(fds);
+    failedCnt = countFailures(boards, boardCnt);
+    free(boards);
+    return failedCnt;
+}
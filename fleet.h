@@ -0,0 +1,70 @@
+/**
+ * multi-board flashing
+ *
+ * Flashes one image into many boards, each session in a child process forked
+ * with the image framed once into a page cache. Ports are grouped by the USB
+ * hub they are attached to, found through sysfs, and the number of sessions
+ * running at once is limited both overall and per hub. A port given as
+ * <device>@<hub> is put in the named group instead.
+ *
+ * In watch mode, boards are queued as their device nodes appear in a
+ * directory, so a board is flashed as soon as it is plugged in.
+ *
+ * Children report every programmed page through a pipe. A board whose page
+ * rate falls well below the median of the fleet is flagged as a straggler,
+ * and the final report gives each board's time against the fleet median.
+ */
+
+#ifndef FLEET_H_
+#define FLEET_H_
+
+#include "pagecache.h"
+
+#define FLEET_DEFAULT_PER_HUB   4
+#define FLEET_STRAGGLER_RATIO   0.5     /*page rate below this fraction of the median*/
+#define FLEET_STRAGGLER_BOARDS  3       /*boards with a page rate needed for a median*/
+#define FLEET_DEFAULT_PATTERN   "ttyUSB*"
+#define FLEET_DEFAULT_COOLDOWN  30      /*seconds a flashed node is ignored in watch mode*/
+#define FLEET_WATCH_SETTLE_MS   200     /*wait after a node appears before opening it*/
+
+/**
+ * session run for every board, in the board's child process
+ *
+ * boardIndex - position of the board among the ports, or in the order the
+ *              device nodes appeared in watch mode
+ *
+ * 0 if successful, non-zero otherwise
+ */
+typedef int (*FLEET_SESSION)(const char *deviceName, const PAGECACHE *frames, int boardIndex);
+
+/**
+ * flash all ports and print the fleet report
+ *
+ * ports - device paths, each optionally followed by @<hub>
+ * maxJobs - maximum number of sessions running at once
+ * maxPerHub - maximum number of sessions running at once on one hub
+ *
+ * number of boards that failed, -1 if the run could not start
+ */
+int fleet_run(const PAGECACHE *frames, char * const *ports, int portCnt, int maxJobs, int maxPerHub, FLEET_SESSION session);
+
+/**
+ * flash every device node appearing in directory with a name matching
+ * pattern, until SIGINT or SIGTERM, then print the fleet report
+ *
+ * A node that appears again while its board is flashed, or within
+ * cooldownSec of the end of its session, is ignored.
+ *
+ * number of boards that failed or were not started, -1 if the directory
+ * cannot be watched
+ */
+int fleet_watch(const PAGECACHE *frames, const char *directory, const char *pattern, int maxJobs, int maxPerHub, int cooldownSec,
+                FLEET_SESSION session);
+
+/**
+ * report programming progress of the session to the fleet, a no-op outside
+ * of a fleet child; pageCnt 0 marks the start of programming
+ */
+void fleet_page(int pageCnt, int pageTotal);
+
+#endif /* FLEET_H_ */
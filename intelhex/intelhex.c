@@ -23,10 +23,21 @@
  * 22may2014
  */
 
+#define _GNU_SOURCE /* fopencookie() and mremap() */
+
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "intelhex.h"
 
 #define PREFIX          "intelhex: "
@@ -59,34 +70,175 @@ enum {
 
 #define DEFAULT_RECORD_LENGTH   16
 #define BUFFER_SIZE             1024
+#define GZIP_BUFFER_SIZE        (256 * 1024)
+#define MAP_CHUNK_SIZE          (1024 * 1024)
 
 /******************************************************************************
  * other helpers
  */
 
+/* close a file opened by openFiles(), leaving the standard streams open */
+static int closeFile(FILE *file)
+{
+    if(file == NULL || file == stdin)
+        return 0;
+
+    if(file == stdout)
+        return fflush(file);
+
+    return fclose(file);
+}
+
+static int isGzipFile(const char *filename)
+{
+    size_t length = strlen(filename);
+
+    return length > 3 && strcasecmp(&filename[length - 3], ".gz") == 0;
+}
+
+/* a truncated file ends with an error rather than a short read */
+static ssize_t readGzipFile(void *cookie, char *buffer, size_t size)
+{
+    int length = gzread((gzFile)cookie, buffer, (size > INT_MAX) ? INT_MAX : size);
+    int error;
+
+    if(length == 0)
+        gzerror((gzFile)cookie, &error);
+
+    return (length < 0 || (length == 0 && error != Z_OK)) ? -1 : length;
+}
+
+/* read what the reader left, so the trailer checksum of the file is checked */
+static int closeGzipFile(void *cookie)
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t length;
+
+    while((length = readGzipFile(cookie, buffer, sizeof(buffer))) > 0)
+        ;
+
+    return (gzclose((gzFile)cookie) == Z_OK && length == 0) ? 0 : -1;
+}
+
+/*
+ * open a gzip file as a stream that is decompressed as it is read, so the
+ * readers parse it as they would the plain file; a corrupt or truncated file
+ * is a read error
+ */
+static FILE *openGzipFile(const char *filename)
+{
+    static const cookie_io_functions_t functions = { .read = readGzipFile, .close = closeGzipFile };
+    gzFile gzip;
+    FILE *file;
+
+    if((gzip = gzopen(filename, "rb")) == NULL)
+        return NULL;
+
+    gzbuffer(gzip, GZIP_BUFFER_SIZE);
+
+    if((file = fopencookie(gzip, "r", functions)) == NULL)
+        gzclose(gzip);
+
+    return file;
+}
+
 static int openFiles(FILE **inputFile, const char *inputFilename, const char *inputMode, FILE **outputFile, const char *outputFilename, const char *outputMode)
 {
     *inputFile = NULL;
     *outputFile = NULL;
 
-    if(inputFilename != NULL && (*inputFile = fopen(inputFilename, inputMode)) == NULL)
+    if(inputFilename != NULL && strcmp(inputFilename, "-") == 0)
+        *inputFile = stdin;
+    else if(inputFilename != NULL && (*inputFile = isGzipFile(inputFilename) ? openGzipFile(inputFilename) : fopen(inputFilename, inputMode)) == NULL)
     {
         ERROR("failed to open \"%s\" file for reading\n", inputFilename);
         return -1;
     }
 
-    if(outputFilename != NULL && (*outputFile = fopen(outputFilename, outputMode)) == NULL)
+    if(outputFilename != NULL && strcmp(outputFilename, "-") == 0)
+        *outputFile = stdout;
+    else if(outputFilename != NULL && (*outputFile = fopen(outputFilename, outputMode)) == NULL)
+    {
+        closeFile(*inputFile);
+        *inputFile = NULL;
+
+        ERROR("failed to open \"%s\" file for writing\n", outputFilename);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * map the whole of file, reading it into an anonymous mapping when it cannot
+ * be mapped directly, e.g. a pipe or a gzip file; an empty file gives a NULL
+ * map and a size of 0
+ */
+static int mapFile(FILE *file, const uint8_t **map, size_t *size)
+{
+    struct stat status;
+    uint8_t *buffer;
+    uint8_t *grown;
+    size_t capacity = MAP_CHUNK_SIZE;
+    size_t length;
+
+    *map = NULL;
+    *size = 0;
+
+    if(fileno(file) >= 0 && fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode))
     {
-        if(*inputFile != NULL)
+        if(status.st_size < 1)
+            return 0;
+
+        if((uint64_t)status.st_size > SIZE_MAX || (*map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0)) == MAP_FAILED)
         {
-            fclose(*inputFile);
-            *inputFile = NULL;
+            *map = NULL;
+            return -1;
         }
 
-        ERROR("failed to open \"%s\" file for writing\n", inputFilename);
+        *size = status.st_size;
+        return 0;
+    }
+
+    if((buffer = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return -1;
+
+    while((length = fread(&buffer[*size], 1, capacity - *size, file)) > 0)
+    {
+        *size += length;
+        if(*size < capacity)
+            continue;
+
+        if((grown = mremap(buffer, capacity, capacity * 2, MREMAP_MAYMOVE)) == MAP_FAILED)
+            break;
+
+        buffer = grown;
+        capacity *= 2;
+    }
+
+    /* a full buffer means it could not grow */
+    if(ferror(file) || *size == capacity)
+    {
+        munmap(buffer, capacity);
+        *size = 0;
+        return -1;
+    }
+
+    if(*size == 0)
+    {
+        munmap(buffer, capacity);
+        return 0;
+    }
+
+    /* shrink to the data, so it is unmapped with its own size */
+    if((grown = mremap(buffer, capacity, *size, 0)) == MAP_FAILED)
+    {
+        munmap(buffer, capacity);
+        *size = 0;
         return -1;
     }
 
+    *map = grown;
     return 0;
 }
 
@@ -163,10 +315,11 @@ static inline IntelHexData * copyHexData(const uint8_t *sourceData, FILE *source
     uint32_t chunkSize;
 
     /**
-     * note: data capacity of IntelHexData structure is always BUFFER_SIZE bytes
+     * note: data capacity of a copied IntelHexData structure is always BUFFER_SIZE bytes,
+     *       while a referenced one is full
      */
 
-    if(*destinationData != NULL && (chunkSize = BUFFER_SIZE - (*destinationData)->size) > 0)
+    if(*destinationData != NULL && (chunkSize = (*destinationData)->capacity - (*destinationData)->size) > 0)
     {
         if(chunkSize > size)
             chunkSize = size;
@@ -191,6 +344,7 @@ static inline IntelHexData * copyHexData(const uint8_t *sourceData, FILE *source
 
         temp->next = NULL;
         temp->size = chunkSize;
+        temp->capacity = BUFFER_SIZE;
         temp->data = (uint8_t *)temp + sizeof(IntelHexData);
 
         if(tail == NULL)
@@ -217,6 +371,139 @@ static inline IntelHexData * copyHexData(const uint8_t *sourceData, FILE *source
     return (tail == NULL) ? *destinationData : tail;
 }
 
+static inline IntelHexData * referenceHexData(const uint8_t *sourceData, IntelHexData **destinationData, uint64_t size)
+{
+    IntelHexData *data = NULL;
+    IntelHexData *tail = NULL;
+    IntelHexData *temp;
+    uint32_t chunkSize;
+
+    while(size > 0)
+    {
+        chunkSize = (size > 0x80000000ULL) ? 0x80000000U : size;
+
+        if((temp = (IntelHexData *)malloc(sizeof(IntelHexData))) == NULL)
+        {
+            ERROR("failed to allocate memory for IntelHexData structure\n");
+            freeHexData(data);
+            return NULL;
+        }
+
+        temp->next = NULL;
+        temp->size = chunkSize;
+        temp->capacity = chunkSize;
+        temp->data = (uint8_t *)sourceData;
+
+        if(tail == NULL)
+            data = temp;
+        else
+            tail->next = temp;
+
+        tail = temp;
+        sourceData += chunkSize;
+        size -= chunkSize;
+    }
+
+    if(*destinationData == NULL)
+        *destinationData = data;
+    else
+        (*destinationData)->next = data;
+
+    return tail;
+}
+
+/******************************************************************************
+ * checksum
+ */
+
+/*
+ * the byte sum modulo 256 only needs the low byte of each lane, so 64-bit
+ * lanes of summed absolute differences against zero never lose anything
+ * that matters
+ */
+
+uint8_t intelHex_byteSum(const void *data, size_t size)
+{
+    const uint8_t *source = data;
+    uint32_t sum = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = zero;
+    __m128i sum1 = zero;
+
+    for( ; size >= 32; size -= 32, source += 32)
+    {
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)source), zero));
+        sum1 = _mm_add_epi64(sum1, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(source + 16)), zero));
+    }
+
+    if(size >= 16)
+    {
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)source), zero));
+        source += 16;
+        size -= 16;
+    }
+
+    if(size >= 8)
+    {
+        sum1 = _mm_add_epi64(sum1, _mm_sad_epu8(_mm_loadl_epi64((const __m128i *)source), zero));
+        source += 8;
+        size -= 8;
+    }
+
+    sum0 = _mm_add_epi64(sum0, sum1);
+    sum = _mm_cvtsi128_si32(sum0) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum0, sum0));
+#endif
+
+    while(size-- > 0)
+        sum += *source++;
+
+    return (uint8_t)sum;
+}
+
+uint8_t intelHex_copyByteSum(void *destination, const void *source, size_t size)
+{
+    const uint8_t *from = source;
+    uint8_t *to = destination;
+    uint32_t sum = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = zero;
+
+    for( ; size >= 16; size -= 16, from += 16, to += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)from);
+
+        _mm_storeu_si128((__m128i *)to, bytes);
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(bytes, zero));
+    }
+
+    if(size >= 8)
+    {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)from);
+
+        _mm_storel_epi64((__m128i *)to, bytes);
+        sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(bytes, zero));
+        size -= 8;
+        from += 8;
+        to += 8;
+    }
+
+    sum = _mm_cvtsi128_si32(sum0) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum0, sum0));
+#endif
+
+    while(size-- > 0)
+        sum += (*to++ = *from++);
+
+    return (uint8_t)sum;
+}
+
+/******************************************************************************
+ * hex info
+ */
+
 int intelHex_initializeHexInfo(IntelHex *hex, uint32_t flags)
 {
     if(hex == NULL)
@@ -226,6 +513,8 @@ int intelHex_initializeHexInfo(IntelHex *hex, uint32_t flags)
     hex->cs = INTEL_HEX_INVALID_ADDRESS;
     hex->ip = INTEL_HEX_INVALID_ADDRESS;
     hex->memory = NULL;
+    hex->mapping = NULL;
+    hex->mappingSize = 0;
 
     switch(INTEL_HEX_FLAGS_ADDRESSING(flags))
     {
@@ -269,10 +558,13 @@ void intelHex_destroyHexInfo(IntelHex *hex)
         freeHexMemory(memory);
     }
 
+    if(hex->mapping != NULL)
+        munmap(hex->mapping, hex->mappingSize);
+
     intelHex_initializeHexInfo(hex, 0);
 }
 
-int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, uint64_t size, uint32_t baseAddress)
+static int saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, uint64_t size, uint32_t baseAddress, int reference)
 {
     IntelHexMemory *previousMemory = NULL;
     IntelHexMemory *currentMemory = NULL;
@@ -338,7 +630,12 @@ int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, u
         head = NULL;
     }
 
-    if((tail = copyHexData(data, file, &head, size)) == NULL)
+    if(reference)
+        tail = referenceHexData(data, &head, size);
+    else
+        tail = copyHexData(data, file, &head, size);
+
+    if(tail == NULL)
         return -1;
 
     if(memory != NULL)
@@ -394,6 +691,16 @@ int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, u
     return 0;
 }
 
+int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, uint64_t size, uint32_t baseAddress)
+{
+    return saveDataToHexInfo(hex, data, file, size, baseAddress, 0);
+}
+
+int intelHex_referenceDataInHexInfo(IntelHex *hex, const uint8_t *data, uint64_t size, uint32_t baseAddress)
+{
+    return saveDataToHexInfo(hex, data, NULL, size, baseAddress, 1);
+}
+
 int intelHex_copyDataFromHexInfo(IntelHex *hex, uint32_t baseAddress, uint8_t *data, FILE *file, uint64_t size)
 {
     IntelHexMemory *memory;
@@ -458,6 +765,139 @@ int intelHex_copyDataFromHexInfo(IntelHex *hex, uint32_t baseAddress, uint8_t *d
     return -1;
 }
 
+/******************************************************************************
+ * page iterator
+ */
+
+static void startIteratorMemory(IntelHexPageIterator *iterator, const IntelHexMemory *memory, uint64_t address)
+{
+    uint64_t skip;
+
+    iterator->memory = memory;
+
+    if(memory == NULL)
+        return;
+
+    iterator->memoryEndAddress = memory->baseAddress + ((memory->size == 0) ? 0x100000000ULL : memory->size);
+    iterator->address = (address > memory->baseAddress) ? address : memory->baseAddress;
+    iterator->data = memory->head;
+
+    for(skip = iterator->address - memory->baseAddress; iterator->data != NULL && skip >= iterator->data->size; iterator->data = iterator->data->next)
+        skip -= iterator->data->size;
+
+    iterator->dataOffset = skip;
+}
+
+int intelHex_initializePageIterator(IntelHexPageIterator *iterator, const IntelHexMemory *memory, uint32_t startAddress, uint32_t endAddress, uint32_t pageSize, uint8_t *bounce, int fill)
+{
+    if(iterator == NULL || pageSize < 1 || bounce == NULL || startAddress > endAddress || fill > 0xff)
+    {
+        ERROR("invalid page iterator parameters\n");
+        return -1;
+    }
+
+    iterator->endAddress = endAddress;
+    iterator->coalescedCount = 0;
+    iterator->pageSize = pageSize;
+    iterator->bounce = bounce;
+    iterator->fill = fill;
+
+    /* memories are sorted, so the ones ending before the start are skipped */
+    while(memory != NULL && (uint64_t)memory->baseAddress + ((memory->size == 0) ? 0x100000000ULL : memory->size) <= startAddress)
+        memory = memory->next;
+
+    startIteratorMemory(iterator, memory, startAddress);
+    return 0;
+}
+
+/* take size bytes of the current memory, returning them in place when they sit in one chunk and copying them to bounce otherwise */
+static const uint8_t *takeBytes(IntelHexPageIterator *iterator, uint32_t size, uint8_t *bounce, int copy)
+{
+    const uint8_t *data = NULL;
+    uint32_t copied;
+    uint32_t copySize;
+
+    if(!copy && iterator->data->size - iterator->dataOffset >= size)
+    {
+        data = &iterator->data->data[iterator->dataOffset];
+        iterator->dataOffset += size;
+    }
+    else
+    {
+        for(copied = 0; copied < size; copied += copySize)
+        {
+            if(iterator->dataOffset == iterator->data->size)
+            {
+                iterator->data = iterator->data->next;
+                iterator->dataOffset = 0;
+            }
+
+            copySize = iterator->data->size - iterator->dataOffset;
+
+            if(copySize > size - copied)
+                copySize = size - copied;
+
+            memcpy(&bounce[copied], &iterator->data->data[iterator->dataOffset], copySize);
+            iterator->dataOffset += copySize;
+        }
+
+        data = bounce;
+    }
+
+    if(iterator->dataOffset == iterator->data->size)
+    {
+        iterator->data = iterator->data->next;
+        iterator->dataOffset = 0;
+    }
+
+    iterator->address += size;
+
+    if(iterator->address == iterator->memoryEndAddress)
+        startIteratorMemory(iterator, iterator->memory->next, iterator->address);
+
+    return data;
+}
+
+int intelHex_nextPage(IntelHexPageIterator *iterator, IntelHexPage *page)
+{
+    uint64_t pageAddress;
+    uint64_t limitAddress;
+    uint64_t endAddress;
+
+    if(iterator->memory == NULL || iterator->address > iterator->endAddress)
+        return 0;
+
+    pageAddress = iterator->address - iterator->address % iterator->pageSize;
+    limitAddress = pageAddress + iterator->pageSize;
+
+    if(limitAddress > iterator->endAddress + 1)
+        limitAddress = iterator->endAddress + 1;
+
+    endAddress = (limitAddress < iterator->memoryEndAddress) ? limitAddress : iterator->memoryEndAddress;
+
+    page->address = pageAddress;
+    page->offset = iterator->address - pageAddress;
+    page->data = takeBytes(iterator, endAddress - iterator->address, &iterator->bounce[page->offset], 0);
+
+    /* the following memories starting in the same page are gathered into the bounce buffer, with the gaps filled */
+    while(iterator->fill >= 0 && iterator->memory != NULL && iterator->address < limitAddress)
+    {
+        if(page->data != &iterator->bounce[page->offset])
+        {
+            memcpy(&iterator->bounce[page->offset], page->data, endAddress - pageAddress - page->offset);
+            page->data = &iterator->bounce[page->offset];
+        }
+
+        memset(&iterator->bounce[endAddress - pageAddress], iterator->fill, iterator->address - endAddress);
+        endAddress = (limitAddress < iterator->memoryEndAddress) ? limitAddress : iterator->memoryEndAddress;
+        takeBytes(iterator, endAddress - iterator->address, &iterator->bounce[iterator->address - pageAddress], 1);
+        iterator->coalescedCount++;
+    }
+
+    page->size = endAddress - pageAddress - page->offset;
+    return 1;
+}
+
 static inline int copyHexInfo(const IntelHex *sourceHex, IntelHex *destinationHex, uint32_t flags)
 {
     IntelHexMemory *memory;
@@ -607,6 +1047,7 @@ static int readHexInfoFromBinFile(FILE *file, IntelHex *hex, uint32_t flags)
 {
     uint32_t baseAddress;
     uint32_t size;
+    int character;
 
     intelHex_initializeHexInfo(hex, flags);
 
@@ -631,11 +1072,12 @@ static int readHexInfoFromBinFile(FILE *file, IntelHex *hex, uint32_t flags)
     if(checkEip(hex->eip) != 0 || checkCsAndIp(hex->cs, hex->ip) != 0)
         return -1;
 
-    while(fgetc(file) != EOF)
+    while((character = fgetc(file)) != EOF)
     {
-        if(fseek(file, -1, SEEK_CUR) != 0)
+        /* put the byte back rather than seek, so the file may be a pipe or a gzip file */
+        if(ungetc(character, file) == EOF)
         {
-            ERROR("failed to set the position indicator of bin file\n");
+            ERROR("failed to put back a byte of bin file\n");
             return -1;
         }
 
@@ -665,51 +1107,248 @@ static int readHexInfoFromBinFile(FILE *file, IntelHex *hex, uint32_t flags)
 }
 
 /******************************************************************************
- * hex file helpers
+ * elf file helpers
  */
 
-static int readValueFromHexFile(FILE *file, int size, uint32_t *value)
+static uint64_t readElfValue(const uint8_t *data, size_t size, int isBigEndian)
 {
-    /**
-     * note: value in file is big-endian
-     */
+    uint64_t value = 0;
+    size_t i;
 
-    int hex;
+    for(i = 0; i < size; i++)
+        value |= (uint64_t)data[isBigEndian ? i : (size - 1 - i)] << ((size - 1 - i) * 8);
 
-    *value = 0;
+    return value;
+}
 
-    while(size-- > 0)
-    {
-        hex = fgetc(file);
+/* field of an ELF structure of either class, e.g. ELF_FIELD(header, is64Bit, isBigEndian, Ehdr, e_entry) */
+#define ELF_FIELD(data, is64Bit, isBigEndian, type, field) \
+    ((is64Bit) ? readElfValue(&(data)[offsetof(Elf64_##type, field)], sizeof(((Elf64_##type *)0)->field), isBigEndian) \
+               : readElfValue(&(data)[offsetof(Elf32_##type, field)], sizeof(((Elf32_##type *)0)->field), isBigEndian))
 
-        if(!isxdigit(hex))
-            return -1;
+static int readHexInfoFromElfFile(FILE *file, IntelHex *hex, uint32_t flags)
+{
+    const uint8_t *map;
+    size_t fileSize;
+    const uint8_t *programHeader;
+    uint64_t programHeaderOffset;
+    uint64_t programHeaderSize;
+    uint64_t programHeaderCount;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t address;
+    uint64_t entry;
+    int is64Bit;
+    int isBigEndian;
+    uint64_t i;
 
-        if(isdigit(hex))
-            hex -= '0';
-        else
-            hex = tolower(hex) - 'a' + 10;
+    intelHex_initializeHexInfo(hex, flags);
 
-        *value |= (hex << (4 * size));
+    if(mapFile(file, &map, &fileSize) != 0)
+    {
+        ERROR("failed to map elf file\n");
+        return -1;
     }
 
-    return 0;
-}
-
-static int writeDataToHexFile(FILE *file, int size, const uint8_t *data, int *sum)
-{
-    int temp = 0;
-    int i;
+    /* the memory data points into the mapping, which is unmapped when hex is destroyed */
+    hex->mapping = (void *)map;
+    hex->mappingSize = fileSize;
 
-    if(sum == NULL)
-        sum = &temp;
+    if(fileSize < sizeof(Elf32_Ehdr))
+    {
+        ERROR("elf file is too short for an elf header\n");
+        return -1;
+    }
 
-    for(i = 0; i < size; i++)
+    if(memcmp(map, ELFMAG, SELFMAG) != 0)
     {
-        *sum += data[i];
+        ERROR("elf magic number not found in elf file\n");
+        return -1;
+    }
 
-        if(fprintf(file, "%.2x", data[i]) != 2)
-            return -1;
+    if((map[EI_CLASS] != ELFCLASS32 && map[EI_CLASS] != ELFCLASS64) || (map[EI_DATA] != ELFDATA2LSB && map[EI_DATA] != ELFDATA2MSB))
+    {
+        ERROR("unknown elf class %u or byte order %u\n", map[EI_CLASS], map[EI_DATA]);
+        return -1;
+    }
+
+    is64Bit = (map[EI_CLASS] == ELFCLASS64);
+    isBigEndian = (map[EI_DATA] == ELFDATA2MSB);
+
+    if(is64Bit && (uint64_t)fileSize < sizeof(Elf64_Ehdr))
+    {
+        ERROR("elf file is too short for an elf header\n");
+        return -1;
+    }
+
+    programHeaderOffset = ELF_FIELD(map, is64Bit, isBigEndian, Ehdr, e_phoff);
+    programHeaderSize = ELF_FIELD(map, is64Bit, isBigEndian, Ehdr, e_phentsize);
+    programHeaderCount = ELF_FIELD(map, is64Bit, isBigEndian, Ehdr, e_phnum);
+    entry = ELF_FIELD(map, is64Bit, isBigEndian, Ehdr, e_entry);
+
+    if(programHeaderCount > 0 && (programHeaderSize < (is64Bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) ||
+            programHeaderOffset > (uint64_t)fileSize || programHeaderCount * programHeaderSize > (uint64_t)fileSize - programHeaderOffset))
+    {
+        ERROR("wrong program header table info: offset=0x%llx size=%llu count=%llu\n",
+                (unsigned long long)programHeaderOffset, (unsigned long long)programHeaderSize, (unsigned long long)programHeaderCount);
+        return -1;
+    }
+
+    for(i = 0; i < programHeaderCount; i++)
+    {
+        programHeader = &map[programHeaderOffset + i * programHeaderSize];
+
+        if(ELF_FIELD(programHeader, is64Bit, isBigEndian, Phdr, p_type) != PT_LOAD)
+            continue;
+
+        /* only the file bytes are loaded; the rest of the segment is zero-filled at run time */
+        if((size = ELF_FIELD(programHeader, is64Bit, isBigEndian, Phdr, p_filesz)) == 0)
+            continue;
+
+        offset = ELF_FIELD(programHeader, is64Bit, isBigEndian, Phdr, p_offset);
+        address = ELF_FIELD(programHeader, is64Bit, isBigEndian, Phdr, p_paddr);
+
+        if(offset > (uint64_t)fileSize || size > (uint64_t)fileSize - offset)
+        {
+            ERROR("program segment %llu with %llu bytes at offset 0x%llx exceeded the elf file\n",
+                    (unsigned long long)i, (unsigned long long)size, (unsigned long long)offset);
+            return -1;
+        }
+
+        if(address > MAX_32BIT)
+        {
+            ERROR("program segment %llu at 0x%llx exceeded the maximum address of 0x%.8x\n", (unsigned long long)i, (unsigned long long)address, MAX_32BIT);
+            return -1;
+        }
+
+        if(intelHex_referenceDataInHexInfo(hex, &map[offset], size, address) != 0)
+            return -1;
+    }
+
+    if(hex->memory == NULL)
+    {
+        ERROR("no loadable program segment found in elf file\n");
+        return -1;
+    }
+
+    if(entry != 0 && entry <= MAX_EIP)
+        hex->eip = entry;
+
+    return 0;
+}
+
+/******************************************************************************
+ * raw file
+ */
+
+int intelHex_mapRawFile(const char *filename, uint32_t baseAddress, IntelHex *hex, uint32_t flags)
+{
+    const uint8_t *map;
+    size_t fileSize;
+    uint64_t start = 0;
+    uint64_t end;
+    FILE *file;
+    FILE *unused;
+    int status;
+
+    intelHex_initializeHexInfo(hex, flags);
+
+    if(openFiles(&file, filename, "rb", &unused, NULL, NULL) != 0)
+        return -1;
+
+    status = mapFile(file, &map, &fileSize);
+    closeFile(file);
+
+    if(status != 0)
+    {
+        ERROR("failed to map \"%s\" raw file\n", filename);
+        return -1;
+    }
+
+    hex->mapping = (void *)map;
+    hex->mappingSize = fileSize;
+    end = fileSize;
+
+    if(fileSize < 1)
+    {
+        ERROR("\"%s\" raw file is empty\n", filename);
+        return -1;
+    }
+
+    if((uint64_t)fileSize - 1 > (uint64_t)(MAX_32BIT - baseAddress))
+    {
+        ERROR("\"%s\" raw file at 0x%.8x with %llu bytes exceeded the maximum address of 0x%.8x\n", filename, baseAddress, (unsigned long long)fileSize, MAX_32BIT);
+        intelHex_destroyHexInfo(hex);
+        return -1;
+    }
+
+    if((flags & INTEL_HEX_TRIM_ERASED))
+    {
+        while(start < end && map[start] == 0xff)
+            start++;
+
+        while(end > start && map[end - 1] == 0xff)
+            end--;
+
+        if(start == end)
+        {
+            WARNING("\"%s\" raw file holds only 0xff bytes\n", filename);
+            return 0;
+        }
+    }
+
+    if(intelHex_referenceDataInHexInfo(hex, &map[start], end - start, baseAddress + start) != 0)
+    {
+        intelHex_destroyHexInfo(hex);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * hex file helpers
+ */
+
+static int readValueFromHexFile(FILE *file, int size, uint32_t *value)
+{
+    /**
+     * note: value in file is big-endian
+     */
+
+    int hex;
+
+    *value = 0;
+
+    while(size-- > 0)
+    {
+        hex = fgetc(file);
+
+        if(!isxdigit(hex))
+            return -1;
+
+        if(isdigit(hex))
+            hex -= '0';
+        else
+            hex = tolower(hex) - 'a' + 10;
+
+        *value |= (hex << (4 * size));
+    }
+
+    return 0;
+}
+
+static int writeDataToHexFile(FILE *file, int size, const uint8_t *data, int *sum)
+{
+    int i;
+
+    if(sum != NULL)
+        *sum += intelHex_byteSum(data, size);
+
+    for(i = 0; i < size; i++)
+    {
+        if(fprintf(file, "%.2x", data[i]) != 2)
+            return -1;
     }
 
     return 0;
@@ -717,7 +1356,7 @@ static int writeDataToHexFile(FILE *file, int size, const uint8_t *data, int *su
 
 static int writeValueToHexFile(FILE *file, int size, uint32_t value, int *sum)
 {
-    uint8_t data[4];
+    uint8_t data[4] = { 0 };
     int i;
 
     for(i = 0; size-- > 0; i++)
@@ -790,29 +1429,74 @@ static int writeHexRecordToHexFile(FILE *file, uint32_t type, uint32_t length, u
     return 0;
 }
 
-static inline int writeHexInfoToHexFile(IntelHex *hex, FILE *file, uint32_t recordLength)
+/* 64 KB window of the last extended address record written */
+typedef struct {
+    uint32_t endAddress;
+    uint32_t address;
+    int isValid;
+} HexRecordWindow;
+
+/**
+ * write bytes as data records of at most size bytes, preceded by an extended
+ * address record whenever they leave the window of the last one; the
+ * addressing follows window->endAddress, as hex->endAddress does
+ */
+static int writeDataRecordsToHexFile(FILE *file, HexRecordWindow *window, uint32_t address, const uint8_t *data, uint32_t size)
 {
-    IntelHexMemory *memory;
-    IntelHexData *data;
+    uint32_t type = (window->endAddress == MAX_32BIT) ? INTEL_HEX_RECORD_EXTENDED_LINEAR_ADDRESS : INTEL_HEX_RECORD_EXTENDED_SEGMENT_ADDRESS;
     uint32_t offset;
     uint32_t length;
-    uint64_t baseAddress;
-    uint64_t endAddress;
-    uint64_t memorySize;
-    uint32_t size;
-    uint32_t address;
-    uint32_t type;
-    uint8_t buffer[255];
-    uint8_t *sourceData;
-    uint32_t sourceDataSize;
-    uint32_t copySize;
-    uint32_t remainingSize;
     uint32_t i;
 
-    if(recordLength == 0)
-        recordLength = DEFAULT_RECORD_LENGTH;
+    for(i = 0; i < size; i += length, address += length)
+    {
+        length = size - i;
+
+        if(window->endAddress == MAX_8BIT)
+            offset = address;
+        else
+        {
+            if(!window->isValid || address < window->address || address - window->address > 0xffff)
+            {
+                if(window->endAddress == MAX_32BIT)
+                {
+                    window->address = address & ~0xffff;
+                    offset = address >> 16;
+                }
+                else
+                {
+                    window->address = address & ~0xf;
+                    offset = address >> 4;
+                }
+
+                if(writeHexRecordToHexFile(file, type, 2, 0, &offset) != 0)
+                {
+                    ERROR("failed to write extended %s address record to hex file\n", (type == INTEL_HEX_RECORD_EXTENDED_LINEAR_ADDRESS) ? "linear" : "segment");
+                    return -1;
+                }
+
+                window->isValid = 1;
+            }
+
+            offset = address - window->address;
+
+            if(length > 0x10000 - offset)
+                length = 0x10000 - offset;
+        }
+
+        if(writeHexRecordToHexFile(file, INTEL_HEX_RECORD_DATA, length, offset, &data[i]) != 0)
+        {
+            ERROR("failed to write data record to hex file\n");
+            return -1;
+        }
+    }
 
-    type = (hex->endAddress == MAX_32BIT) ? INTEL_HEX_RECORD_EXTENDED_LINEAR_ADDRESS : INTEL_HEX_RECORD_EXTENDED_SEGMENT_ADDRESS;
+    return 0;
+}
+
+static int writeStartAddressRecordsToHexFile(const IntelHex *hex, FILE *file)
+{
+    uint32_t address;
 
     if(IS_VALID_ADDRESS(hex->eip))
     {
@@ -834,82 +1518,33 @@ static inline int writeHexInfoToHexFile(IntelHex *hex, FILE *file, uint32_t reco
         }
     }
 
-    for(memory = hex->memory; memory != NULL; memory = memory->next)
-    {
-        baseAddress = memory->baseAddress;
-        memorySize = (memory->size == 0) ? 0x100000000ULL : memory->size;
-        endAddress = baseAddress + memorySize;
-        data = memory->head;
-        sourceData = NULL;
-        sourceDataSize = 0;
-
-        while(baseAddress < endAddress)
-        {
-            if(hex->endAddress == MAX_8BIT)
-            {
-                size = memorySize;
-                offset = baseAddress;
-            }
-            else
-            {
-                if(hex->endAddress == MAX_32BIT)
-                {
-                    offset = baseAddress & 0xffff;
-                    address = baseAddress >> 16;
-                }
-                else
-                {
-                    offset = baseAddress & 0xf;
-                    address = baseAddress >> 4;
-                }
-
-                if(writeHexRecordToHexFile(file, type, 2, 0, &address) != 0)
-                {
-                    ERROR("failed to write extended %s address record to hex file\n", (type == INTEL_HEX_RECORD_EXTENDED_LINEAR_ADDRESS) ? "linear" : "segment");
-                    return -1;
-                }
-
-                if((size = 0x10000 - offset) > memorySize)
-                    size = memorySize;
-            }
+    return 0;
+}
 
-            for(i = 0; i < size; i += length)
-            {
-                length = size - i;
+static inline int writeHexInfoToHexFile(IntelHex *hex, FILE *file, uint32_t recordLength)
+{
+    IntelHexPageIterator iterator;
+    IntelHexPage page;
+    uint8_t bounce[255];
+    HexRecordWindow window = { hex->endAddress, 0, 0 };
 
-                if(length > recordLength)
-                    length = recordLength;
+    if(recordLength == 0)
+        recordLength = DEFAULT_RECORD_LENGTH;
 
-                for(remainingSize = length; remainingSize > 0; )
-                {
-                    if(sourceData == NULL)
-                    {
-                        sourceData = data->data;
-                        sourceDataSize = data->size;
-                        data = data->next;
-                    }
-
-                    copySize = (sourceDataSize > remainingSize) ? remainingSize : sourceDataSize;
-                    memcpy(&buffer[length - remainingSize], sourceData, copySize);
-
-                    if((sourceDataSize -= copySize) < 1)
-                        sourceData = NULL;
-                    else
-                        sourceData += copySize;
-
-                    remainingSize -= copySize;
-                }
+    if(writeStartAddressRecordsToHexFile(hex, file) != 0)
+        return -1;
 
-                if(writeHexRecordToHexFile(file, INTEL_HEX_RECORD_DATA, length, offset + i, buffer) != 0)
-                {
-                    ERROR("failed to write data record to hex file\n");
-                    return -1;
-                }
-            }
+    /**
+     * every record is one page of recordLength bytes, split where it leaves
+     * the 64 KB window of the last extended address record
+     */
+    if(intelHex_initializePageIterator(&iterator, hex->memory, 0, MAX_32BIT, recordLength, bounce, -1) != 0)
+        return -1;
 
-            baseAddress += size;
-            memorySize -= size;
-        }
+    while(intelHex_nextPage(&iterator, &page))
+    {
+        if(writeDataRecordsToHexFile(file, &window, page.address + page.offset, page.data, page.size) != 0)
+            return -1;
     }
 
     if(writeHexRecordToHexFile(file, INTEL_HEX_RECORD_END_OF_FILE, 0, 0, NULL) != 0)
@@ -921,7 +1556,19 @@ static inline int writeHexInfoToHexFile(IntelHex *hex, FILE *file, uint32_t reco
     return 0;
 }
 
-static int readHexInfoFromHexFile(FILE *file, IntelHex *hex, uint32_t flags)
+/**
+ * receiver of the data records of a hex file, in file order
+ *
+ * 0 to go on, non-zero to stop reading
+ */
+typedef int (*HexDataSink)(void *context, IntelHex *hex, const uint8_t *data, uint32_t size, uint32_t address);
+
+static int saveHexData(void *context, IntelHex *hex, const uint8_t *data, uint32_t size, uint32_t address)
+{
+    return intelHex_saveDataToHexInfo(hex, data, NULL, size, address);
+}
+
+static int parseHexFile(FILE *file, IntelHex *hex, uint32_t flags, HexDataSink sink, void *context)
 {
     int notFirstRecord = 0;
     int isLinear = 1;
@@ -996,9 +1643,10 @@ static int readHexInfoFromHexFile(FILE *file, IntelHex *hex, uint32_t flags)
             }
 
             buffer[i] = (uint8_t)value;
-            checksum += value;
         }
 
+        checksum += intelHex_byteSum(buffer, byteCount);
+
         if(readValueFromHexFile(file, 2, &value) != 0)
         {
             ERROR("failed to read record checksum info from hex file\n");
@@ -1032,7 +1680,7 @@ static int readHexInfoFromHexFile(FILE *file, IntelHex *hex, uint32_t flags)
                     size = ((offset + byteCount) > 0x10000) ? (0x10000 - offset) : byteCount;
                 }
 
-                if(intelHex_saveDataToHexInfo(hex, data, NULL, size, address) != 0)
+                if(sink(context, hex, data, size, address) != 0)
                     return -1;
 
                 data += size;
@@ -1117,50 +1765,786 @@ static int readHexInfoFromHexFile(FILE *file, IntelHex *hex, uint32_t flags)
     return -1;
 }
 
+static int readHexInfoFromHexFile(FILE *file, IntelHex *hex, uint32_t flags)
+{
+    return parseHexFile(file, hex, flags, saveHexData, NULL);
+}
+
 /******************************************************************************
- * conversion
+ * s-record file helpers
  */
 
-int intelHex_convert(int inputFormat, const char *inputFilename, const IntelHex *inputHex, int outputFormat, const char *outputFilename, IntelHex *outputHex, uint32_t flags)
-{
-    int status = -1;
-    FILE *inputFile;
-    FILE *outputFile;
-    IntelHex hex;
+#define SREC_MAX_LINE_LENGTH    (4 + 255 * 2)
 
-    if((inputFilename == NULL && inputHex == NULL) || (inputFilename != NULL && inputHex != NULL))
-    {
-        ERROR("at most one of inputFilename and inputHex must be specified\n");
-        return -1;
-    }
+/* value of a hexadecimal digit, 0xff for any other character */
+static const uint8_t hexDigitValues[256] = {
+    [0 ... 255] = 0xff,
+    ['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+    ['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+    ['A'] = 0xa, ['B'] = 0xb, ['C'] = 0xc, ['D'] = 0xd, ['E'] = 0xe, ['F'] = 0xf,
+    ['a'] = 0xa, ['b'] = 0xb, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe, ['f'] = 0xf
+};
 
-    if(outputFilename == NULL && outputHex == NULL)
-    {
-        ERROR("at least one of outputFilename and outputHex must be specified\n");
-        return -1;
-    }
+/* address size in bytes of record types S0 to S9, 0 for the reserved S4 */
+static const uint8_t srecAddressSizes[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
 
-    if(openFiles(&inputFile, inputFilename, (inputFormat == INTEL_HEX_FORMAT_HEX) ? "r" : "rb", &outputFile, outputFilename, (outputFormat == INTEL_HEX_FORMAT_HEX) ? "w" : "wb") != 0)
-        return -1;
+static int readHexInfoFromSrecFile(FILE *file, IntelHex *hex, uint32_t flags)
+{
+    char line[SREC_MAX_LINE_LENGTH + 3];
+    uint8_t buffer[255];
+    uint32_t dataRecordCount = 0;
+    int isTerminated = 0;
+    uint32_t recordType;
+    uint32_t addressSize;
+    uint32_t byteCount;
+    uint32_t checksum;
+    uint32_t address;
+    uint32_t size;
+    uint8_t high;
+    uint8_t low;
+    size_t length;
+    uint32_t i;
 
-    if(outputHex == NULL)
-        outputHex = &hex;
+    intelHex_initializeHexInfo(hex, flags);
 
-    if(inputFile == NULL)
-        status = copyHexInfo(inputHex, outputHex, flags);
-    else
+    while(fgets(line, sizeof(line), file) != NULL)
     {
-        if(inputFormat == INTEL_HEX_FORMAT_HEX)
-            status = readHexInfoFromHexFile(inputFile, outputHex, flags);
-        else
-            status = readHexInfoFromBinFile(inputFile, outputHex, flags);
-
-        fclose(inputFile);
-    }
+        length = strlen(line);
 
-    if(outputFile != NULL)
-    {
-        if(status == 0)
+        if(length == sizeof(line) - 1 && line[length - 1] != '\n')
+        {
+            ERROR("record longer than %u characters in s-record file\n", SREC_MAX_LINE_LENGTH);
+            return -1;
+        }
+
+        while(length > 0 && isspace((unsigned char)line[length - 1]))
+            length--;
+
+        if(length == 0)
+            continue;
+
+        if(isTerminated)
+        {
+            ERROR("record found after the termination record of s-record file\n");
+            return -1;
+        }
+
+        if(line[0] != 'S' || !isdigit((unsigned char)line[1]))
+        {
+            ERROR("record mark not found in s-record file\n");
+            return -1;
+        }
+
+        recordType = line[1] - '0';
+
+        if((length & 1) != 0 || length < 4)
+        {
+            ERROR("record of type S%u has an odd number of digits\n", recordType);
+            return -1;
+        }
+
+        /* decode and sum the byte count, address, data and checksum bytes in one pass */
+        high = hexDigitValues[(uint8_t)line[2]];
+        low = hexDigitValues[(uint8_t)line[3]];
+        byteCount = (high << 4) | low;
+        checksum = byteCount;
+
+        if(((high | low) & 0xf0) != 0 || byteCount != (length - 4) / 2)
+        {
+            ERROR("wrong record byte count for type S%u\n", recordType);
+            return -1;
+        }
+
+        for(i = 0; i < byteCount; i++)
+        {
+            high = hexDigitValues[(uint8_t)line[4 + i * 2]];
+            low = hexDigitValues[(uint8_t)line[5 + i * 2]];
+
+            if(((high | low) & 0xf0) != 0)
+            {
+                ERROR("failed to read record data byte from s-record file\n");
+                return -1;
+            }
+
+            buffer[i] = (high << 4) | low;
+            checksum += buffer[i];
+        }
+
+        if((checksum & 0xff) != 0xff)
+        {
+            ERROR("wrong record checksum\n");
+            return -1;
+        }
+
+        if((addressSize = srecAddressSizes[recordType]) == 0)
+        {
+            if((flags & INTEL_HEX_IGNORE_UNKNOWN_RECORD))
+            {
+                WARNING("unknown record of type S%u\n", recordType);
+                continue;
+            }
+
+            ERROR("unknown record of type S%u\n", recordType);
+            return -1;
+        }
+
+        if(byteCount < addressSize + 1)
+        {
+            ERROR("wrong record info for type S%u: byteCount=%u\n", recordType, byteCount);
+            return -1;
+        }
+
+        for(address = 0, i = 0; i < addressSize; i++)
+            address = (address << 8) | buffer[i];
+
+        size = byteCount - addressSize - 1;
+
+        if(recordType >= 1 && recordType <= 3)
+        {
+            if(size > 0 && intelHex_saveDataToHexInfo(hex, &buffer[addressSize], NULL, size, address) != 0)
+                return -1;
+
+            dataRecordCount++;
+        }
+        else if(recordType != 0 && size != 0)
+        {
+            ERROR("wrong record info for type S%u: byteCount=%u\n", recordType, byteCount);
+            return -1;
+        }
+        else if(recordType == 5 || recordType == 6)
+        {
+            if(address != (dataRecordCount & ((recordType == 5) ? 0xffff : 0xffffff)))
+            {
+                ERROR("record count %u does not match the %u data records\n", address, dataRecordCount);
+                return -1;
+            }
+        }
+        else if(recordType >= 7)
+        {
+            hex->eip = address;
+            isTerminated = 1;
+        }
+    }
+
+    if(ferror(file) || !isTerminated)
+    {
+        ERROR("termination record not found in s-record file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * merge
+ */
+
+typedef struct {
+    const IntelHexMemory *memory;
+    const IntelHexData *data;
+    uint32_t offset;
+    uint32_t address;
+    uint64_t remainingSize;
+} MergeCursor;
+
+static void startMemory(MergeCursor *cursor, const IntelHexMemory *memory)
+{
+    cursor->memory = memory;
+
+    if(memory != NULL)
+    {
+        cursor->data = memory->head;
+        cursor->offset = 0;
+        cursor->address = memory->baseAddress;
+        cursor->remainingSize = (memory->size == 0) ? 0x100000000ULL : memory->size;
+    }
+}
+
+static inline uint32_t cursorEndAddress(const MergeCursor *cursor)
+{
+    return cursor->address + (uint32_t)(cursor->remainingSize - 1);
+}
+
+static int appendDataToHexInfo(IntelHex *hex, IntelHexMemory **tailMemory, const uint8_t *data, uint32_t size, uint32_t baseAddress)
+{
+    IntelHexMemory *memory = *tailMemory;
+    IntelHexData *tail;
+    uint32_t endAddress = baseAddress + size - 1;
+
+    if(endAddress > hex->endmostAddress)
+    {
+        ERROR("hex memory at 0x%.8x with %u bytes exceeded the maximum address of 0x%.8x\n", baseAddress, size, hex->endmostAddress);
+        return -1;
+    }
+
+    if(endAddress > hex->endAddress)
+    {
+        if(endAddress > MAX_16BIT)
+            hex->endAddress = MAX_32BIT;
+        else if(endAddress > MAX_8BIT)
+            hex->endAddress = MAX_16BIT;
+    }
+
+    /* the merge emits memory in ascending order, so data only ever extends the last memory */
+    if(memory != NULL && (uint32_t)(memory->baseAddress + memory->size) == baseAddress)
+    {
+        if((tail = copyHexData(data, NULL, &memory->tail, size)) == NULL)
+            return -1;
+
+        memory->size += size;
+        memory->tail = tail;
+        return 0;
+    }
+
+    if((memory = (IntelHexMemory *)malloc(sizeof(IntelHexMemory))) == NULL)
+    {
+        ERROR("failed to allocate memory for IntelHexMemory structure\n");
+        return -1;
+    }
+
+    memory->next = NULL;
+    memory->baseAddress = baseAddress;
+    memory->size = size;
+    memory->head = NULL;
+
+    if((memory->tail = copyHexData(data, NULL, &memory->head, size)) == NULL)
+    {
+        free(memory);
+        return -1;
+    }
+
+    if(*tailMemory == NULL)
+        hex->memory = memory;
+    else
+        (*tailMemory)->next = memory;
+
+    *tailMemory = memory;
+    return 0;
+}
+
+/* move the cursor size bytes forward, appending the bytes passed to hex unless it is NULL */
+static int advanceCursor(MergeCursor *cursor, uint64_t size, IntelHex *hex, IntelHexMemory **tailMemory)
+{
+    uint32_t copySize;
+
+    while(size > 0)
+    {
+        copySize = cursor->data->size - cursor->offset;
+
+        if(copySize > size)
+            copySize = size;
+
+        if(hex != NULL && appendDataToHexInfo(hex, tailMemory, &cursor->data->data[cursor->offset], copySize, cursor->address) != 0)
+            return -1;
+
+        cursor->address += copySize;
+        cursor->remainingSize -= copySize;
+        size -= copySize;
+
+        if((cursor->offset += copySize) == cursor->data->size)
+        {
+            cursor->data = cursor->data->next;
+            cursor->offset = 0;
+        }
+    }
+
+    if(cursor->remainingSize == 0)
+        startMemory(cursor, cursor->memory->next);
+
+    return 0;
+}
+
+static void printInputName(char *buffer, size_t size, const char * const *inputNames, int input)
+{
+    if(inputNames != NULL && inputNames[input] != NULL)
+        snprintf(buffer, size, "\"%s\"", inputNames[input]);
+    else
+        snprintf(buffer, size, "input %d", input);
+}
+
+int intelHex_merge(const IntelHex * const *inputHex, const char * const *inputNames, int inputCount, IntelHex *outputHex, uint32_t flags)
+{
+    MergeCursor *cursors;
+    IntelHexMemory *tailMemory = NULL;
+    const IntelHex *entryHex = NULL;
+    int status = 0;
+    int overlapped = 0;
+    char name[128];
+    char firstName[128];
+    int first;
+    int i;
+
+    if(inputHex == NULL || inputCount < 1 || outputHex == NULL)
+    {
+        ERROR("at least one input and an output must be specified\n");
+        return -1;
+    }
+
+    if((cursors = (MergeCursor *)malloc(inputCount * sizeof(MergeCursor))) == NULL)
+    {
+        ERROR("failed to allocate memory for merge cursors\n");
+        return -1;
+    }
+
+    intelHex_initializeHexInfo(outputHex, flags);
+
+    for(i = 0; i < inputCount; i++)
+    {
+        startMemory(&cursors[i], inputHex[i]->memory);
+
+        if(IS_VALID_ADDRESS(inputHex[i]->eip) || IS_VALID_ADDRESS(inputHex[i]->cs))
+        {
+            if(entryHex == NULL)
+                entryHex = inputHex[i];
+            else if(entryHex->eip != inputHex[i]->eip || entryHex->cs != inputHex[i]->cs || entryHex->ip != inputHex[i]->ip)
+                WARNING("start address of input %d ignored for the one of an earlier input\n", i);
+        }
+    }
+
+    if(entryHex != NULL)
+    {
+        outputHex->eip = entryHex->eip;
+        outputHex->cs = entryHex->cs;
+        outputHex->ip = entryHex->ip;
+    }
+
+    /**
+     * every step takes the lowest pending address over all inputs, the first
+     * input wins a tie, and emits its bytes up to where an earlier input
+     * starts; the bytes of later inputs below that point are overlaps
+     */
+    while(status == 0)
+    {
+        uint32_t endAddress;
+
+        for(first = -1, i = 0; i < inputCount; i++)
+        {
+            if(cursors[i].memory != NULL && (first < 0 || cursors[i].address < cursors[first].address))
+                first = i;
+        }
+
+        if(first < 0)
+            break;
+
+        endAddress = cursorEndAddress(&cursors[first]);
+
+        for(i = 0; i < first; i++)
+        {
+            if(cursors[i].memory != NULL && cursors[i].address <= endAddress)
+                endAddress = cursors[i].address - 1;
+        }
+
+        for(i = first + 1; i < inputCount; i++)
+        {
+            uint32_t overlapEndAddress;
+
+            if(cursors[i].memory == NULL || cursors[i].address > endAddress)
+                continue;
+
+            overlapEndAddress = cursorEndAddress(&cursors[i]);
+
+            if(overlapEndAddress > endAddress)
+                overlapEndAddress = endAddress;
+
+            printInputName(name, sizeof(name), inputNames, i);
+            printInputName(firstName, sizeof(firstName), inputNames, first);
+
+            if((flags & INTEL_HEX_MERGE_PRIORITY))
+                WARNING("%s at 0x%.8x ~ 0x%.8x overlapped %s, which was kept\n", name, cursors[i].address, overlapEndAddress, firstName);
+            else
+            {
+                ERROR("%s at 0x%.8x ~ 0x%.8x overlapped %s\n", name, cursors[i].address, overlapEndAddress, firstName);
+                overlapped = 1;
+            }
+
+            advanceCursor(&cursors[i], (uint64_t)overlapEndAddress - cursors[i].address + 1, NULL, NULL);
+        }
+
+        /* once an overlap is found the remaining ones are still reported, but nothing is copied */
+        if(advanceCursor(&cursors[first], (uint64_t)endAddress - cursors[first].address + 1, overlapped ? NULL : outputHex, &tailMemory) != 0)
+            status = -1;
+    }
+
+    if(overlapped)
+        status = -1;
+
+    free(cursors);
+
+    if(status != 0)
+        intelHex_destroyHexInfo(outputHex);
+
+    return status;
+}
+
+/******************************************************************************
+ * streaming conversion
+ */
+
+typedef struct {
+    FILE *file;
+    int format;
+    IntelHexMemory *lastMemory;     /* range the last data went into */
+    HexRecordWindow window;         /* hex output */
+    uint32_t recordLength;
+    uint32_t recordAddress;
+    uint32_t recordSize;
+    uint8_t record[255];
+    long chunkPosition;             /* bin output: position of the size of the open chunk, -1 if none */
+    uint32_t chunkAddress;
+    uint64_t chunkSize;
+} HexStream;
+
+/**
+ * add an address range, without data, to the memory list of hex, rejecting
+ * overlaps as intelHex_saveDataToHexInfo() does; only the ranges are kept, so
+ * memory use depends on the number of ranges, not on their size
+ */
+static int addStreamRange(HexStream *stream, IntelHex *hex, uint32_t size, uint32_t baseAddress)
+{
+    IntelHexMemory *previousMemory = NULL;
+    IntelHexMemory *currentMemory;
+    IntelHexMemory *memory = stream->lastMemory;
+    uint32_t endAddress;
+
+    if(baseAddress > hex->endmostAddress || (size - 1) > (hex->endmostAddress - baseAddress))
+    {
+        ERROR("hex memory at 0x%.8x with %u bytes exceeded the maximum address of 0x%.8x\n", baseAddress, size, hex->endmostAddress);
+        return -1;
+    }
+
+    endAddress = baseAddress + size - 1;
+
+    /* records mostly follow each other, extending the range of the last one */
+    if(memory != NULL && (uint64_t)memory->baseAddress + memory->size == baseAddress && (memory->next == NULL || endAddress < memory->next->baseAddress))
+    {
+        memory->size += size;
+        return 0;
+    }
+
+    for(currentMemory = hex->memory; currentMemory != NULL; previousMemory = currentMemory, currentMemory = currentMemory->next)
+    {
+        if(endAddress >= currentMemory->baseAddress && baseAddress < (currentMemory->baseAddress + currentMemory->size))
+        {
+            ERROR("hex memory at 0x%.8x ~ 0x%.8x overlapped hex memory at 0x%.8x ~ 0x%.8x\n", baseAddress, endAddress, currentMemory->baseAddress, currentMemory->baseAddress + currentMemory->size - 1);
+            return -1;
+        }
+
+        if(baseAddress < currentMemory->baseAddress)
+            break;
+    }
+
+    if(previousMemory != NULL && (uint64_t)previousMemory->baseAddress + previousMemory->size == baseAddress)
+    {
+        memory = previousMemory;
+        memory->size += size;
+
+        if(currentMemory != NULL && (uint64_t)endAddress + 1 == currentMemory->baseAddress)
+        {
+            memory->size += currentMemory->size;
+            memory->next = currentMemory->next;
+            free(currentMemory);
+        }
+    }
+    else if(currentMemory != NULL && (uint64_t)endAddress + 1 == currentMemory->baseAddress)
+    {
+        memory = currentMemory;
+        memory->baseAddress = baseAddress;
+        memory->size += size;
+    }
+    else
+    {
+        if((memory = (IntelHexMemory *)malloc(sizeof(IntelHexMemory))) == NULL)
+        {
+            ERROR("failed to allocate memory for IntelHexMemory structure\n");
+            return -1;
+        }
+
+        memory->baseAddress = baseAddress;
+        memory->size = size;
+        memory->head = NULL;
+        memory->tail = NULL;
+        memory->next = currentMemory;
+
+        if(previousMemory == NULL)
+            hex->memory = memory;
+        else
+            previousMemory->next = memory;
+    }
+
+    stream->lastMemory = memory;
+    return 0;
+}
+
+static int flushStreamRecord(HexStream *stream)
+{
+    if(stream->recordSize == 0)
+        return 0;
+
+    if(writeDataRecordsToHexFile(stream->file, &stream->window, stream->recordAddress, stream->record, stream->recordSize) != 0)
+        return -1;
+
+    stream->recordSize = 0;
+    return 0;
+}
+
+/* write the size of the open bin chunk, which was not known when its header was written */
+static int closeStreamChunk(HexStream *stream)
+{
+    long position;
+
+    if(stream->chunkPosition < 0)
+        return 0;
+
+    if((position = ftell(stream->file)) < 0 || fseek(stream->file, stream->chunkPosition, SEEK_SET) != 0 ||
+            writeValueToBinFile(stream->chunkSize, stream->file) != 0 || fseek(stream->file, position, SEEK_SET) != 0)
+    {
+        ERROR("failed to write data size info to bin file\n");
+        return -1;
+    }
+
+    stream->chunkPosition = -1;
+    return 0;
+}
+
+static int writeStreamData(void *context, IntelHex *hex, const uint8_t *data, uint32_t size, uint32_t address)
+{
+    HexStream *stream = context;
+    uint64_t recordEnd;
+    uint32_t length;
+
+    if(addStreamRange(stream, hex, size, address) != 0)
+        return -1;
+
+    if(stream->format == INTEL_HEX_FORMAT_BIN)
+    {
+        if(stream->chunkPosition < 0 || (uint64_t)stream->chunkAddress + stream->chunkSize != address || stream->chunkSize + size > MAX_32BIT)
+        {
+            if(closeStreamChunk(stream) != 0)
+                return -1;
+
+            if(writeValueToBinFile(address, stream->file) != 0 || (stream->chunkPosition = ftell(stream->file)) < 0 || writeValueToBinFile(0, stream->file) != 0)
+            {
+                ERROR("failed to write data base address info to bin file\n");
+                return -1;
+            }
+
+            stream->chunkAddress = address;
+            stream->chunkSize = 0;
+        }
+
+        if(fwrite(data, 1, size, stream->file) != size)
+        {
+            ERROR("failed to write %u bytes of data to bin file\n", size);
+            return -1;
+        }
+
+        stream->chunkSize += size;
+        return 0;
+    }
+
+    /* data is gathered into records aligned to the record length, as writeHexInfoToHexFile() writes them */
+    while(size > 0)
+    {
+        if(stream->recordSize > 0 && stream->recordAddress + stream->recordSize != address && flushStreamRecord(stream) != 0)
+            return -1;
+
+        if(stream->recordSize == 0)
+            stream->recordAddress = address;
+
+        recordEnd = ((uint64_t)stream->recordAddress / stream->recordLength + 1) * stream->recordLength;
+        length = ((uint64_t)address + size > recordEnd) ? (uint32_t)(recordEnd - address) : size;
+
+        memcpy(&stream->record[stream->recordSize], data, length);
+        stream->recordSize += length;
+        data += length;
+        address += length;
+        size -= length;
+
+        if(address == recordEnd && flushStreamRecord(stream) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int intelHex_streamConvert(const char *inputFilename, int outputFormat, const char *outputFilename, IntelHex *summaryHex, uint32_t flags)
+{
+    HexStream stream;
+    FILE *inputFile;
+    IntelHex hex;
+    int status = -1;
+
+    if(inputFilename == NULL || outputFilename == NULL)
+    {
+        ERROR("inputFilename and outputFilename must be specified\n");
+        return -1;
+    }
+
+    if(outputFormat != INTEL_HEX_FORMAT_HEX && outputFormat != INTEL_HEX_FORMAT_BIN)
+    {
+        ERROR("only hex and bin files can be written\n");
+        return -1;
+    }
+
+    if(openFiles(&inputFile, inputFilename, "r", &stream.file, outputFilename, (outputFormat == INTEL_HEX_FORMAT_HEX) ? "w" : "wb") != 0)
+        return -1;
+
+    if(summaryHex == NULL)
+        summaryHex = &hex;
+
+    intelHex_initializeHexInfo(summaryHex, flags);
+    stream.format = outputFormat;
+    stream.lastMemory = NULL;
+    stream.recordLength = (INTEL_HEX_FLAGS_RECORD_LENGTH(flags) == 0) ? DEFAULT_RECORD_LENGTH : INTEL_HEX_FLAGS_RECORD_LENGTH(flags);
+    stream.recordSize = 0;
+    stream.chunkPosition = -1;
+
+    /* the extent of the data is not known up front, so automatic addressing is 32-bit */
+    stream.window.endAddress = (INTEL_HEX_FLAGS_ADDRESSING(flags) == 0) ? MAX_32BIT : summaryHex->endmostAddress;
+    stream.window.isValid = 0;
+
+    /* the bin header is written once EIP, CS and IP are known, which takes a seekable file */
+    if(outputFormat == INTEL_HEX_FORMAT_BIN && (ftell(stream.file) != 0 || writeValueToBinFile(0, stream.file) != 0 ||
+            writeValueToBinFile(0, stream.file) != 0 || writeValueToBinFile(0, stream.file) != 0))
+        ERROR("bin file must be a regular file to be streamed\n");
+    else if(parseHexFile(inputFile, summaryHex, flags, writeStreamData, &stream) == 0)
+    {
+        if(outputFormat == INTEL_HEX_FORMAT_HEX)
+        {
+            if(flushStreamRecord(&stream) == 0 && writeStartAddressRecordsToHexFile(summaryHex, stream.file) == 0)
+            {
+                if(writeHexRecordToHexFile(stream.file, INTEL_HEX_RECORD_END_OF_FILE, 0, 0, NULL) != 0)
+                    ERROR("failed to write end-of-file record to hex file\n");
+                else
+                    status = 0;
+            }
+        }
+        else if(closeStreamChunk(&stream) == 0)
+        {
+            if(fseek(stream.file, 0, SEEK_SET) != 0 || writeValueToBinFile(summaryHex->eip, stream.file) != 0 ||
+                    writeValueToBinFile(summaryHex->cs, stream.file) != 0 || writeValueToBinFile(summaryHex->ip, stream.file) != 0)
+                ERROR("failed to write EIP, CS and IP info to bin file\n");
+            else
+                status = 0;
+        }
+    }
+
+    if(closeFile(inputFile) != 0 && status == 0)
+    {
+        ERROR("failed to read \"%s\" file\n", inputFilename);
+        status = -1;
+    }
+
+    if(closeFile(stream.file) != 0 && status == 0)
+    {
+        ERROR("failed to write \"%s\" file\n", outputFilename);
+        status = -1;
+    }
+
+    if(status != 0 || summaryHex == &hex)
+        intelHex_destroyHexInfo(summaryHex);
+
+    return status;
+}
+
+/******************************************************************************
+ * conversion
+ */
+
+int intelHex_fileFormat(const char *filename)
+{
+    static const struct {
+        const char *extension;
+        int format;
+    } formats[] = {
+        { ".elf", INTEL_HEX_FORMAT_ELF },
+        { ".abs", INTEL_HEX_FORMAT_ELF },
+        { ".x", INTEL_HEX_FORMAT_ELF },
+        { ".mot", INTEL_HEX_FORMAT_SREC },
+        { ".srec", INTEL_HEX_FORMAT_SREC },
+        { ".s19", INTEL_HEX_FORMAT_SREC },
+        { ".s28", INTEL_HEX_FORMAT_SREC },
+        { ".s37", INTEL_HEX_FORMAT_SREC },
+        { ".bin", INTEL_HEX_FORMAT_BIN }
+    };
+    size_t length = strlen(filename);
+    size_t extension;
+    size_t i;
+
+    /* "image.hex.gz" is a hex file */
+    if(isGzipFile(filename))
+        length -= 3;
+
+    for(extension = length; extension > 0 && filename[extension - 1] != '.' && filename[extension - 1] != '/'; extension--)
+        ;
+
+    if(extension > 0 && filename[extension - 1] == '.')
+    {
+        for(i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        {
+            if(strlen(formats[i].extension) == length - extension + 1 && strncasecmp(&filename[extension - 1], formats[i].extension, length - extension + 1) == 0)
+                return formats[i].format;
+        }
+    }
+
+    return INTEL_HEX_FORMAT_HEX;
+}
+
+int intelHex_convert(int inputFormat, const char *inputFilename, const IntelHex *inputHex, int outputFormat, const char *outputFilename, IntelHex *outputHex, uint32_t flags)
+{
+    int status = -1;
+    FILE *inputFile;
+    FILE *outputFile;
+    IntelHex hex;
+
+    if((inputFilename == NULL && inputHex == NULL) || (inputFilename != NULL && inputHex != NULL))
+    {
+        ERROR("at most one of inputFilename and inputHex must be specified\n");
+        return -1;
+    }
+
+    if(outputFilename == NULL && outputHex == NULL)
+    {
+        ERROR("at least one of outputFilename and outputHex must be specified\n");
+        return -1;
+    }
+
+    if(outputFilename != NULL && outputFormat != INTEL_HEX_FORMAT_HEX && outputFormat != INTEL_HEX_FORMAT_BIN)
+    {
+        ERROR("%s file format is supported for input only\n", (outputFormat == INTEL_HEX_FORMAT_ELF) ? "elf" : "s-record");
+        return -1;
+    }
+
+    if(openFiles(&inputFile, inputFilename, (inputFormat == INTEL_HEX_FORMAT_HEX || inputFormat == INTEL_HEX_FORMAT_SREC) ? "r" : "rb", &outputFile, outputFilename, (outputFormat == INTEL_HEX_FORMAT_HEX) ? "w" : "wb") != 0)
+        return -1;
+
+    if(outputHex == NULL)
+        outputHex = &hex;
+
+    if(inputFile == NULL)
+        status = copyHexInfo(inputHex, outputHex, flags);
+    else
+    {
+        if(inputFormat == INTEL_HEX_FORMAT_HEX)
+            status = readHexInfoFromHexFile(inputFile, outputHex, flags);
+        else if(inputFormat == INTEL_HEX_FORMAT_ELF)
+            status = readHexInfoFromElfFile(inputFile, outputHex, flags);
+        else if(inputFormat == INTEL_HEX_FORMAT_SREC)
+            status = readHexInfoFromSrecFile(inputFile, outputHex, flags);
+        else
+            status = readHexInfoFromBinFile(inputFile, outputHex, flags);
+
+        /* a gzip file is only known to be intact once its trailer is read */
+        if(closeFile(inputFile) != 0 && status == 0)
+        {
+            ERROR("failed to read \"%s\" file\n", inputFilename);
+            status = -1;
+        }
+    }
+
+    if(outputFile != NULL)
+    {
+        if(status == 0)
         {
             if(outputFormat == INTEL_HEX_FORMAT_HEX)
                 status = writeHexInfoToHexFile(outputHex, outputFile, INTEL_HEX_FLAGS_RECORD_LENGTH(flags));
@@ -1168,7 +2552,7 @@ int intelHex_convert(int inputFormat, const char *inputFilename, const IntelHex
                 status = writeHexInfoToBinFile(outputHex, outputFile);
         }
 
-        fclose(outputFile);
+        closeFile(outputFile);
     }
 
     if(status != 0 || outputHex == &hex)
@@ -1195,12 +2579,19 @@ static void usage(const char *name)
 
     printf(PREFIX "usage:\n"
             "  \n"
-            "  %s <input file format: \"-hex\" or \"-bin\"> <input file> <output file format: \"-hex\" or \"-bin\"> <output file> [optional parameters]\n"
+            "  %s <input file format: \"-hex\", \"-bin\", \"-elf\" or \"-srec\"> <input file> [<input file format> <input file>...] <output file format: \"-hex\" or \"-bin\"> <output file> [optional parameters]\n"
+            "  \n"
+            "  several input files are merged into the output file\n"
             "  \n"
             "  [optional parameters]\n"
             "    -rl<[0 to 255]>, to specify the maximum data record length; 0 to 255 bytes\n"
             "    -ur, to allow unknown record\n"
             "    -ad<[8,16,32]>, to force the addressing\n"
+            "    -pr, to merge overlapping input files, taking the bytes of the first one\n"
+            "    -st, to convert a single hex input file record by record, in bounded memory\n"
+            "  \n"
+            "  \"-\" as a file name is the standard input or output; input files ending in \".gz\"\n"
+            "  are decompressed as they are read\n"
             "  \n",
             name);
 }
@@ -1226,40 +2617,130 @@ static int getDecimalValue(const char *data, int maxDigits)
     return value;
 }
 
+static int getFormat(const char *data)
+{
+    if(strcmp(data, "-hex") == 0)
+        return INTEL_HEX_FORMAT_HEX;
+
+    if(strcmp(data, "-bin") == 0)
+        return INTEL_HEX_FORMAT_BIN;
+
+    if(strcmp(data, "-elf") == 0)
+        return INTEL_HEX_FORMAT_ELF;
+
+    if(strcmp(data, "-srec") == 0)
+        return INTEL_HEX_FORMAT_SREC;
+
+    return -1;
+}
+
+static const char *getFormatName(int format)
+{
+    static const char * const names[] = { "hex", "bin", "elf", "s-record" };
+
+    return names[format];
+}
+
+static int mergeFiles(const int *inputFormats, char * const *inputFilenames, int inputCount, int outputFormat, const char *outputFilename, IntelHex *hex, uint32_t flags)
+{
+    IntelHex *inputHex;
+    const IntelHex **inputPointers;
+    FILE *inputFile;
+    FILE *outputFile;
+    int status = -1;
+    int readCount;
+
+    inputHex = (IntelHex *)malloc(inputCount * sizeof(IntelHex));
+    inputPointers = (const IntelHex **)malloc(inputCount * sizeof(IntelHex *));
+
+    if(inputHex == NULL || inputPointers == NULL)
+    {
+        ERROR("failed to allocate memory for input files\n");
+        free(inputHex);
+        free(inputPointers);
+        return -1;
+    }
+
+    for(readCount = 0; readCount < inputCount; readCount++)
+    {
+        if(intelHex_convert(inputFormats[readCount], inputFilenames[readCount], NULL, inputFormats[readCount], NULL, &inputHex[readCount], flags) != 0)
+            break;
+
+        inputPointers[readCount] = &inputHex[readCount];
+    }
+
+    if(readCount == inputCount && intelHex_merge(inputPointers, (const char * const *)inputFilenames, inputCount, hex, flags) == 0)
+    {
+        /* the merged memory is written as it is, without copying it into another hex info structure */
+        if(openFiles(&inputFile, NULL, NULL, &outputFile, outputFilename, (outputFormat == INTEL_HEX_FORMAT_HEX) ? "w" : "wb") == 0)
+        {
+            if(outputFormat == INTEL_HEX_FORMAT_HEX)
+                status = writeHexInfoToHexFile(hex, outputFile, INTEL_HEX_FLAGS_RECORD_LENGTH(flags));
+            else
+                status = writeHexInfoToBinFile(hex, outputFile);
+
+            closeFile(outputFile);
+        }
+
+        if(status != 0)
+            intelHex_destroyHexInfo(hex);
+    }
+
+    while(readCount-- > 0)
+        intelHex_destroyHexInfo(&inputHex[readCount]);
+
+    free(inputHex);
+    free(inputPointers);
+    return status;
+}
+
 int main(int argc, char **argv)
 {
     uint32_t flags = 0;
-    int inputFormat;
+    int formats[argc / 2];
+    char *filenames[argc / 2];
+    int fileCount = 0;
+    int inputCount;
     int outputFormat;
     IntelHex hex;
     IntelHexMemory *memory;
+    FILE *info;
+    int stream = 0;
     int value;
     int i;
 
-    if(argc < 5)
-    {
-        usage(argv[0]);
-        return -1;
-    }
+    for(i = 1; i + 1 < argc && (formats[fileCount] = getFormat(argv[i])) >= 0; i += 2)
+        filenames[fileCount++] = argv[i + 1];
 
-    if((inputFormat = (strcmp(argv[1], "-hex") == 0) ? INTEL_HEX_FORMAT_HEX : INTEL_HEX_FORMAT_BIN) != INTEL_HEX_FORMAT_HEX && strcmp(argv[1], "-bin") != 0)
+    /* the last file is the output file */
+    if(fileCount < 2)
     {
         usage(argv[0]);
         return -1;
     }
 
-    if((outputFormat = (strcmp(argv[3], "-hex") == 0) ? INTEL_HEX_FORMAT_HEX : INTEL_HEX_FORMAT_BIN) != INTEL_HEX_FORMAT_HEX && strcmp(argv[3], "-bin") != 0)
+    inputCount = fileCount - 1;
+    outputFormat = formats[inputCount];
+
+    if(outputFormat != INTEL_HEX_FORMAT_HEX && outputFormat != INTEL_HEX_FORMAT_BIN)
     {
         usage(argv[0]);
         return -1;
     }
 
-    for(i = 5; i < argc; i++)
+    /* the report goes to the standard error when the output file is the standard output */
+    info = (strcmp(filenames[inputCount], "-") == 0) ? stderr : stdout;
+
+    for(; i < argc; i++)
     {
         if(strlen(argv[i]) < 4)
         {
             if(strcmp(argv[i], "-ur") == 0)
                 flags |= INTEL_HEX_IGNORE_UNKNOWN_RECORD;
+            else if(strcmp(argv[i], "-pr") == 0)
+                flags |= INTEL_HEX_MERGE_PRIORITY;
+            else if(strcmp(argv[i], "-st") == 0)
+                stream = 1;
             else
             {
                 usage(argv[0]);
@@ -1311,42 +2792,187 @@ int main(int argc, char **argv)
         }
     }
 
-    printf("converting %s file, \"%s\", to %s file, \"%s\", with parameters:\n"
+    /* records are streamed from a single hex input file only */
+    if(stream && (inputCount > 1 || formats[0] != INTEL_HEX_FORMAT_HEX))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    fprintf(info, "converting");
+
+    for(i = 0; i < inputCount; i++)
+        fprintf(info, "%s %s file, \"%s\",", (i == 0) ? "" : ((i == inputCount - 1) ? " and" : ""), getFormatName(formats[i]), filenames[i]);
+
+    fprintf(info, " to %s file, \"%s\", with parameters:\n"
             "  ignore unknown records: %s\n"
             "  addressing: %s\n"
             "  data record length: %d bytes %s\n"
+            "  overlapping inputs: %s\n"
+            "  streaming: %s\n"
             "  \n",
-                (inputFormat == INTEL_HEX_FORMAT_HEX) ? "hex" : "bin",
-                argv[2],
-                (outputFormat == INTEL_HEX_FORMAT_HEX) ? "hex" : "bin",
-                argv[4],
+                getFormatName(outputFormat),
+                filenames[inputCount],
                 ((flags & INTEL_HEX_IGNORE_UNKNOWN_RECORD)) ? "YES" : "NO",
                 (INTEL_HEX_FLAGS_ADDRESSING(flags) == INTEL_HEX_8BIT_ADDRESSING) ? "8-bit" :
                         ((INTEL_HEX_FLAGS_ADDRESSING(flags) == INTEL_HEX_16BIT_ADDRESSING) ? "16-bit" :
                                 ((INTEL_HEX_FLAGS_ADDRESSING(flags) == INTEL_HEX_32BIT_ADDRESSING) ? "32-bit" : "auto")),
                 (INTEL_HEX_FLAGS_RECORD_LENGTH(flags) == 0) ? DEFAULT_RECORD_LENGTH : INTEL_HEX_FLAGS_RECORD_LENGTH(flags),
-                        (INTEL_HEX_FLAGS_RECORD_LENGTH(flags) == 0) ? "(default)" : "");
+                        (INTEL_HEX_FLAGS_RECORD_LENGTH(flags) == 0) ? "(default)" : "",
+                ((flags & INTEL_HEX_MERGE_PRIORITY)) ? "first one wins" : "rejected",
+                stream ? "YES" : "NO");
+
+    if(stream)
+        value = intelHex_streamConvert(filenames[0], outputFormat, filenames[inputCount], &hex, flags);
+    else if(inputCount == 1)
+        value = intelHex_convert(formats[0], filenames[0], NULL, outputFormat, filenames[1], &hex, flags);
+    else
+        value = mergeFiles(formats, filenames, inputCount, outputFormat, filenames[inputCount], &hex, flags);
 
-    if(intelHex_convert(inputFormat, argv[2], NULL, outputFormat, argv[4], &hex, flags) != 0)
+    if(value != 0)
     {
-        printf("conversion failed!\n\n");
+        fprintf(info, "conversion failed!\n\n");
         return -1;
     }
 
-    printf("conversion successful!\n\n");
+    fprintf(info, "conversion successful!\n\n");
 
-    printf("summary:\n");
-    printf("  EIP: 0x%.8x %s\n", hex.eip, IS_VALID_ADDRESS(hex.eip) ? "" : "(unspecified)");
-    printf("  CS: 0x%.8x %s\n", hex.cs, IS_VALID_ADDRESS(hex.cs) ? "" : "(unspecified)");
-    printf("  IP: 0x%.8x %s\n", hex.ip, IS_VALID_ADDRESS(hex.ip) ? "" : "(unspecified)");
+    fprintf(info, "summary:\n");
+    fprintf(info, "  EIP: 0x%.8x %s\n", hex.eip, IS_VALID_ADDRESS(hex.eip) ? "" : "(unspecified)");
+    fprintf(info, "  CS: 0x%.8x %s\n", hex.cs, IS_VALID_ADDRESS(hex.cs) ? "" : "(unspecified)");
+    fprintf(info, "  IP: 0x%.8x %s\n", hex.ip, IS_VALID_ADDRESS(hex.ip) ? "" : "(unspecified)");
 
     for(i = 0, memory = hex.memory; memory != NULL; i++, memory = memory->next)
-        printf("  mem%d: 0x%.8x ~ 0x%.8x, %u bytes\n", i, memory->baseAddress, memory->baseAddress + memory->size - 1, memory->size);
+        fprintf(info, "  mem%d: 0x%.8x ~ 0x%.8x, %u bytes\n", i, memory->baseAddress, memory->baseAddress + memory->size - 1, memory->size);
 
-    printf("\n");
+    fprintf(info, "\n");
 
     intelHex_destroyHexInfo(&hex);
     return 0;
 }
 
 #endif /* INTELHEX_STANDALONE */
+
+#ifdef INTELHEX_BENCHMARK
+#include <time.h>
+
+static uint8_t referenceByteSum(const uint8_t *data, size_t size)
+{
+    uint8_t sum = 0;
+
+    while(size-- > 0)
+        sum += *data++;
+
+    return sum;
+}
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * compare the checksum kernels with the byte-at-a-time sum for every length
+ * and alignment a frame can have
+ */
+static int check(void)
+{
+    uint8_t source[512];
+    uint8_t destination[512];
+    size_t size;
+    size_t alignment;
+    int i;
+
+    for(i = 0; i < (int)sizeof(source); i++)
+        source[i] = (uint8_t)(i * 131 + 7);
+
+    for(size = 0; size <= 300; size++)
+    {
+        for(alignment = 0; alignment < 16; alignment++)
+        {
+            uint8_t expected = referenceByteSum(&source[alignment], size);
+
+            memset(destination, 0, sizeof(destination));
+
+            if(intelHex_byteSum(&source[alignment], size) != expected ||
+                    intelHex_copyByteSum(&destination[15 - alignment], &source[alignment], size) != expected ||
+                    memcmp(&destination[15 - alignment], &source[alignment], size) != 0)
+            {
+                ERROR("checksum mismatch: size %zu, alignment %zu\n", size, alignment);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static volatile uint8_t g_sink;
+
+static double measure(int kernel, const uint8_t *source, uint8_t *destination, size_t size)
+{
+    int iterations = 50000000 / (size + 16);
+    uint64_t start = now();
+    int i;
+
+    for(i = 0; i < iterations; i++)
+    {
+        switch(kernel)
+        {
+            case 0:
+                g_sink = referenceByteSum(source, size);
+                break;
+            case 1:
+                g_sink = intelHex_byteSum(source, size);
+                break;
+            case 2:
+                memcpy(destination, source, size);
+                g_sink = referenceByteSum(destination, size);
+                break;
+            default:
+                g_sink = intelHex_copyByteSum(destination, source, size);
+                break;
+        }
+    }
+
+    return (double)(now() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    /*boot mode frames: 0x10 selection (7), 0x3f bit rate (10), page data (256), 0x50 frame (262)*/
+    static const size_t sizes[] = { 7, 10, 16, 32, 64, 128, 255, 256, 261, 262, 1024 };
+    static uint8_t source[1024];
+    static uint8_t destination[1024];
+    size_t i;
+
+    if(check() != 0)
+        return -1;
+
+    printf("checksum kernels match the byte-at-a-time sum\n");
+
+#ifdef __SSE2__
+    printf("kernel: SSE2\n");
+#else
+    printf("kernel: scalar\n");
+#endif
+
+    for(i = 0; i < sizeof(source); i++)
+        source[i] = (uint8_t)rand();
+
+    printf("%6s %12s %12s %16s %16s\n", "bytes", "sum ns", "kernel ns", "copy+sum ns", "fused ns");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("%6zu %12.1f %12.1f %16.1f %16.1f\n", sizes[i],
+                measure(0, source, destination, sizes[i]), measure(1, source, destination, sizes[i]),
+                measure(2, source, destination, sizes[i]), measure(3, source, destination, sizes[i]));
+    }
+
+    return 0;
+}
+
+#endif /* INTELHEX_BENCHMARK */
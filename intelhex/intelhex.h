@@ -50,9 +50,37 @@
  *       with the latter represented as "0" due to overflow
  */
 
+/**
+ * ELF object file format (input only)
+ *
+ * the file is mapped into memory and the file bytes of every PT_LOAD program
+ * segment are referenced in place at the segment's physical (load) address,
+ * without copying them; the zero-filled tail of a segment (NOBITS sections
+ * such as .bss) is not part of the image; 32-bit and 64-bit files of either
+ * byte order are accepted, and the entry point becomes the EIP
+ */
+
+/**
+ * motorola s-record file format (input only)
+ *
+ * record          address (bytes)    description
+ * --------------------------------------------------------------------
+ * S0              2                  header, ignored
+ * S1, S2, S3      2, 3, 4            data
+ * S5, S6          2, 3               count of the data records so far
+ * S7, S8, S9      4, 3, 2            termination, with the EIP address
+ * --------------------------------------------------------------------
+ *
+ * each record is "S", the type digit, then the byte count, address, data and
+ * checksum as hexadecimal byte pairs; the byte count covers the address, data
+ * and checksum, and the checksum is the ones' complement of the sum of the
+ * byte count, address and data bytes
+ */
+
 #ifndef INTELHEX_H_
 #define INTELHEX_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -71,6 +99,7 @@
 typedef struct IntelHexData {
 	struct IntelHexData *next;
 	uint32_t size;
+	uint32_t capacity;
 	uint8_t *data;
 } IntelHexData;
 
@@ -95,14 +124,52 @@ typedef struct {
 	IntelHexMemory *memory;
 	uint32_t endAddress;
 	uint32_t endmostAddress;
+	void *mapping;
+	size_t mappingSize;
 } IntelHex;
 
+/**
+ * aligned page of hex memory
+ *
+ * the bytes of the page from offset to offset + size - 1 hold data, the
+ * others are padding; data points straight into the hex data chunks unless
+ * the bytes span two chunks or several memories share the page, in which
+ * case it points into the bounce buffer of the iterator
+ */
+typedef struct {
+	uint32_t address;
+	uint32_t offset;
+	uint32_t size;
+	const uint8_t *data;
+} IntelHexPage;
+
+/**
+ * page iterator
+ *
+ * note: the fields are private, except coalescedCount, the number of pages
+ *       returned once for several memories so far
+ */
+typedef struct {
+	const IntelHexMemory *memory;
+	const IntelHexData *data;
+	uint32_t dataOffset;
+	uint64_t address;
+	uint64_t memoryEndAddress;
+	uint64_t endAddress;
+	uint32_t pageSize;
+	uint8_t *bounce;
+	int fill;
+	uint32_t coalescedCount;
+} IntelHexPageIterator;
+
 /**
  * format
  */
 enum {
 	INTEL_HEX_FORMAT_HEX,
-	INTEL_HEX_FORMAT_BIN
+	INTEL_HEX_FORMAT_BIN,
+	INTEL_HEX_FORMAT_ELF,
+	INTEL_HEX_FORMAT_SREC
 };
 
 /**
@@ -112,6 +179,8 @@ enum {
  */
 enum {
 	INTEL_HEX_IGNORE_UNKNOWN_RECORD		= 0x80000000,
+	INTEL_HEX_MERGE_PRIORITY			= 0x40000000,
+	INTEL_HEX_TRIM_ERASED				= 0x20000000,
 	INTEL_HEX_32BIT_ADDRESSING			= 0x00800000,
 	INTEL_HEX_16BIT_ADDRESSING			= 0x00400000,
 	INTEL_HEX_8BIT_ADDRESSING			= 0x00200000
@@ -126,10 +195,11 @@ enum {
  * convert intel hexadecimal object file or binary file to intel hexadecimal object file or binary file
  *
  * inputFormat - file format of input file
- * inputFilename - name of input file
+ * inputFilename - name of input file; "-" for the standard input; a name
+ *                 ending in ".gz" is decompressed as it is read
  * inputHex - IntelHex input as an alternative to input file
  * outputFormat - file format of output file
- * outputFilename - name of output file
+ * outputFilename - name of output file; "-" for the standard output
  * outputHex - IntelHex output
  * flags - conversion parameters
  *
@@ -139,6 +209,30 @@ enum {
  */
 int intelHex_convert(int inputFormat, const char *inputFilename, const IntelHex *inputHex, int outputFormat, const char *outputFilename, IntelHex *outputHex, uint32_t flags);
 
+/**
+ * convert intel hexadecimal object file to intel hexadecimal object file or
+ * binary file record by record, without building the whole IntelHex first
+ *
+ * inputFilename - name of hex input file; "-" for the standard input, e.g. a pipe;
+ *                 a name ending in ".gz" is decompressed as it is read
+ * outputFormat - file format of output file
+ * outputFilename - name of output file; "-" for the standard output, for hex files only
+ * summaryHex - IntelHex output with EIP, CS, IP and the memory ranges found,
+ *              without any data; may be NULL
+ * flags - conversion parameters
+ *
+ * 0 if successful, non-zero otherwise
+ *
+ * note: memory use depends on the number of separate memory ranges, not on
+ *       their size; data is written in input order, hex records are aligned
+ *       to the record length as usual, and automatic addressing gives 32-bit
+ *       extended linear address records, since the extent of the data is
+ *       not known up front; a bin file must be a regular file, as its
+ *       header and chunk sizes are written once known;
+ *       don't forget to destroy summaryHex
+ */
+int intelHex_streamConvert(const char *inputFilename, int outputFormat, const char *outputFilename, IntelHex *summaryHex, uint32_t flags);
+
 /**
  * convert intel hexadecimal object file to binary file
  *
@@ -169,6 +263,36 @@ int intelHex_hexToBin(const char *inputFilename, const IntelHex *inputHex, const
  */
 int intelHex_binToHex(const char *inputFilename, const IntelHex *inputHex, const char *outputFilename, IntelHex *outputHex, uint32_t flags);
 
+/**
+ * guess the file format from the extension of a file name
+ *
+ * filename - name of the file
+ *
+ * INTEL_HEX_FORMAT_ELF for ".elf", ".abs" and ".x", INTEL_HEX_FORMAT_SREC for
+ * ".mot", ".srec", ".s19", ".s28" and ".s37", INTEL_HEX_FORMAT_BIN for ".bin",
+ * INTEL_HEX_FORMAT_HEX otherwise; a trailing ".gz" is skipped, e.g.
+ * "image.mot.gz" gives INTEL_HEX_FORMAT_SREC
+ */
+int intelHex_fileFormat(const char *filename);
+
+/**
+ * map a raw binary file, without any header, into hex info structure without
+ * copying it
+ *
+ * filename - name of the raw binary file
+ * baseAddress - memory base address of the first byte of the file
+ * hex - IntelHex output
+ * flags - conversion parameters; with INTEL_HEX_TRIM_ERASED, leading and
+ *         trailing 0xff bytes, which erased flash already holds, are left out
+ *
+ * 0 if successful, non-zero otherwise
+ *
+ * note: the file is referenced as one hex memory; a gzip file, whose name
+ *       ends in ".gz", or the standard input, "-", is read into an anonymous
+ *       mapping first; don't forget to destroy hex
+ */
+int intelHex_mapRawFile(const char *filename, uint32_t baseAddress, IntelHex *hex, uint32_t flags);
+
 /**
  * initialize the hex info structure
  *
@@ -192,6 +316,18 @@ int intelHex_initializeHexInfo(IntelHex *hex, uint32_t flags);
  */
 int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, uint64_t size, uint32_t baseAddress);
 
+/**
+ * save buffer data into hex info structure without copying it
+ *
+ * hex - IntelHex to save data into
+ * data - buffer data; must stay valid and unchanged until hex is destroyed
+ * size - size of data
+ * baseAddress - memory base address of data being saved
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int intelHex_referenceDataInHexInfo(IntelHex *hex, const uint8_t *data, uint64_t size, uint32_t baseAddress);
+
 /**
  * copy data from hex info structure
  *
@@ -206,7 +342,75 @@ int intelHex_saveDataToHexInfo(IntelHex *hex, const uint8_t *data, FILE *file, u
 int intelHex_copyDataFromHexInfo(IntelHex *hex, uint32_t baseAddress, uint8_t *data, FILE *file, uint64_t size);
 
 /**
- * destroy the contents of hex info structure
+ * start walking hex memory in aligned pages
+ *
+ * iterator - IntelHexPageIterator to initialize
+ * memory - first hex memory to walk; the ones linked after it follow
+ * startAddress - address of the first byte to walk
+ * endAddress - address of the last byte to walk
+ * pageSize - page size in bytes; pages are aligned to multiples of it
+ * bounce - buffer of pageSize bytes for pages spanning two data chunks
+ * fill - byte value; a page shared by several memories is returned once, with
+ *        the gaps between them set to fill; -1 to return such a page once per
+ *        memory instead
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int intelHex_initializePageIterator(IntelHexPageIterator *iterator, const IntelHexMemory *memory, uint32_t startAddress, uint32_t endAddress, uint32_t pageSize, uint8_t *bounce, int fill);
+
+/**
+ * get the next page with data
+ *
+ * iterator - IntelHexPageIterator to advance
+ * page - IntelHexPage to return the page in; its data stays valid until the next call
+ *
+ * 1 if a page was returned, 0 after the last page
+ */
+int intelHex_nextPage(IntelHexPageIterator *iterator, IntelHexPage *page);
+
+/**
+ * merge the memory of several hex info structures into one
+ *
+ * inputHex - IntelHex inputs, in order of priority
+ * inputNames - names of the inputs used in messages; NULL for "input <n>"
+ * inputCount - number of inputs
+ * outputHex - IntelHex output
+ * flags - conversion parameters; with INTEL_HEX_MERGE_PRIORITY, bytes present
+ *         in several inputs are taken from the first of them, otherwise every
+ *         overlapping range is reported and the merge fails
+ *
+ * 0 if successful, non-zero otherwise
+ *
+ * note: the memory lists are merged in a single pass over all inputs;
+ *       EIP, CS and IP are taken from the first input that has them;
+ *       don't forget to destroy outputHex
+ */
+int intelHex_merge(const IntelHex * const *inputHex, const char * const *inputNames, int inputCount, IntelHex *outputHex, uint32_t flags);
+
+/**
+ * sum bytes, modulo 256, as needed for Intel HEX and boot mode checksums
+ *
+ * data - bytes to sum
+ * size - number of bytes
+ *
+ * sum of the bytes; the checksum is its two's complement
+ */
+uint8_t intelHex_byteSum(const void *data, size_t size);
+
+/**
+ * copy bytes and sum them, modulo 256, in a single pass
+ *
+ * destination - destination buffer
+ * source - bytes to copy and sum
+ * size - number of bytes
+ *
+ * sum of the bytes
+ */
+uint8_t intelHex_copyByteSum(void *destination, const void *source, size_t size);
+
+/**
+ * destroy the contents of hex info structure, unmapping the input file it
+ * references, if any
  *
  * hex - IntelHex to destroy
  */
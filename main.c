@@ -9,10 +9,24 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "intelhex/intelhex.h"
+#include "stats.h"
+#include "capture.h"
+#include "replay.h"
+#include "profile.h"
+#include "decoder.h"
+#include "daemon.h"
+#include "fleet.h"
+#include "flashplan.h"
+#include "pagecache.h"
+#include "patch.h"
 
 
 /******************************************************************************
@@ -38,6 +52,17 @@
 #endif
 
 
+/******************************************************************************
+ * boot mode timing
+ */
+#define INITIAL_BIT_RATE              9600
+#define DEFAULT_BIT_RATE              115200
+#define SYNC_TIMEOUT_MS               15000     /*worst case of the former 30 retries of 500ms*/
+#define SYNC_INTERVAL_MIN_US          5000      /*first 0x00 burst interval, doubled on every unanswered burst*/
+#define SYNC_INTERVAL_MAX_US          100000
+#define BIT_RATE_SWITCH_MAX_US        25000     /*former fixed wait, used when the device needs longer*/
+
+
 /******************************************************************************
  * typedefs
  */
@@ -72,6 +97,9 @@ typedef enum {
     RESPONSE_CLOCK_MODE_INQUIRY_OK                  = 0x31,
     RESPONSE_MULTIPLICATION_RATIO_INQUIRY_OK        = 0x32,
     RESPONSE_OPERATING_FREQUENCY_INQUIRY_OK         = 0x33,
+    RESPONSE_USER_BOOT_AREA_INFORMATION_INQUIRY_OK  = 0x34,
+    RESPONSE_USER_AREA_INFORMATION_INQUIRY_OK       = 0x35,
+    RESPONSE_DATA_AREA_INFORMATION_INQUIRY_OK       = 0x3b,
     RESPONSE_BOOT_PROGRAM_STATUS_OK                 = 0x5f,
     RESPONSE_DEVICE_SELECTION_ERROR                 = 0x90,
     RESPONSE_NEW_BIT_RATE_SELECTION_ERROR           = 0xbf,
@@ -80,12 +108,6 @@ typedef enum {
     RESPONSE_BIT_RATE_INIT_ERROR                    = 0xff,
 } RESPONSE;
 
-typedef enum {
-    PAYLOAD_NONE,              /*No Payload is expected, and no error buffer is given*/
-    PAYLOAD_EXPECTED,          /*Payload is expected*/
-    PAYLOAD_NONE_WITH_ERR_BUF, /*No Payload is expected, and error buffer is given*/
-} PAYLOAD;
-
 /*Device Struct Representation*/
 #define SERIESNAME_LEN 48
 typedef struct {
@@ -102,14 +124,46 @@ typedef struct {
     unsigned int maximumOperatingFrequency;
 } CLOCK_TYPE;
 
+/*Flash Area Struct Representation*/
+typedef struct {
+    uint32_t startAddress;
+    uint32_t endAddress;
+} AREA;
+
+/*Programming Plan Struct Representation*/
+typedef struct {
+    uint32_t startAddress;
+    uint32_t endAddress;
+    const IntelHexMemory *memory;
+} PLAN_RANGE;
+
+#define PLAN_STEP_COUNT 2
+typedef struct {
+    unsigned char selection;
+    int rangeCnt;
+    PLAN_RANGE *ranges;
+} PLAN_STEP;
+
+/*Image Parsed In The Background*/
+typedef struct {
+    pthread_t thread;
+    const char *imageName;
+    IntelHex image;
+    int result;
+    atomic_int isDone;
+    int isJoined;
+    uint64_t start;
+    uint64_t end;
+} IMAGE_LOAD;
+
 /*Execution Parameters*/
 typedef struct {
     void *command;
     int commandLength;
+    const struct iovec *commandVector; /*alternative to command, sent with a single writev()*/
+    int commandVectorCnt;
     void *response;
     int responseCapacity;
-    PAYLOAD payload;
-    unsigned char expectedReply;
     int isBlocking;
     struct timeval *timeout;
 } EXECPARAM;
@@ -119,6 +173,8 @@ typedef struct {
  */
 static int g_serialHandle = -1;
 struct termios g_serialAttributes;
+static unsigned int g_bitRate = INITIAL_BIT_RATE;
+static uint64_t g_bitRateSwitched = 0;
 
 static int g_deviceListCnt = 0;
 static DEVICE *deviceList = NULL;
@@ -129,12 +185,55 @@ static unsigned char *g_clockModeList = NULL;
 int g_clockTypeListCnt = 0;
 static CLOCK_TYPE *g_clockTypeList = NULL;
 
+static int g_userBootAreaListCnt = 0;
+static AREA *g_userBootAreaList = NULL;
+
+static int g_userAreaListCnt = 0;
+static AREA *g_userAreaList = NULL;
+
+static int g_dataAreaListCnt = 0;
+static AREA *g_dataAreaList = NULL;
+
+static int g_profileListCnt = 0;
+static PROFILE g_profileList[PROFILE_MAX_COUNT];
+static const char *g_profileCacheName = NULL;
+
+static int g_progress = 0;
+static int g_progressTotal = 0;
+
+static FLASHPLAN g_flashPlan;
+static const PAGECACHE *g_pageCache = NULL;
+
+static const char **g_mergeNames = NULL;
+static int g_mergeCnt = 0;
+static uint32_t g_mergeFlags = 0;
+
+/*Raw Binary Input*/
+typedef struct {
+    const char *spec;           /*<file>@<address> as given*/
+    char *fileName;
+    uint32_t address;
+} RAW_BIN;
+
+static RAW_BIN *g_rawBins = NULL;
+static int g_rawBinCnt = 0;
+static uint32_t g_rawBinFlags = 0;
+
+static PATCH_SPEC g_patchSpec;
+static PATCH_OVERLAY g_patchOverlay;
+static PATCH_OVERLAY *g_patches = NULL;
+static uint32_t g_patchIndex = 0;
+
+static IMAGE_LOAD *g_imageLoad = NULL;
+
 
 /******************************************************************************
  * helper functions
  */
 static int writeData(const void *data, int size)
 {
+    stats_syscall(STATS_SYSCALL_WRITE, size);
+    capture_data(CAPTURE_TX, data, size);
     if(write(g_serialHandle, data, size) != size)
     {
         LOG_PERROR("write: ");
@@ -144,6 +243,27 @@ static int writeData(const void *data, int size)
     return 0;
 }
 
+static int writeDataVector(const struct iovec *vector, int count)
+{
+    ssize_t size = 0;
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        size += vector[i].iov_len;
+    }
+
+    stats_syscall(STATS_SYSCALL_WRITEV, size);
+    capture_vector(CAPTURE_TX, vector, count);
+    if(writev(g_serialHandle, vector, count) != size)
+    {
+        LOG_PERROR("writev: ");
+        return -1;
+    }
+
+    return 0;
+}
+
 static int readData(void *data, int size, int block, struct timeval *t)
 {
     static struct timeval timeout_default = { .tv_sec = 0, .tv_usec = 999999 / 2 };
@@ -163,6 +283,7 @@ static int readData(void *data, int size, int block, struct timeval *t)
     FD_ZERO(&set);
     FD_SET(g_serialHandle, &set);
 
+    stats_syscall(STATS_SYSCALL_SELECT, 0);
     int retVal = select(FD_SETSIZE, &set, 0, 0, block ? NULL : &timeout);
     if(retVal == 0)
     {
@@ -181,10 +302,43 @@ static int readData(void *data, int size, int block, struct timeval *t)
         LOG_PERROR("read: ");
         return -1;
     }
+    stats_syscall(STATS_SYSCALL_READ, size);
+    capture_data(CAPTURE_RX, data, size);
 
     return size;
 }
 
+/**
+ * wait up to timeoutUs for received data without reading it
+ *
+ * 1 if data is available, 0 on timeout, -1 on error
+ */
+static int waitForData(long timeoutUs)
+{
+    struct timeval timeout = { .tv_sec = timeoutUs / 1000000, .tv_usec = timeoutUs % 1000000 };
+    fd_set set;
+    int retVal;
+
+    FD_ZERO(&set);
+    FD_SET(g_serialHandle, &set);
+
+    stats_syscall(STATS_SYSCALL_SELECT, 0);
+    if((retVal = select(g_serialHandle + 1, &set, NULL, NULL, &timeout)) < 0)
+    {
+        LOG_PERROR("select: ");
+        return -1;
+    }
+
+    return retVal;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+    struct timespec t = { .tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+}
+
 static unsigned char computeChecksum(const unsigned char *data, int size)
 {
     unsigned char checksum = 0;
@@ -194,108 +348,168 @@ static unsigned char computeChecksum(const unsigned char *data, int size)
         return 0;
     }
 
-    while(size-- > 0)
-    {
-        checksum += data[size];
-    }
+    checksum = intelHex_byteSum(data, size);
 
     return (~checksum + 1);
 }
 
-static int executeCommand(EXECPARAM p)
+/**
+ * receive the response to command, reading whatever the port delivers and
+ * letting the decoder work out where the response ends
+ *
+ * isError receives whether the response is the command's error response
+ */
+static int readResponse(const EXECPARAM *p, unsigned char command, int *isError)
 {
-    if(p.command == NULL || p.commandLength <= 0 || p.response == NULL || p.responseCapacity <= 0)
+    DECODER decoder;
+
+    decoder_start(&decoder, command, p->response, p->responseCapacity);
+
+    while(decoder.status == DECODER_MORE)
     {
-        ERROR("invalid params\n");
-        return -1;
+        uint8_t *tail = &decoder.buffer[decoder.length];
+        int size = readData(tail, decoder.capacity - decoder.length, p->isBlocking, p->timeout);
+        if(size < 1)
+        {
+            return -1;
+        }
+
+        int consumed = decoder_feed(&decoder, tail, size);
+        if(consumed < size)
+        {
+            WARNING("dropped %d bytes after the response to %.2x\n", size - consumed, command);
+        }
     }
 
-    if(p.payload == PAYLOAD_EXPECTED && p.responseCapacity <= 1)
+    if(decoder.length > 0)
     {
-        ERROR("response buffer insufficient\n");
-        return -1;
+        int i;
+
+        LOG_DBG("   RSP:");
+
+        for(i = 0; i < decoder.length; i++)
+        {
+            LOG_DBG(" %.2x", decoder.buffer[i]);
+        }
+
+        LOG_DBG("\n");
     }
 
-    LOG_DBG("   COM: %.2x  payload: %d  blocking: %s\n", ((char *)p.command)[0], p.payload, (p.isBlocking == 0 ? "no" : "yes"));
-    if(writeData(p.command, p.commandLength) < 0)
+    switch(decoder.status)
     {
+        case DECODER_OVERFLOW:
+            ERROR("response buffer insufficient\n");
+            return -1;
+        case DECODER_CHECKSUM:
+            return -1;
+        default:
+            break;
+    }
+
+    *isError = decoder_isError(&decoder);
+    return decoder.length;
+}
+
+static int executeCommand(EXECPARAM p)
+{
+    if((p.commandVector == NULL ? (p.command == NULL || p.commandLength <= 0) : (p.commandVectorCnt <= 0)) || p.response == NULL || p.responseCapacity <= 0)
+    {
+        ERROR("invalid params\n");
         return -1;
     }
 
-    int responseCapacity = p.responseCapacity;
-    int responseSize = 0;
-    switch(p.payload)
+    unsigned char command = (p.commandVector != NULL) ? ((unsigned char *)p.commandVector[0].iov_base)[0] : ((unsigned char *)p.command)[0];
+    LOG_DBG("   COM: %.2x  blocking: %s\n", command, (p.isBlocking == 0 ? "no" : "yes"));
+
+    uint64_t sendStart = STATS_NOW();
+    if((p.commandVector != NULL ? writeDataVector(p.commandVector, p.commandVectorCnt) : writeData(p.command, p.commandLength)) < 0)
     {
-        case PAYLOAD_NONE:
-            responseCapacity = 1;
-            break;
-        case PAYLOAD_NONE_WITH_ERR_BUF:
-            if(responseCapacity < 2)
-            {
-                ERROR("invalid buffer size. provide error buffer\n");
-                return -1;
-            }
-            responseCapacity = 1;
-            break;
-        case PAYLOAD_EXPECTED:
-            /*follow-through*/
-        default:
-            break;
+        return -1;
     }
+    uint64_t sendEnd = STATS_NOW();
+
+    int isError = 0;
+    int responseSize = readResponse(&p, command, &isError);
+
+    stats_command(command, sendStart, sendEnd, STATS_NOW(), responseSize > 0 && !isError);
+    return responseSize;
+}
+
+/******************************************************************************
+ * syncBitRate()
+ * 
+ * Send 0x00 bursts until the device answers 0x00. The interval between
+ * bursts starts short and doubles on every unanswered burst, so a device
+ * already in boot mode is matched within a few milliseconds while a slow one
+ * is not flooded. The reply is taken as soon as it arrives; bytes other than
+ * 0x00 are stale line noise and are dropped.
+ * 
+ */
+static int syncBitRate(void)
+{
+    unsigned char command[1] = { COMMAND_INITIAL_TRANSMIT }; /*0x00*/
+    unsigned char response[1];
+    uint64_t start = stats_now();
+    uint64_t deadline = start + SYNC_TIMEOUT_MS * 1000000ULL;
+    long interval = SYNC_INTERVAL_MIN_US;
+    int bursts = 0;
 
-    while(responseCapacity > 0)
+    /*drop whatever the device or the line left behind before reset*/
+    tcflush(g_serialHandle, TCIOFLUSH);
+
+    while(stats_now() < deadline)
     {
-        int size = readData((unsigned char *)p.response + responseSize, responseCapacity, p.isBlocking, p.timeout);
-        if(size < 1)
+        uint64_t sendStart = STATS_NOW();
+        if(writeData(command, sizeof(command)) < 0)
         {
             return -1;
         }
-        /*Accommodate the error response*/
-        if(p.payload == PAYLOAD_NONE_WITH_ERR_BUF && ((unsigned char *)p.response)[0] != p.expectedReply)
+        uint64_t sendEnd = stats_now();
+        uint64_t burstEnd = sendEnd + interval * 1000ULL;
+        int synced = 0;
+        bursts++;
+
+        while(!synced)
         {
-            int tempSize = readData((unsigned char *)p.response + responseSize + 1, responseCapacity, p.isBlocking, p.timeout);
-            if(tempSize < 1)
+            uint64_t now = stats_now();
+            int retVal;
+
+            if(now >= burstEnd || (retVal = waitForData((burstEnd - now) / 1000)) == 0)
+            {
+                break;
+            }
+
+            if(retVal < 0 || readData(response, 1, 0, NULL) < 1)
             {
                 return -1;
             }
-            size += tempSize;
-        }
 
-        if(responseSize < 2 && (responseSize + size) > 1)
-        {
-            responseCapacity = ((unsigned char *)p.response)[1] - (size - (2 - responseSize)) + 1;
-        }
-        else
-        {
-            responseCapacity -= size;
+            if(response[0] == RESPONSE_INITIAL_TRANSMIT_OK)
+            {
+                synced = 1;
+            }
+            else
+            {
+                LOG_DBG("   dropped stale byte %.2x\n", response[0]);
+            }
         }
 
-        responseSize += size;
-    }
-
-    if(responseSize > 0)
-    {
-        int i;
-
-        LOG_DBG("   RSP:");
+        stats_command(COMMAND_INITIAL_TRANSMIT, sendStart, sendEnd, STATS_NOW(), synced);
 
-        for(i = 0; i < responseSize; i++)
+        if(synced)
         {
-            LOG_DBG(" %.2x", ((unsigned char *)p.response)[i]);
+            LOG("Automatic Adjustment OK after %d bursts in %.1f ms\n", bursts, (stats_now() - start) / 1e6);
+            return 0;
         }
 
-        LOG_DBG("\n");
-
-        if(p.payload == PAYLOAD_EXPECTED)
+        if((interval *= 2) > SYNC_INTERVAL_MAX_US)
         {
-            if(computeChecksum(p.response, responseSize - 1) != ((unsigned char *)p.response)[responseSize - 1])
-            {
-                return -1;
-            }
+            interval = SYNC_INTERVAL_MAX_US;
         }
     }
 
-    return responseSize;
+    ERROR("no answer to %d bursts in %d ms\n", bursts, SYNC_TIMEOUT_MS);
+    return -1;
 }
 
 /******************************************************************************
@@ -308,36 +522,24 @@ static int matchBitRates(void)
 {
     unsigned char response[1];
     unsigned char command[1];
-    int retries = 30; /*max number of retries is 30*/
-
-    command[0] = COMMAND_INITIAL_TRANSMIT; /*0x00*/
 
-    /*Retry 30 times*/
-    while(retries-- > 0)
-    {
-        LOG_DBG("tries left : %d\n", retries);
-        EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = 1, 
-                       .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
-        if(executeCommand(p) > 0)
-        {
-            if(response[0] != RESPONSE_INITIAL_TRANSMIT_OK)
-            {
-                return -1;
-            }
-            break;
-        }
-    }
-    if(retries <= 0)
+    if(syncBitRate() < 0)
     {
         return -1;
     }
 
-    LOG("Automatic Adjustment OK\n");
-
     command[0] = COMMAND_BIT_RATE_INIT; /*0x55*/
     EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = 1, 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
-    if(executeCommand(p) > 0)
+                   .isBlocking = 0, .timeout = NULL};
+    int size = executeCommand(p);
+
+    /*bursts sent while the device was answering the first one may still be answered*/
+    while(size > 0 && response[0] == RESPONSE_INITIAL_TRANSMIT_OK)
+    {
+        size = readData(response, 1, 0, NULL);
+    }
+
+    if(size > 0)
     {
         if(response[0] != RESPONSE_BIT_RATE_INIT_OK)
         {
@@ -378,7 +580,7 @@ static int getSupportedDevices(void)
     unsigned char command[1];
     command[0] = COMMAND_SUPPORTED_DEVICE_INQUIRY; /*0x20*/
     EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_EXPECTED, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_SUPPORTED_DEVICE_INQUIRY_OK && size == (response[1] + 3))
@@ -441,7 +643,7 @@ static int getSupportedDevices(void)
 static int setDevice(int deviceIndex)
 {
     unsigned char command[7];
-    unsigned char response[1];
+    unsigned char response[2];
     command[0] = COMMAND_DEVICE_SELECTION; /*0x10*/
     command[1] = 4;
 
@@ -461,8 +663,9 @@ static int setDevice(int deviceIndex)
     memcpy(&command[2], deviceList[deviceIndex].code, 4);
     command[6] = computeChecksum(command, sizeof(command) - 1);
 
-    EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = 1, 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+    /*a rejected device code is answered with 0x90 and an error byte*/
+    EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_GENERIC_OK)
@@ -503,7 +706,7 @@ static int getClockModes(void)
     command[0] = COMMAND_CLOCK_MODE_INQUIRY; /*0x21*/
 
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_EXPECTED, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_CLOCK_MODE_INQUIRY_OK)
@@ -545,7 +748,7 @@ static int getClockModes(void)
 static int setClockMode(int clockModeIndex)
 {
     unsigned char command[4];
-    unsigned char response[1];
+    unsigned char response[2];
     
     if(g_clockModeList == NULL)
     {
@@ -566,7 +769,7 @@ static int setClockMode(int clockModeIndex)
     command[3] = computeChecksum(command, sizeof(command) - 1);
 
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_GENERIC_OK)
@@ -610,7 +813,7 @@ static int getMultiplicationRatios(void)
     command[0] = COMMAND_MULTIPLICATION_RATIO_INQUIRY; /*0x22*/
 
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_EXPECTED, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_MULTIPLICATION_RATIO_INQUIRY_OK)
@@ -687,7 +890,7 @@ static int getOperatingFrequencies(void)
     command[0] = COMMAND_OPERATING_FREQUENCY_INQUIRY; /*0x23*/
 
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_EXPECTED, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_OPERATING_FREQUENCY_INQUIRY_OK)
@@ -785,7 +988,7 @@ static speed_t convertBitRate(unsigned int bitRate)
             outSpeed = B230400;
             break;
 #ifdef B460800
-        /*B460800 may not be defined in some systems*/
+        /*B460800 may not be defined in some systems*/
         case 460800:
             outSpeed = B460800;
             break;
@@ -836,8 +1039,9 @@ static int setBitRate(unsigned int bitRate, unsigned int frequency, char systemC
     command[9] = computeChecksum(command, sizeof(command) - 1);
 
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_NONE_WITH_ERR_BUF, .expectedReply = RESPONSE_GENERIC_OK, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = NULL};
     int size = executeCommand(p);
+    uint64_t acknowledged = stats_now();
     if(size < 1)
     {
         return -1;
@@ -869,9 +1073,15 @@ static int setBitRate(unsigned int bitRate, unsigned int frequency, char systemC
         return -1;
     }
 
-    /*Sleep 25ms*/
-    struct timespec wait = { .tv_sec = 0, .tv_nsec = 25000000 };
-    nanosleep(&wait, NULL);
+    /*
+     * the device switches once the 0x06 has left its transmitter, so one
+     * character time at the old bit rate after the reply arrived is enough.
+     * confirmBitRate() falls back to the former fixed wait for devices that
+     * take longer.
+     */
+    stats_phase(STATS_PHASE_BIT_RATE_WAIT);
+    sleepUntil(acknowledged + 10 * 1000000000ULL / g_bitRate);
+    stats_phase(STATS_PHASE_BIT_RATE);
 
     g_serialAttributes.c_ispeed = g_serialAttributes.c_ospeed = bitRate_termios;
     if(tcsetattr(g_serialHandle, TCSANOW, &g_serialAttributes))
@@ -880,6 +1090,8 @@ static int setBitRate(unsigned int bitRate, unsigned int frequency, char systemC
         LOG_PERROR("  tcsetattr: ");
         return -1;
     }
+    g_bitRate = bitRate;
+    g_bitRateSwitched = acknowledged;
 
     return 0;
 }
@@ -894,10 +1106,11 @@ static int confirmBitRate(void)
 {
     unsigned char command[1];
     unsigned char response[1];
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = BIT_RATE_SWITCH_MAX_US };
     
     command[0] = COMMAND_NEW_BIT_RATE_CONFIRMATION; /*0x06*/
     EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
+                   .isBlocking = 0, .timeout = &timeout};
     int size = executeCommand(p);
 
     if(size > 0 && response[0] == RESPONSE_GENERIC_OK)
@@ -905,328 +1118,2018 @@ static int confirmBitRate(void)
         return 0;
     }
 
+    /*the device had not switched yet; retry once the former fixed wait has passed*/
+    WARNING("bit rate not confirmed, retrying after %d us\n", BIT_RATE_SWITCH_MAX_US);
+    sleepUntil(g_bitRateSwitched + BIT_RATE_SWITCH_MAX_US * 1000ULL);
+    tcflush(g_serialHandle, TCIFLUSH);
+
+    p.timeout = NULL;
+    size = executeCommand(p);
+
+    if(size > 0 && response[0] == RESPONSE_GENERIC_OK)
+    {
+        return 0;
+    }
+
     return -1;
 }
 
 /******************************************************************************
- * activateFlashProgramming()
+ * cleanupAreaLists()
  * 
- * Transfer the RX63N/RX631 device into a programmable state.
- * NOTE: Do not issue a programming/erasure state transition command before
- *       the device selection, clock mode selection, and new
- *       bit rate selection commands.
- * NOTE: No handling forthe case where ID code protection is enabled
+ * Free the user boot, user and data area lists
  * 
  */
-static int activateFlashProgramming(void)
+static int cleanupAreaLists(void)
 {
-    unsigned char command[1];
-    unsigned char response[1];
-    /*specifications say that two bytes are needed for an error response, but only one is needed*/
-    command[0] = COMMAND_PROGRAMMING_ERASURE_STATE_TRANSITION; /*0x40*/
-
-    struct timeval timeout =  { .tv_sec = 1, .tv_usec = 0 };
-    EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = 1, 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = &timeout};//
-    int size = executeCommand(p);
+    if(g_userBootAreaList != NULL)
+    {
+        free(g_userBootAreaList);
+        g_userBootAreaList = NULL;
+    }
+    g_userBootAreaListCnt = 0;
 
-    if(size > 0)
+    if(g_userAreaList != NULL)
     {
-        LOG_DBG("activateFlashProgramming() response = 0x%x\n", response[0]);
-        /*ID code protection is enabled*/
-        if(response[0] == 0x16)
-        {
-            /*TODO: send ID code*/
-            ERROR("Unsupported: ID code protection is enabled");
-            return -1;
-        }
-        /*ID code protection is disabled*/
-        if(response[0] == 0x26)
-        {
-            return 0;
-        }
+        free(g_userAreaList);
+        g_userAreaList = NULL;
     }
+    g_userAreaListCnt = 0;
 
-    return -1;
+    if(g_dataAreaList != NULL)
+    {
+        free(g_dataAreaList);
+        g_dataAreaList = NULL;
+    }
+    g_dataAreaListCnt = 0;
+    return 0;
 }
 
 /******************************************************************************
- * programUserArea()
+ * getAreaInformation()
  * 
- * Program the user area with the loaded image file.
+ * Obtain the start and last addresses of the areas reported by one of the
+ * area information inquiries (0x24, 0x25, 0x2b). The response layout is
+ * shared by all three: reply, size, number of areas, then a 4-byte start
+ * address and a 4-byte last address per area, and the checksum.
  * 
  */
-static int programUserArea(const char *imageFile)
+static int getAreaInformation(unsigned char inquiry, unsigned char expectedReply, AREA **areaList, int *areaListCnt)
 {
-    unsigned char response[2];
-    unsigned char command[262]; /*1 byte cmd + 4 byte addr + 256 byte data + 1 byte checksum*/
-    
-    /*User/Data Area Programming Selection*/
-    command[0] = COMMAND_USER_DATA_AREA_PROGRAMMING_SELECTION; /*0x43*/
+    unsigned char response[100];
+    unsigned char command[1];
+    command[0] = inquiry;
 
-    /*Check the imageFile parsing before starting the user area programming*/
-    IntelHex image;
-    int result = intelHex_hexToBin(imageFile, NULL, NULL, &image, 0);
-    if(result != 0)
+    EXECPARAM p = {.command = command, .commandLength = sizeof(command), .response = response, .responseCapacity = sizeof(response), 
+                   .isBlocking = 0, .timeout = NULL};
+    int size = executeCommand(p);
+
+    if(size < 3 || response[0] != expectedReply || size != (response[1] + 3) || response[1] != (1 + response[2] * 8))
     {
-        ERROR("Failed to open firmware image file!\n");
         return -1;
     }
 
-    EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = 1, 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
-    int size = executeCommand(p);
-    if(size < 1 || response[0] != RESPONSE_GENERIC_OK)
+    *areaListCnt = response[2];
+    *areaList = NULL;
+    if(*areaListCnt == 0)
     {
-        ERROR("User/Data Area Programming Selection error!\n");
-        return -1;
+        return 0;
     }
 
-    LOG("Image OK\n");
-    LOG_DBG("Firmware Image Info:\n"
-            "  CS: %.8x\n"
-            "  EIP: %.8x\n"
-            "  IP: %.8x\n",
-            image.cs,
-            image.eip,
-            image.ip);
-
-    IntelHexMemory *memory = NULL;
-    IntelHexData *hexData = NULL;
-    uint32_t address = 0;
-    uint32_t flashSize = 0;
-    int dataSize = 0;
-    uint8_t *data = NULL;
+    *areaList = malloc(*areaListCnt * sizeof(AREA));
+    if(*areaList == NULL)
+    {
+        ERROR("malloc() fail\n");
+        *areaListCnt = 0;
+        return -1;
+    }
 
-    int hasError = 0;
+    int i;
+    int j = 3;
 
-    LOG("Programming to device...\n");
-    /*256-Byte Programming*/
-    command[0] = COMMAND_256_BYTE_PROGRAMMING; /*0x50*/
-    for(memory = image.memory; memory != NULL && !hasError; memory = memory->next)
+    for(i = 0; i < *areaListCnt; i++, j += 8)
     {
-        LOG_DBG("Memory: %.8x ~ %.8x (%d)\n", memory->baseAddress, memory->baseAddress + memory->size - 1, memory->size);
+        (*areaList)[i].startAddress = (response[j] << 24) | (response[j + 1] << 16) | (response[j + 2] << 8) | response[j + 3];
+        (*areaList)[i].endAddress = (response[j + 4] << 24) | (response[j + 5] << 16) | (response[j + 6] << 8) | response[j + 7];
 
-        address = memory->baseAddress;
+        LOG_DBG("Area %.2x/%d: %.8x ~ %.8x\n", inquiry, i, (*areaList)[i].startAddress, (*areaList)[i].endAddress);
+    }
 
-        for(hexData = memory->head; hexData != NULL && !hasError; hexData = hexData->next)
-        {
-            data = hexData->data;
-            dataSize = hexData->size;
+    return 0;
+}
 
-            /*flash per 256 bytes*/
-            while(dataSize > 0)
-            {
-                flashSize = (uint32_t)(address & 0xff);
+/******************************************************************************
+ * getAreas()
+ * 
+ * Obtain the user boot area, user area and data area maps of the selected
+ * device. Devices without a data area may reject the data area inquiry; that
+ * only leaves the data area list empty.
+ * 
+ */
+static int getAreas(void)
+{
+    cleanupAreaLists();
 
-                if(flashSize > 0)
-                {
-                    memset(&command[5], 0xff, flashSize);
-                    address &= ~0xff;
-                }
+    if(getAreaInformation(COMMAND_USER_BOOT_AREA_INFORMATION_INQUIRY, RESPONSE_USER_BOOT_AREA_INFORMATION_INQUIRY_OK, /*0x24*/
+                          &g_userBootAreaList, &g_userBootAreaListCnt) < 0)
+    {
+        ERROR("user boot area information inquiry failed\n");
+        cleanupAreaLists();
+        return -1;
+    }
 
-                command[1] = (address >> 24) & 0xff;
-                command[2] = (address >> 16) & 0xff;
-                command[3] = (address >> 8) & 0xff;
-                command[4] = address & 0xff;
+    if(getAreaInformation(COMMAND_USER_AREA_INFORMATION_INQUIRY, RESPONSE_USER_AREA_INFORMATION_INQUIRY_OK, /*0x25*/
+                          &g_userAreaList, &g_userAreaListCnt) < 0)
+    {
+        ERROR("user area information inquiry failed\n");
+        cleanupAreaLists();
+        return -1;
+    }
 
-                LOG_DBG("  Data: %.8x ~ %.8x (%d)\n", address, address + 256 - 1, 256);
+    if(getAreaInformation(COMMAND_DATA_AREA_INFORMATION_INQUIRY, RESPONSE_DATA_AREA_INFORMATION_INQUIRY_OK, /*0x2b*/
+                          &g_dataAreaList, &g_dataAreaListCnt) < 0)
+    {
+        WARNING("data area information inquiry failed, assuming no data area\n");
+        g_dataAreaList = NULL;
+        g_dataAreaListCnt = 0;
+    }
 
-                if(dataSize > (256 - flashSize))
-                {
-                    memcpy(&command[5 + flashSize], data, 256 - flashSize);
-                    data += (256 - flashSize);
-                    dataSize -= (256 - flashSize);
-                    flashSize = 256;
-                    address += 256;
-                }
-                else
-                {
-                    memcpy(&command[5 + flashSize], data, dataSize);
-                    data += dataSize;
-                    flashSize += dataSize;
-                    address += flashSize;
-                    memset(&command[5 + flashSize], 0xff, 256 - flashSize);
-                    dataSize = 0;
-                    flashSize = 256;
-                }
+    return 0;
+}
 
-                command[5 + flashSize] = computeChecksum(command, 5 + flashSize);
+/******************************************************************************
+ * selectDevice()
+ * 
+ * Select the device, trying the most recently cached profile first so that a
+ * repeat session on the same part skips the supported device inquiry. On a
+ * cache miss the device is inquired as usual, and profile points to the cached
+ * profile for its device code, or NULL if there is none.
+ * 
+ */
+static int selectDevice(const PROFILE **profile)
+{
+    int index;
 
-                EXECPARAM pprog = {.command = command, .commandLength = 262, .response = response, .responseCapacity = 2,
-                               .payload = PAYLOAD_NONE_WITH_ERR_BUF, .expectedReply = RESPONSE_GENERIC_OK, .isBlocking = 0, .timeout = NULL};
-                size = executeCommand(pprog);
-                if(size < 0)
-                {
-                    hasError = 1;
-                    break;
-                }
-                if(response[0] != RESPONSE_GENERIC_OK)
-                {
-                    switch(response[1])
-                    {
-                        case 0x11:
-                            ERROR("Checksum error\n");
-                            break;
-                        case 0x2a:
-                            ERROR("Address error\n");
-                            break;
-                        case 0x53:
-                            ERROR("Programming cannot be done due to a programming error\n");
-                            break;
-                        default:
-                            ERROR("Unknown error\n");
-                            break;
-                    }
-                    hasError = 1;
-                    break;
-                }
-            }
+    *profile = NULL;
+
+    if(g_profileListCnt > 0)
+    {
+        cleanupDeviceList();
+        if((deviceList = calloc(1, sizeof(DEVICE))) == NULL)
+        {
+            ERROR("malloc() fail\n");
+            return -1;
+        }
+        g_deviceListCnt = 1;
+        memcpy(deviceList[0].code, g_profileList[0].code, 4);
+        snprintf(deviceList[0].seriesName, SERIESNAME_LEN, "%s", g_profileList[0].seriesName);
+        deviceList[0].seriesNameLength = strlen(deviceList[0].seriesName);
+
+        if(setDevice(0) == 0)
+        {
+            LOG("Device %s selected from the profile cache\n", deviceList[0].seriesName);
+            *profile = &g_profileList[0];
+            return 0;
         }
+
+        LOG("Device %s from the profile cache rejected, inquiring\n", deviceList[0].seriesName);
+        cleanupDeviceList();
     }
 
-    /*Terminate Programming*/
-    memset(&command[1], 0xff, 4); /*0xff is set to all 4 bytes of the address area*/
-    command[5] = computeChecksum(command, 5);
-    EXECPARAM pterm = {.command = command, .commandLength = 6, .response = response, .responseCapacity = 1, 
-                   .payload = PAYLOAD_NONE, .expectedReply = 0, .isBlocking = 0, .timeout = NULL};
-    size = executeCommand(pterm);
-    if(size < 0)
+    if(getSupportedDevices() < 0 || setDevice(0) < 0)
     {
-        ERROR("error in terminating programming\n");
+        return -1;
     }
 
-    intelHex_destroyHexInfo(&image);
-    return hasError ? -1 : 0;
+    if((index = profile_find(g_profileList, g_profileListCnt, deviceList[0].code)) >= 0)
+    {
+        LOG("Device %s found in the profile cache\n", deviceList[0].seriesName);
+        *profile = &g_profileList[index];
+    }
+
+    return 0;
 }
 
 /******************************************************************************
- * main
+ * applyProfileClockModes()
+ * 
+ * Fill the clock mode list from a cached profile instead of inquiring it
+ * 
  */
-int main(int argc, char **argv)
+static int applyProfileClockModes(const PROFILE *profile)
 {
-    if(argc != 3)
+    cleanupClockModeList();
+
+    if(profile->clockModeCnt == 0 || (g_clockModeList = malloc(profile->clockModeCnt)) == NULL)
     {
-        ERROR("Usage: %s <device> <firmware image>\n", argv[0]);
+        ERROR("invalid cached clock modes\n");
         return -1;
     }
 
-    LOG_DBG("Device: %s\n", argv[1]);
-    LOG_DBG("Firmware: %s\n", argv[2]);
-    LOG_DBG("\n");
+    g_clockModeListCnt = profile->clockModeCnt;
+    memcpy(g_clockModeList, profile->clockModes, g_clockModeListCnt);
+    return 0;
+}
+
+/******************************************************************************
+ * applyProfileClockTypes()
+ * 
+ * Fill the clock type list (multiplication ratios and operating frequencies)
+ * from a cached profile instead of inquiring it
+ * 
+ */
+static int applyProfileClockTypes(const PROFILE *profile)
+{
+    int i;
 
-    if((g_serialHandle = open(argv[1], O_RDWR | O_NOCTTY | O_SYNC)) == -1)
+    cleanupClockTypeList();
+
+    if(profile->clockTypeCnt == 0 || (g_clockTypeList = calloc(profile->clockTypeCnt, sizeof(CLOCK_TYPE))) == NULL)
     {
-        LOG_PERROR("  open: ");
+        ERROR("invalid cached clock types\n");
         return -1;
     }
+    g_clockTypeListCnt = profile->clockTypeCnt;
 
-    if(tcgetattr(g_serialHandle, &g_serialAttributes) != 0)
+    for(i = 0; i < g_clockTypeListCnt; i++)
     {
-        LOG_PERROR("  tcgetattr: ");
-        return -1;
+        const PROFILE_CLOCK_TYPE *clockType = &profile->clockTypes[i];
+
+        if((g_clockTypeList[i].multiplicationRatios = malloc(clockType->ratioCnt ? clockType->ratioCnt : 1)) == NULL)
+        {
+            ERROR("malloc() fail\n");
+            cleanupClockTypeList();
+            return -1;
+        }
+        g_clockTypeList[i].numberOfMultiplicationRatios = clockType->ratioCnt;
+        memcpy(g_clockTypeList[i].multiplicationRatios, clockType->ratios, clockType->ratioCnt);
+        g_clockTypeList[i].minimumOperatingFrequency = clockType->minimumFrequency;
+        g_clockTypeList[i].maximumOperatingFrequency = clockType->maximumFrequency;
     }
 
-    g_serialAttributes.c_ispeed = g_serialAttributes.c_ospeed = B9600;
-    g_serialAttributes.c_cflag = CS8 | CREAD;
+    return 0;
+}
 
-    if(tcsetattr(g_serialHandle, TCSANOW, &g_serialAttributes) != 0)
+static int copyAreas(AREA **areaList, int *areaListCnt, const PROFILE_AREA *areas, int areaCnt)
+{
+    if(areaCnt == 0)
     {
-        LOG_PERROR("  tcsetattr: ");
-        return -1;
+        return 0;
     }
 
-    if(matchBitRates() < 0)
+    if((*areaList = malloc(areaCnt * sizeof(AREA))) == NULL)
     {
-        ERROR("Failed to match bit rates!\n");
+        ERROR("malloc() fail\n");
         return -1;
     }
 
-    if(getSupportedDevices() < 0)
+    memcpy(*areaList, areas, areaCnt * sizeof(AREA));
+    *areaListCnt = areaCnt;
+    return 0;
+}
+
+/******************************************************************************
+ * applyProfileAreas()
+ * 
+ * Fill the area lists from a cached profile instead of inquiring them
+ * 
+ */
+static int applyProfileAreas(const PROFILE *profile)
+{
+    cleanupAreaLists();
+
+    if(copyAreas(&g_userBootAreaList, &g_userBootAreaListCnt, profile->areas[PROFILE_AREA_USER_BOOT], profile->areaCnt[PROFILE_AREA_USER_BOOT]) < 0 ||
+       copyAreas(&g_userAreaList, &g_userAreaListCnt, profile->areas[PROFILE_AREA_USER], profile->areaCnt[PROFILE_AREA_USER]) < 0 ||
+       copyAreas(&g_dataAreaList, &g_dataAreaListCnt, profile->areas[PROFILE_AREA_DATA], profile->areaCnt[PROFILE_AREA_DATA]) < 0)
     {
-        ERROR("Failed to get supported devices!\n");
+        cleanupAreaLists();
         return -1;
     }
 
-    if(setDevice(0) < 0)
+    return 0;
+}
+
+static int copyProfileAreas(PROFILE_AREA *areas, uint8_t *areaCnt, const AREA *areaList, int areaListCnt)
+{
+    if(areaListCnt > PROFILE_MAX_AREAS)
     {
-        ERROR("Failed to set device!\n");
-        cleanupDeviceList();
         return -1;
     }
 
-    if(getClockModes() < 0)
+    memcpy(areas, areaList, areaListCnt * sizeof(AREA));
+    *areaCnt = areaListCnt;
+    return 0;
+}
+
+/******************************************************************************
+ * storeProfile()
+ * 
+ * Store what this session learned about the selected device as the most
+ * recently used profile
+ * 
+ */
+static int storeProfile(const char *filename)
+{
+    PROFILE profile;
+    int i;
+
+    memset(&profile, 0, sizeof(profile));
+
+    if(deviceList == NULL || g_clockModeListCnt > PROFILE_MAX_CLOCK_MODES || g_clockTypeListCnt > PROFILE_MAX_CLOCK_TYPES)
     {
-        ERROR("Failed to get clock modes!\n");
-        cleanupClockModeList();
-        cleanupDeviceList();
         return -1;
     }
 
-    if(setClockMode(0) < 0)
+    memcpy(profile.code, deviceList[0].code, 4);
+    snprintf(profile.seriesName, PROFILE_NAME_LEN, "%s", deviceList[0].seriesName);
+    profile.bitRate = g_bitRate;
+
+    profile.clockModeCnt = g_clockModeListCnt;
+    memcpy(profile.clockModes, g_clockModeList, g_clockModeListCnt);
+
+    profile.clockTypeCnt = g_clockTypeListCnt;
+    for(i = 0; i < g_clockTypeListCnt; i++)
     {
-        ERROR("Failed to set clock mode!\n");
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        if(g_clockTypeList[i].numberOfMultiplicationRatios > PROFILE_MAX_RATIOS)
+        {
+            return -1;
+        }
+        profile.clockTypes[i].ratioCnt = g_clockTypeList[i].numberOfMultiplicationRatios;
+        memcpy(profile.clockTypes[i].ratios, g_clockTypeList[i].multiplicationRatios, g_clockTypeList[i].numberOfMultiplicationRatios);
+        profile.clockTypes[i].minimumFrequency = g_clockTypeList[i].minimumOperatingFrequency;
+        profile.clockTypes[i].maximumFrequency = g_clockTypeList[i].maximumOperatingFrequency;
     }
 
-    if(getMultiplicationRatios() < 0)
+    if(copyProfileAreas(profile.areas[PROFILE_AREA_USER_BOOT], &profile.areaCnt[PROFILE_AREA_USER_BOOT], g_userBootAreaList, g_userBootAreaListCnt) < 0 ||
+       copyProfileAreas(profile.areas[PROFILE_AREA_USER], &profile.areaCnt[PROFILE_AREA_USER], g_userAreaList, g_userAreaListCnt) < 0 ||
+       copyProfileAreas(profile.areas[PROFILE_AREA_DATA], &profile.areaCnt[PROFILE_AREA_DATA], g_dataAreaList, g_dataAreaListCnt) < 0)
     {
-        ERROR("Failed to get multiplication ratios!\n");
-        cleanupClockModeList();
-        cleanupDeviceList();
         return -1;
     }
 
-    if(getOperatingFrequencies() < 0)
+    return profile_store(filename, &profile);
+}
+
+/******************************************************************************
+ * findArea()
+ * 
+ * Return the area from the cached area lists that contains address, or NULL
+ * 
+ */
+static const AREA *findArea(uint32_t address)
+{
+    const AREA *lists[] = { g_userBootAreaList, g_userAreaList, g_dataAreaList };
+    const int counts[] = { g_userBootAreaListCnt, g_userAreaListCnt, g_dataAreaListCnt };
+    int i;
+    int j;
+
+    for(i = 0; i < 3; i++)
     {
-        ERROR("Failed to get operating frequencies!\n");
-        cleanupClockTypeList();
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        for(j = 0; j < counts[i]; j++)
+        {
+            if(address >= lists[i][j].startAddress && address <= lists[i][j].endAddress)
+            {
+                return &lists[i][j];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * validateImage()
+ * 
+ * Check every memory segment of the image against the cached area lists so
+ * that an image the device would reject with an address error fails before
+ * the programming/erasure state transition instead of partway through it.
+ * A segment may span adjacent areas.
+ * 
+ */
+static int validateImage(const IntelHex *image)
+{
+    const IntelHexMemory *memory;
+    const AREA *area;
+
+    for(memory = image->memory; memory != NULL; memory = memory->next)
+    {
+        uint64_t address = memory->baseAddress;
+        uint64_t endAddress = (uint64_t)memory->baseAddress + (memory->size == 0 ? 0x100000000ULL : memory->size) - 1;
+
+        while(address <= endAddress)
+        {
+            if((area = findArea((uint32_t)address)) == NULL)
+            {
+                ERROR("image memory at 0x%.8x ~ 0x%.8x is outside of the device flash areas (first bad address 0x%.8x)\n",
+                      memory->baseAddress, (uint32_t)endAddress, (uint32_t)address);
+                return -1;
+            }
+
+            address = (uint64_t)area->endAddress + 1;
+        }
     }
 
-    if(setBitRate(115200, 12000000, 8, 4) < 0)
+    return 0;
+}
+
+/******************************************************************************
+ * validateFrames()
+ * 
+ * Check the page address of every frame of a flash plan or page cache
+ * against the cached area lists, the frame counterpart of validateImage()
+ * 
+ */
+static int validateFrames(const uint8_t *frames, uint32_t frameCnt)
+{
+    uint32_t i;
+
+    for(i = 0; i < frameCnt; i++)
     {
-        ERROR("Failed to set bit rate!\n");
-        cleanupClockTypeList();
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        uint32_t address = pagecache_address(&frames[(size_t)i * PAGECACHE_FRAME_SIZE]);
+
+        if(findArea(address) == NULL)
+        {
+            ERROR("page 0x%.8x is outside of the device flash areas\n", address);
+            return -1;
+        }
     }
-    
-    if(confirmBitRate() < 0)
+
+    return 0;
+}
+
+/******************************************************************************
+ * activateFlashProgramming()
+ * 
+ * Transfer the RX63N/RX631 device into a programmable state.
+ * NOTE: Do not issue a programming/erasure state transition command before
+ *       the device selection, clock mode selection, and new
+ *       bit rate selection commands.
+ * NOTE: No handling forthe case where ID code protection is enabled
+ * 
+ */
+static int activateFlashProgramming(void)
+{
+    unsigned char command[1];
+    unsigned char response[1];
+    /*specifications say that two bytes are needed for an error response, but only one is needed*/
+    command[0] = COMMAND_PROGRAMMING_ERASURE_STATE_TRANSITION; /*0x40*/
+
+    struct timeval timeout =  { .tv_sec = 1, .tv_usec = 0 };
+    EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = 1, 
+                   .isBlocking = 0, .timeout = &timeout};//
+    int size = executeCommand(p);
+
+    if(size > 0)
     {
-        ERROR("Failed to confirm bit rate!\n");
-        cleanupClockTypeList();
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        LOG_DBG("activateFlashProgramming() response = 0x%x\n", response[0]);
+        /*ID code protection is enabled*/
+        if(response[0] == 0x16)
+        {
+            /*TODO: send ID code*/
+            ERROR("Unsupported: ID code protection is enabled");
+            return -1;
+        }
+        /*ID code protection is disabled*/
+        if(response[0] == 0x26)
+        {
+            return 0;
+        }
     }
 
-    if(activateFlashProgramming() < 0)
+    return -1;
+}
+
+/******************************************************************************
+ * cleanupPlan()
+ * 
+ * Free the ranges of all programming plan steps
+ * 
+ */
+static int cleanupPlan(PLAN_STEP *plan, int planCnt)
+{
+    int i;
+
+    for(i = 0; i < planCnt; i++)
     {
-        ERROR("Failed to activate flash programming!\n");
-        cleanupClockTypeList();
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        if(plan[i].ranges != NULL)
+        {
+            free(plan[i].ranges);
+            plan[i].ranges = NULL;
+        }
+        plan[i].rangeCnt = 0;
     }
+    return 0;
+}
+
+static int compareRanges(const void *a, const void *b)
+{
+    const PLAN_RANGE *ra = a;
+    const PLAN_RANGE *rb = b;
+
+    return (ra->startAddress > rb->startAddress) - (ra->startAddress < rb->startAddress);
+}
+
+/******************************************************************************
+ * addPlanRanges()
+ * 
+ * Append the parts of a memory segment that fall inside the given areas to a
+ * programming plan step
+ * 
+ */
+static int addPlanRanges(PLAN_STEP *step, const IntelHexMemory *memory, const AREA *areaList, int areaListCnt)
+{
+    uint32_t endAddress = memory->baseAddress + memory->size - 1;
+    int i;
 
-    if(programUserArea(argv[2]) < 0)
+    for(i = 0; i < areaListCnt; i++)
     {
-        ERROR("Failed to program user area!\n");
-        cleanupClockTypeList();
-        cleanupClockModeList();
-        cleanupDeviceList();
-        return -1;
+        if(endAddress < areaList[i].startAddress || memory->baseAddress > areaList[i].endAddress)
+        {
+            continue;
+        }
+
+        PLAN_RANGE *ranges = realloc(step->ranges, (step->rangeCnt + 1) * sizeof(PLAN_RANGE));
+        if(ranges == NULL)
+        {
+            ERROR("realloc() fail\n");
+            return -1;
+        }
+        step->ranges = ranges;
+
+        ranges[step->rangeCnt].memory = memory;
+        ranges[step->rangeCnt].startAddress = (memory->baseAddress > areaList[i].startAddress) ? memory->baseAddress : areaList[i].startAddress;
+        ranges[step->rangeCnt].endAddress = (endAddress < areaList[i].endAddress) ? endAddress : areaList[i].endAddress;
+        step->rangeCnt++;
     }
 
-    LOG("Finished\n");
-    cleanupClockTypeList();
-    cleanupClockModeList();
-    cleanupDeviceList();
     return 0;
 }
+
+/******************************************************************************
+ * coalesceRanges()
+ * 
+ * Join the ranges of a step that share a page, so that the page is framed
+ * once with the bytes of all of them instead of once per image segment.
+ * Flash areas are page aligned, so joined ranges stay within one area.
+ * Returns the number of frames saved.
+ * 
+ */
+static int coalesceRanges(PLAN_STEP *step)
+{
+    int savedCnt = 0;
+    int i;
+    int j;
+
+    for(i = 0, j = 1; j < step->rangeCnt; j++)
+    {
+        if((step->ranges[j].startAddress >> 8) == (step->ranges[i].endAddress >> 8))
+        {
+            step->ranges[i].endAddress = step->ranges[j].endAddress;
+            savedCnt++;
+        }
+        else
+        {
+            step->ranges[++i] = step->ranges[j];
+        }
+    }
+
+    if(step->rangeCnt > 0)
+    {
+        step->rangeCnt = i + 1;
+    }
+    return savedCnt;
+}
+
+/******************************************************************************
+ * planProgramming()
+ * 
+ * Split the image by flash area into one step per programming selection:
+ * the user boot area (0x42) first, then the user and data areas (0x43).
+ * Each step lists the image ranges to program in address order, so that
+ * every area is selected and programmed exactly once per session.
+ * Returns the number of frames saved by coalescing shared pages.
+ * 
+ */
+static int planProgramming(const IntelHex *image, PLAN_STEP plan[PLAN_STEP_COUNT])
+{
+    const IntelHexMemory *memory;
+    int savedCnt = 0;
+    int i;
+
+    plan[0].selection = COMMAND_USER_BOOT_AREA_PROGRAMMING_SELECTION; /*0x42*/
+    plan[1].selection = COMMAND_USER_DATA_AREA_PROGRAMMING_SELECTION; /*0x43*/
+    for(i = 0; i < PLAN_STEP_COUNT; i++)
+    {
+        plan[i].rangeCnt = 0;
+        plan[i].ranges = NULL;
+    }
+
+    for(memory = image->memory; memory != NULL; memory = memory->next)
+    {
+        if(addPlanRanges(&plan[0], memory, g_userBootAreaList, g_userBootAreaListCnt) < 0 ||
+           addPlanRanges(&plan[1], memory, g_userAreaList, g_userAreaListCnt) < 0 ||
+           addPlanRanges(&plan[1], memory, g_dataAreaList, g_dataAreaListCnt) < 0)
+        {
+            cleanupPlan(plan, PLAN_STEP_COUNT);
+            return -1;
+        }
+    }
+
+    for(i = 0; i < PLAN_STEP_COUNT; i++)
+    {
+        qsort(plan[i].ranges, plan[i].rangeCnt, sizeof(PLAN_RANGE), compareRanges);
+        savedCnt += coalesceRanges(&plan[i]);
+    }
+
+    return savedCnt;
+}
+
+/******************************************************************************
+ * programPage()
+ * 
+ * Send one framed 256-byte programming command, given as an iovec, and
+ * decode its response
+ * 
+ */
+static int programPage(const struct iovec *vector, int vectorCnt)
+{
+    unsigned char response[2];
+
+    EXECPARAM p = {.commandVector = vector, .commandVectorCnt = vectorCnt, .response = response, .responseCapacity = 2,
+                   .isBlocking = 0, .timeout = NULL};
+    if(executeCommand(p) < 0)
+    {
+        return -1;
+    }
+
+    if(response[0] != RESPONSE_GENERIC_OK)
+    {
+        switch(response[1])
+        {
+            case 0x11:
+                ERROR("Checksum error\n");
+                break;
+            case 0x2a:
+                ERROR("Address error\n");
+                break;
+            case 0x53:
+                ERROR("Programming cannot be done due to a programming error\n");
+                break;
+            default:
+                ERROR("Unknown error\n");
+                break;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * countPage()
+ * 
+ * Account for a programmed page and report progress
+ * 
+ */
+static void countPage(int *pageCnt)
+{
+    (*pageCnt)++;
+    fleet_page(*pageCnt, g_progressTotal);
+
+    /*report every tenth of the image, so a remote client sees the session move*/
+    if(g_progress && g_progressTotal > 0 && (*pageCnt == g_progressTotal || (*pageCnt * 10) / g_progressTotal != ((*pageCnt - 1) * 10) / g_progressTotal))
+    {
+        LOG("Progress %d/%d pages\n", *pageCnt, g_progressTotal);
+    }
+}
+
+/******************************************************************************
+ * sendPage()
+ * 
+ * Page sink that programs the page into the device
+ * 
+ */
+static int sendPage(const struct iovec *vector, int vectorCnt, void *context)
+{
+    if(programPage(vector, vectorCnt) < 0)
+    {
+        return -1;
+    }
+
+    countPage(context);
+    return 0;
+}
+
+/******************************************************************************
+ * selectProgrammingArea()
+ * 
+ * Send the user boot area (0x42) or user/data area (0x43) programming
+ * selection
+ * 
+ */
+static int selectProgrammingArea(unsigned char selection)
+{
+    unsigned char command[1];
+    unsigned char response[2];
+
+    command[0] = selection;
+    EXECPARAM p = {.command = command, .commandLength = 1, .response = response, .responseCapacity = sizeof(response), 
+                   .isBlocking = 0, .timeout = NULL};
+    int size = executeCommand(p);
+    if(size < 1 || response[0] != RESPONSE_GENERIC_OK)
+    {
+        ERROR("%s Area Programming Selection error!\n", (selection == COMMAND_USER_BOOT_AREA_PROGRAMMING_SELECTION) ? "User Boot" : "User/Data");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * terminateProgramming()
+ * 
+ * End the programming of the current selection
+ * 
+ */
+static void terminateProgramming(void)
+{
+    unsigned char command[6];
+    unsigned char response[2];
+
+    command[0] = COMMAND_256_BYTE_PROGRAMMING; /*0x50*/
+    memset(&command[1], 0xff, 4); /*0xff is set to all 4 bytes of the address area*/
+    command[5] = computeChecksum(command, 5);
+    EXECPARAM pterm = {.command = command, .commandLength = 6, .response = response, .responseCapacity = sizeof(response), 
+                   .isBlocking = 0, .timeout = NULL};
+    if(executeCommand(pterm) < 0)
+    {
+        ERROR("error in terminating programming\n");
+    }
+}
+
+/******************************************************************************
+ * programSelection()
+ * 
+ * Select the area of a programming plan step, program all of its ranges and
+ * terminate the programming of that selection
+ * 
+ */
+static int programSelection(const PLAN_STEP *step, int *pageCnt)
+{
+    int hasError = 0;
+    int i;
+
+    if(selectProgrammingArea(step->selection) < 0)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < step->rangeCnt && !hasError; i++)
+    {
+        LOG_DBG("Range: %.8x ~ %.8x\n", step->ranges[i].startAddress, step->ranges[i].endAddress);
+
+        if(pagecache_frameRange(step->ranges[i].memory, step->ranges[i].startAddress, step->ranges[i].endAddress, sendPage, pageCnt) < 0)
+        {
+            hasError = 1;
+        }
+    }
+
+    terminateProgramming();
+    return hasError ? -1 : 0;
+}
+
+/******************************************************************************
+ * programImage()
+ * 
+ * Program the loaded image into the user boot, user and data areas within
+ * the current boot mode session. Selections without image data are skipped.
+ * 
+ */
+static int programImage(const IntelHex *image)
+{
+    PLAN_STEP plan[PLAN_STEP_COUNT];
+    struct timespec cpuStart;
+    struct timespec cpuEnd;
+    int pageCnt = 0;
+    int savedCnt;
+    int hasError = 0;
+    int i;
+
+    if((savedCnt = planProgramming(image, plan)) < 0)
+    {
+        return -1;
+    }
+
+    if(savedCnt > 0)
+    {
+        LOG("%d frames saved by framing pages shared by image segments once\n", savedCnt);
+    }
+
+    g_progressTotal = 0;
+    for(i = 0; i < PLAN_STEP_COUNT; i++)
+    {
+        int j;
+
+        for(j = 0; j < plan[i].rangeCnt; j++)
+        {
+            g_progressTotal += ((plan[i].ranges[j].endAddress >> 8) - (plan[i].ranges[j].startAddress >> 8)) + 1;
+        }
+    }
+
+    LOG("Programming to device...\n");
+    fleet_page(0, g_progressTotal);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+    for(i = 0; i < PLAN_STEP_COUNT && !hasError; i++)
+    {
+        if(plan[i].rangeCnt > 0 && programSelection(&plan[i], &pageCnt) < 0)
+        {
+            hasError = 1;
+        }
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+
+    if(pageCnt > 0)
+    {
+        long cpuTime = (cpuEnd.tv_sec - cpuStart.tv_sec) * 1000000000L + (cpuEnd.tv_nsec - cpuStart.tv_nsec);
+        LOG("Programmed %d pages, %ld ns host CPU time per page\n", pageCnt, cpuTime / pageCnt);
+    }
+
+    cleanupPlan(plan, PLAN_STEP_COUNT);
+    return hasError ? -1 : 0;
+}
+
+/******************************************************************************
+ * programPlan()
+ * 
+ * Program a precompiled flash plan, writing its frames to the port straight
+ * from the mapping
+ * 
+ */
+static int programPlan(const FLASHPLAN *plan)
+{
+    int pageCnt = 0;
+    int hasError = 0;
+    uint32_t i;
+    uint32_t j;
+
+    g_progressTotal = plan->header->frameCnt;
+
+    LOG("Programming plan to device...\n");
+    fleet_page(0, g_progressTotal);
+    for(i = 0; i < plan->header->stepCnt && !hasError; i++)
+    {
+        const FLASHPLAN_STEP *step = &plan->header->steps[i];
+
+        if(step->frameCnt == 0)
+        {
+            continue;
+        }
+
+        if(selectProgrammingArea(step->selection) < 0)
+        {
+            return -1;
+        }
+
+        for(j = 0; j < step->frameCnt && !hasError; j++)
+        {
+            uint8_t patched[FLASHPLAN_FRAME_SIZE];
+            const uint8_t *frame = flashplan_frame(plan, step->firstFrame + j);
+            struct iovec vector = { .iov_len = FLASHPLAN_FRAME_SIZE };
+
+            vector.iov_base = (void *)((g_patches != NULL) ? patch_frame(g_patches, frame, FLASHPLAN_FRAME_SIZE, patched) : frame);
+
+            hasError = sendPage(&vector, 1, &pageCnt) < 0;
+        }
+
+        terminateProgramming();
+    }
+
+    LOG("Programmed %d pages\n", pageCnt);
+    return hasError ? -1 : 0;
+}
+
+/******************************************************************************
+ * isUserBootPage()
+ * 
+ * Return whether a page belongs to the user boot area selection (0x42)
+ * rather than the user/data area selection (0x43)
+ * 
+ */
+static int isUserBootPage(uint32_t address)
+{
+    int i;
+
+    for(i = 0; i < g_userBootAreaListCnt; i++)
+    {
+        if(address >= g_userBootAreaList[i].startAddress && address <= g_userBootAreaList[i].endAddress)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * programPageCache()
+ * 
+ * Program the frames of a shared page cache, sorted into the user boot and
+ * user/data selections by the device flash areas. The frames are written
+ * as they are, so a session only pays for the writes and the ACKs.
+ * 
+ */
+static int programPageCache(const PAGECACHE *cache)
+{
+    static const unsigned char selections[PLAN_STEP_COUNT] = { COMMAND_USER_BOOT_AREA_PROGRAMMING_SELECTION, COMMAND_USER_DATA_AREA_PROGRAMMING_SELECTION };
+    int frameCnts[PLAN_STEP_COUNT] = { 0 };
+    int pageCnt = 0;
+    int hasError = 0;
+    uint32_t i;
+    int j;
+
+    for(i = 0; i < cache->frameCnt; i++)
+    {
+        frameCnts[isUserBootPage(pagecache_address(pagecache_frame(cache, i))) ? 0 : 1]++;
+    }
+    g_progressTotal = cache->frameCnt;
+
+    if(cache->coalescedCnt > 0)
+    {
+        LOG("%u frames saved by framing pages shared by image segments once\n", cache->coalescedCnt);
+    }
+    LOG("Programming to device...\n");
+    fleet_page(0, g_progressTotal);
+    for(j = 0; j < PLAN_STEP_COUNT && !hasError; j++)
+    {
+        if(frameCnts[j] == 0)
+        {
+            continue;
+        }
+
+        if(selectProgrammingArea(selections[j]) < 0)
+        {
+            return -1;
+        }
+
+        for(i = 0; i < cache->frameCnt && !hasError; i++)
+        {
+            uint8_t patched[PAGECACHE_FRAME_SIZE];
+            const uint8_t *frame = pagecache_frame(cache, i);
+            struct iovec vector = { .iov_len = PAGECACHE_FRAME_SIZE };
+
+            if(isUserBootPage(pagecache_address(frame)) == (j == 0))
+            {
+                /*only the few pages with patched bytes are copied*/
+                vector.iov_base = (void *)((g_patches != NULL) ? patch_frame(g_patches, frame, PAGECACHE_FRAME_SIZE, patched) : frame);
+                hasError = sendPage(&vector, 1, &pageCnt) < 0;
+            }
+        }
+
+        terminateProgramming();
+    }
+
+    LOG("Programmed %d pages\n", pageCnt);
+    return hasError ? -1 : 0;
+}
+
+/******************************************************************************
+ * addPlanFrame()
+ * 
+ * Page sink that appends the page to a flash plan being compiled
+ * 
+ */
+static int addPlanFrame(const struct iovec *vector, int vectorCnt, void *context)
+{
+    return flashplan_addFrame(context, vector, vectorCnt);
+}
+
+/******************************************************************************
+ * compilePlan()
+ * 
+ * Frame an image into a flash plan file, offline, using the flash areas of
+ * the most recently used profile of the profile cache
+ * 
+ */
+static int compilePlan(const IntelHex *image, const char *filename)
+{
+    PLAN_STEP plan[PLAN_STEP_COUNT];
+    FLASHPLAN_WRITER writer;
+    const PROFILE *profile;
+    int savedCnt = 0;
+    int hasError = 0;
+    int i;
+    int j;
+
+    if(g_profileCacheName == NULL || (g_profileListCnt = profile_load(g_profileCacheName, g_profileList, PROFILE_MAX_COUNT)) <= 0)
+    {
+        ERROR("compiling a plan needs the flash areas of a --profile-cache with at least one device\n");
+        return -1;
+    }
+    profile = &g_profileList[0];
+
+    if(applyProfileAreas(profile) < 0 || validateImage(image) < 0 || (savedCnt = planProgramming(image, plan)) < 0)
+    {
+        cleanupAreaLists();
+        return -1;
+    }
+
+    if(flashplan_create(&writer, filename, profile->code) < 0)
+    {
+        cleanupPlan(plan, PLAN_STEP_COUNT);
+        cleanupAreaLists();
+        return -1;
+    }
+
+    for(i = 0; i < PLAN_STEP_COUNT && !hasError; i++)
+    {
+        if(plan[i].rangeCnt == 0)
+        {
+            continue;
+        }
+
+        hasError = flashplan_addStep(&writer, plan[i].selection) < 0;
+        for(j = 0; j < plan[i].rangeCnt && !hasError; j++)
+        {
+            hasError = pagecache_frameRange(plan[i].ranges[j].memory, plan[i].ranges[j].startAddress, plan[i].ranges[j].endAddress,
+                                            addPlanFrame, &writer) < 0;
+        }
+    }
+
+    cleanupPlan(plan, PLAN_STEP_COUNT);
+    cleanupAreaLists();
+
+    if(hasError)
+    {
+        flashplan_abort(&writer);
+        return -1;
+    }
+
+    if(flashplan_finish(&writer) < 0)
+    {
+        return -1;
+    }
+
+    LOG("Compiled %u pages for %s into %s\n", writer.header.frameCnt, profile->seriesName, filename);
+    if(savedCnt > 0)
+    {
+        LOG("  %d frames saved by framing pages shared by image segments once\n", savedCnt);
+    }
+    for(i = 0; i < FLASHPLAN_ESTIMATE_COUNT; i++)
+    {
+        LOG("  estimated %6u bit/s: %u ms\n", writer.header.estimates[i].bitRate, writer.header.estimates[i].milliseconds);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * endSession()
+ * 
+ * Free everything a session built up and close the port
+ * 
+ */
+static void endSession(void)
+{
+    cleanupAreaLists();
+    cleanupClockTypeList();
+    cleanupClockModeList();
+    cleanupDeviceList();
+
+    if(g_serialHandle != -1)
+    {
+        close(g_serialHandle);
+        g_serialHandle = -1;
+    }
+    g_bitRate = INITIAL_BIT_RATE;
+}
+
+/******************************************************************************
+ * addRawBin()
+ * 
+ * Add a raw binary input given as <file>@<address>
+ * 
+ */
+static int addRawBin(const char *spec, int maxCnt)
+{
+    const char *at = strrchr(spec, '@');
+    RAW_BIN *rawBin;
+    char *end;
+    unsigned long address;
+
+    if(at == NULL || at == spec || at[1] == '\0')
+    {
+        return -1;
+    }
+
+    errno = 0;
+    address = strtoul(at + 1, &end, 0);
+    if(*end != '\0' || errno != 0 || address > 0xffffffffUL)
+    {
+        return -1;
+    }
+
+    if(g_rawBins == NULL && (g_rawBins = calloc(maxCnt, sizeof(RAW_BIN))) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        return -1;
+    }
+
+    rawBin = &g_rawBins[g_rawBinCnt];
+    if((rawBin->fileName = strndup(spec, at - spec)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        return -1;
+    }
+    rawBin->spec = spec;
+    rawBin->address = address;
+    g_rawBinCnt++;
+    return 0;
+}
+
+/******************************************************************************
+ * inputName()
+ * 
+ * Name of an image input: the firmware image, if given, then the --merge
+ * images, then the --raw-bin binaries
+ * 
+ */
+static const char *inputName(const char *imageName, int input)
+{
+    if(imageName != NULL && input-- == 0)
+    {
+        return imageName;
+    }
+
+    if(input < g_mergeCnt)
+    {
+        return g_mergeNames[input];
+    }
+
+    return g_rawBins[input - g_mergeCnt].spec;
+}
+
+/******************************************************************************
+ * loadInput()
+ * 
+ * Load an image input. Raw binaries and ELF files are mapped and referenced
+ * in place, other files are parsed in the format their name implies.
+ * 
+ */
+static int loadInput(const char *imageName, int input, IntelHex *image)
+{
+    const char *name = inputName(imageName, input);
+    int rawBin = input - (imageName != NULL) - g_mergeCnt;
+
+    if(rawBin >= 0)
+    {
+        return intelHex_mapRawFile(g_rawBins[rawBin].fileName, g_rawBins[rawBin].address, image, g_rawBinFlags);
+    }
+
+    return intelHex_convert(intelHex_fileFormat(name), name, NULL, INTEL_HEX_FORMAT_BIN, NULL, image, 0);
+}
+
+/******************************************************************************
+ * loadImage()
+ * 
+ * Load the firmware image, NULL when only --raw-bin binaries are given, and
+ * merge the images given with --merge and --raw-bin into it, in memory, in a
+ * single pass over their segment lists
+ * 
+ */
+static int loadImage(const char *imageName, IntelHex *image)
+{
+    int inputCnt = (imageName != NULL) + g_mergeCnt + g_rawBinCnt;
+    IntelHex *images;
+    const IntelHex **inputs;
+    const char **names;
+    int loadedCnt;
+    int result = -1;
+
+    /*a single input is used as it is, so a mapped file is never copied*/
+    if(inputCnt == 1)
+    {
+        return loadInput(imageName, 0, image);
+    }
+
+    images = calloc(inputCnt, sizeof(IntelHex));
+    inputs = calloc(inputCnt, sizeof(IntelHex *));
+    names = calloc(inputCnt, sizeof(char *));
+    if(images == NULL || inputs == NULL || names == NULL)
+    {
+        ERROR("malloc() fail\n");
+        free(images);
+        free(inputs);
+        free(names);
+        return -1;
+    }
+
+    for(loadedCnt = 0; loadedCnt < inputCnt; loadedCnt++)
+    {
+        names[loadedCnt] = inputName(imageName, loadedCnt);
+        if(loadInput(imageName, loadedCnt, &images[loadedCnt]) != 0)
+        {
+            break;
+        }
+        inputs[loadedCnt] = &images[loadedCnt];
+    }
+
+    if(loadedCnt == inputCnt)
+    {
+        result = intelHex_merge(inputs, names, inputCnt, image, g_mergeFlags);
+    }
+
+    while(loadedCnt-- > 0)
+    {
+        intelHex_destroyHexInfo(&images[loadedCnt]);
+    }
+
+    free(images);
+    free(inputs);
+    free(names);
+    return result;
+}
+
+/******************************************************************************
+ * imageLoader()
+ * 
+ * Thread that parses the image while the session brings up the device
+ * 
+ */
+static void *imageLoader(void *context)
+{
+    IMAGE_LOAD *load = context;
+
+    load->result = loadImage(load->imageName, &load->image);
+    load->end = stats_now();
+    atomic_store(&load->isDone, 1);
+    return NULL;
+}
+
+/******************************************************************************
+ * startImageLoad()
+ * 
+ * Start parsing the image on a worker thread, so the parse overlaps the
+ * sync, inquiries and bit rate change, which do not depend on it. The image
+ * is parsed in place when no thread can be started.
+ * 
+ */
+static void startImageLoad(IMAGE_LOAD *load, const char *imageName)
+{
+    memset(load, 0, sizeof(IMAGE_LOAD));
+    load->imageName = imageName;
+    load->start = stats_now();
+    g_imageLoad = load;
+
+    if(pthread_create(&load->thread, NULL, imageLoader, load) != 0)
+    {
+        imageLoader(load);
+        load->isJoined = 1;
+    }
+}
+
+/******************************************************************************
+ * imageLoadFailed()
+ * 
+ * Return whether the background parse already failed, so the session can
+ * stop before spending more time on the device
+ * 
+ */
+static int imageLoadFailed(void)
+{
+    return g_imageLoad != NULL && atomic_load(&g_imageLoad->isDone) && g_imageLoad->result != 0;
+}
+
+/******************************************************************************
+ * awaitImage()
+ * 
+ * Wait for the background parse; the parsed image, NULL if it failed
+ * 
+ */
+static const IntelHex *awaitImage(void)
+{
+    IMAGE_LOAD *load = g_imageLoad;
+    uint64_t waitStart = stats_now();
+
+    if(!load->isJoined)
+    {
+        pthread_join(load->thread, NULL);
+        load->isJoined = 1;
+    }
+
+    if(load->result != 0)
+    {
+        return NULL;
+    }
+
+    LOG("Image OK, parsed in %.1f ms alongside the device bring-up, %.1f ms waited\n",
+        (load->end - load->start) / 1e6, (load->end > waitStart) ? (load->end - waitStart) / 1e6 : 0.0);
+    LOG_DBG("Firmware Image Info:\n"
+            "  CS: %.8x\n"
+            "  EIP: %.8x\n"
+            "  IP: %.8x\n",
+            load->image.cs,
+            load->image.eip,
+            load->image.ip);
+    return &load->image;
+}
+
+/******************************************************************************
+ * stopImageLoad()
+ * 
+ * Wait for the background parse if the session ended before it needed the
+ * image, and free the image
+ * 
+ */
+static void stopImageLoad(void)
+{
+    IMAGE_LOAD *load = g_imageLoad;
+
+    if(!load->isJoined)
+    {
+        pthread_join(load->thread, NULL);
+        load->isJoined = 1;
+    }
+
+    if(load->result == 0)
+    {
+        intelHex_destroyHexInfo(&load->image);
+    }
+    g_imageLoad = NULL;
+}
+
+/******************************************************************************
+ * flashDevice()
+ * 
+ * Run the whole boot mode session on one port: sync, device and clock
+ * selection, bit rate change, preflight and programming of a parsed image,
+ * or, if image is NULL, of the shared page cache or the mapped flash plan.
+ * 
+ */
+static int flashDevice(const char *deviceName, const IntelHex *image)
+{
+    const PROFILE *profile = NULL;
+
+    g_profileListCnt = 0;
+    if(g_profileCacheName != NULL && (g_profileListCnt = profile_load(g_profileCacheName, g_profileList, PROFILE_MAX_COUNT)) < 0)
+    {
+        WARNING("ignoring the unreadable profile cache\n");
+        g_profileListCnt = 0;
+    }
+
+    if((g_serialHandle = open(deviceName, O_RDWR | O_NOCTTY | O_SYNC)) == -1)
+    {
+        LOG_PERROR("  open: ");
+        return -1;
+    }
+
+    if(tcgetattr(g_serialHandle, &g_serialAttributes) != 0)
+    {
+        LOG_PERROR("  tcgetattr: ");
+        endSession();
+        return -1;
+    }
+
+    g_serialAttributes.c_ispeed = g_serialAttributes.c_ospeed = convertBitRate(INITIAL_BIT_RATE);
+    g_serialAttributes.c_cflag = CS8 | CREAD;
+
+    if(tcsetattr(g_serialHandle, TCSANOW, &g_serialAttributes) != 0)
+    {
+        LOG_PERROR("  tcsetattr: ");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_SYNC);
+    if(matchBitRates() < 0)
+    {
+        ERROR("Failed to match bit rates!\n");
+        endSession();
+        return -1;
+    }
+
+    if(imageLoadFailed())
+    {
+        ERROR("Failed to open firmware image file!\n");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_INQUIRY);
+    if(selectDevice(&profile) < 0)
+    {
+        ERROR("Failed to set device!\n");
+        endSession();
+        return -1;
+    }
+
+    if(g_flashPlan.header != NULL && memcmp(deviceList[0].code, g_flashPlan.header->deviceCode, 4) != 0)
+    {
+        ERROR("The flash plan was compiled for another device!\n");
+        endSession();
+        return -1;
+    }
+
+    if((profile != NULL ? applyProfileClockModes(profile) : getClockModes()) < 0)
+    {
+        ERROR("Failed to get clock modes!\n");
+        endSession();
+        return -1;
+    }
+
+    if(setClockMode(0) < 0)
+    {
+        ERROR("Failed to set clock mode!\n");
+        endSession();
+        return -1;
+    }
+
+    /*the ratio and frequency inquiries only report; a cached profile has them already*/
+    if(profile == NULL && getMultiplicationRatios() < 0)
+    {
+        ERROR("Failed to get multiplication ratios!\n");
+        endSession();
+        return -1;
+    }
+
+    if((profile != NULL ? applyProfileClockTypes(profile) : getOperatingFrequencies()) < 0)
+    {
+        ERROR("Failed to get operating frequencies!\n");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_BIT_RATE);
+    if(setBitRate(profile != NULL ? profile->bitRate : DEFAULT_BIT_RATE, 12000000, 8, 4) < 0)
+    {
+        ERROR("Failed to set bit rate!\n");
+        endSession();
+        return -1;
+    }
+    
+    if(confirmBitRate() < 0)
+    {
+        ERROR("Failed to confirm bit rate!\n");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_AREA_INQUIRY);
+    if((profile != NULL ? applyProfileAreas(profile) : getAreas()) < 0)
+    {
+        ERROR("Failed to get flash areas!\n");
+        endSession();
+        return -1;
+    }
+
+    /*programming starts as soon as both the device and the image are ready*/
+    if(image == NULL && g_imageLoad != NULL)
+    {
+        stats_phase(STATS_PHASE_IMAGE);
+        if((image = awaitImage()) == NULL)
+        {
+            ERROR("Failed to open firmware image file!\n");
+            endSession();
+            return -1;
+        }
+    }
+
+    /*Preflight: reject images the device would answer with an address error*/
+    if(image != NULL ? validateImage(image) < 0 :
+       g_pageCache != NULL ? validateFrames(g_pageCache->frames, g_pageCache->frameCnt) < 0 :
+       validateFrames(g_flashPlan.frames, g_flashPlan.header->frameCnt) < 0)
+    {
+        ERROR("Firmware image does not fit the device flash areas!\n");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_TRANSITION);
+    if(activateFlashProgramming() < 0)
+    {
+        ERROR("Failed to activate flash programming!\n");
+        endSession();
+        return -1;
+    }
+
+    stats_phase(STATS_PHASE_PROGRAMMING);
+    if((image != NULL ? programImage(image) : g_pageCache != NULL ? programPageCache(g_pageCache) : programPlan(&g_flashPlan)) < 0)
+    {
+        ERROR("Failed to program device!\n");
+        endSession();
+        return -1;
+    }
+
+    /*the cache is only rewritten when the profile is new or not the most recent one*/
+    if(g_profileCacheName != NULL && profile != &g_profileList[0] && storeProfile(g_profileCacheName) < 0)
+    {
+        WARNING("failed to update the profile cache\n");
+    }
+
+    endSession();
+    return 0;
+}
+
+/******************************************************************************
+ * flashFrames()
+ * 
+ * Session of the daemon and fleet jobs, programming the frames the parent
+ * process framed once for all of them
+ * 
+ */
+static int flashFrames(const char *deviceName, const PAGECACHE *frames)
+{
+    g_pageCache = frames;
+    return flashDevice(deviceName, NULL);
+}
+
+/******************************************************************************
+ * startPatches()
+ * 
+ * Build the patch overlay of a board over the frames it is programmed from
+ * and check that every patch lands on one of the frames
+ * 
+ */
+static int startPatches(uint32_t boardIndex, const uint8_t *frames, uint32_t frameCnt, uint32_t frameSize)
+{
+    int i;
+
+    if(patch_overlay(&g_patchSpec, boardIndex, &g_patchOverlay) != 0)
+    {
+        return -1;
+    }
+
+    if(patch_check(&g_patchOverlay, frames, frameCnt, frameSize) != 0)
+    {
+        patch_freeOverlay(&g_patchOverlay);
+        return -1;
+    }
+
+    LOG("Board %u patches:\n", boardIndex);
+    for(i = 0; i < g_patchOverlay.rangeCnt; i++)
+    {
+        const PATCH_RANGE *range = &g_patchOverlay.ranges[i];
+        char text[3 * PATCH_MAX_FIELD_SIZE + 1];
+        uint32_t j;
+
+        for(j = 0; j < range->size; j++)
+        {
+            sprintf(&text[3 * j], " %.2x", range->data[j]);
+        }
+        LOG("  %.8x:%s\n", range->address, text);
+    }
+
+    g_patches = &g_patchOverlay;
+    return 0;
+}
+
+/******************************************************************************
+ * stopPatches()
+ * 
+ */
+static void stopPatches(void)
+{
+    if(g_patches != NULL)
+    {
+        patch_freeOverlay(g_patches);
+        g_patches = NULL;
+    }
+}
+
+/******************************************************************************
+ * flashBoard()
+ * 
+ * Fleet session: flash the shared frames into one board, with the patches
+ * of that board applied on the fly
+ * 
+ */
+static int flashBoard(const char *deviceName, const PAGECACHE *frames, int boardIndex)
+{
+    int result;
+
+    if(g_patchSpec.fieldCnt > 0 && startPatches(g_patchIndex + boardIndex, frames->frames, frames->frameCnt, PAGECACHE_FRAME_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    result = flashFrames(deviceName, frames);
+    stopPatches();
+    return result;
+}
+
+/******************************************************************************
+ * main
+ */
+static long stopReplay(void)
+{
+    long mismatches = replay_close();
+
+    if(mismatches > 0)
+    {
+        ERROR("%ld host bytes differed from the replayed capture\n", mismatches);
+    }
+
+    return mismatches;
+}
+
+static void usage(const char *name)
+{
+    ERROR("Usage: %s [options] <device> <firmware image>\n"
+          "       %s [options] --replay <capture file> <firmware image>\n"
+          "       %s [options] --daemon <socket>\n"
+          "       %s --submit <socket> <device> <firmware image>\n"
+          "       %s [options] --fleet <firmware image> <device>[@<hub>]...\n"
+          "       %s [options] --watch <directory> <firmware image>\n"
+          "       %s --profile-cache <file> --compile-plan <plan file> <firmware image>\n"
+          "       %s [options] --plan <plan file> <device>\n"
+          "       %s [options] --raw-bin <file>@<address> <device>\n"
+          "  options:\n"
+          "    --stats                print command latencies, phase times and wire counters on exit\n"
+          "    --stats-json <file>    write the same report as JSON to file (\"-\" for stdout)\n"
+          "    --capture <file>       record all serial traffic with timestamps, see rx63ncap\n"
+          "    --replay <file>        answer as the device recorded in a capture file instead of using a port\n"
+          "    --replay-speed <x>     replay timing factor: 1 as recorded (default), 2 twice as fast, 0 no delays\n"
+          "    --profile-cache <file> reuse device inquiry results cached in file, keyed by device code\n"
+          "    --progress             report programming progress every tenth of the image\n"
+          "    --daemon <socket>      serve flashing jobs submitted over a Unix socket\n"
+          "    --jobs <n>             daemon and fleet: run at most n jobs at once, one per port (default %d)\n"
+          "    --submit <socket>      submit the job to a daemon and stream its output\n"
+          "    --fleet <file>         flash the image in file into every device and report stragglers\n"
+          "    --per-hub <n>          fleet: run at most n jobs at once on one USB hub (default %d)\n"
+          "    --watch <directory>    flash every device node appearing in directory, as a fleet\n"
+          "    --pattern <glob>       watch: names of the device nodes to flash (default %s)\n"
+          "    --cooldown <s>         watch: ignore a flashed node for s seconds (default %d)\n"
+          "    --compile-plan <file>  frame the image for the most recent cached device into a flash plan file\n"
+          "    --plan <file>          program a flash plan file instead of an image\n"
+          "    --merge <file>         merge the image in file into the firmware image; may be repeated\n"
+          "    --merge-priority       on overlapping merged images, keep the bytes of the one given first\n"
+          "    --raw-bin <file>@<a>   program the raw binary in file at address a, in place of the firmware image\n"
+          "                           argument; may be repeated\n"
+          "    --raw-bin-trim         leave out the leading and trailing 0xff bytes of raw binaries\n"
+          "    --patch <file>         patch per-board fields, e.g. serial numbers, described in file into the image\n"
+          "    --patch-index <n>      index of the first board for counters and CSV rows (default 0)\n",
+          name, name, name, name, name, name, name, name, name, DAEMON_DEFAULT_JOBS, FLEET_DEFAULT_PER_HUB, FLEET_DEFAULT_PATTERN, FLEET_DEFAULT_COOLDOWN);
+}
+
+static int run(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "stats",      no_argument,        NULL, 's' },
+        { "stats-json", required_argument,  NULL, 'j' },
+        { "capture",    required_argument,  NULL, 'c' },
+        { "replay",     required_argument,  NULL, 'r' },
+        { "replay-speed", required_argument, NULL, 'R' },
+        { "profile-cache", required_argument, NULL, 'p' },
+        { "progress",   no_argument,        NULL, 'P' },
+        { "daemon",     required_argument,  NULL, 'd' },
+        { "jobs",       required_argument,  NULL, 'J' },
+        { "submit",     required_argument,  NULL, 'S' },
+        { "fleet",      required_argument,  NULL, 'f' },
+        { "per-hub",    required_argument,  NULL, 'H' },
+        { "watch",      required_argument,  NULL, 'w' },
+        { "pattern",    required_argument,  NULL, 'm' },
+        { "cooldown",   required_argument,  NULL, 'C' },
+        { "compile-plan", required_argument, NULL, 'k' },
+        { "plan",       required_argument,  NULL, 'L' },
+        { "merge",      required_argument,  NULL, 'M' },
+        { "merge-priority", no_argument,    NULL, 'Y' },
+        { "raw-bin",    required_argument,  NULL, 'B' },
+        { "raw-bin-trim", no_argument,      NULL, 'E' },
+        { "patch",      required_argument,  NULL, 'T' },
+        { "patch-index", required_argument, NULL, 'I' },
+        { NULL,         0,                  NULL, 0 }
+    };
+    int statsText = 0;
+    const char *statsJson = NULL;
+    const char *captureName = NULL;
+    const char *replayName = NULL;
+    double replaySpeed = 1.0;
+    char replayDevice[64];
+    const char *daemonSocket = NULL;
+    const char *submitSocket = NULL;
+    const char *fleetImageName = NULL;
+    const char *watchDirectory = NULL;
+    const char *watchPattern = FLEET_DEFAULT_PATTERN;
+    int cooldown = FLEET_DEFAULT_COOLDOWN;
+    const char *compilePlanName = NULL;
+    const char *planName = NULL;
+    const char *patchName = NULL;
+    int jobs = DAEMON_DEFAULT_JOBS;
+    int perHub = FLEET_DEFAULT_PER_HUB;
+    int option;
+
+    while((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch(option)
+        {
+            case 's':
+                statsText = 1;
+                break;
+            case 'j':
+                statsJson = optarg;
+                break;
+            case 'c':
+                captureName = optarg;
+                break;
+            case 'r':
+                replayName = optarg;
+                break;
+            case 'R':
+                replaySpeed = atof(optarg);
+                break;
+            case 'p':
+                g_profileCacheName = optarg;
+                break;
+            case 'P':
+                g_progress = 1;
+                break;
+            case 'd':
+                daemonSocket = optarg;
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
+            case 'S':
+                submitSocket = optarg;
+                break;
+            case 'f':
+                fleetImageName = optarg;
+                break;
+            case 'H':
+                perHub = atoi(optarg);
+                break;
+            case 'w':
+                watchDirectory = optarg;
+                break;
+            case 'm':
+                watchPattern = optarg;
+                break;
+            case 'C':
+                cooldown = atoi(optarg);
+                break;
+            case 'k':
+                compilePlanName = optarg;
+                break;
+            case 'L':
+                planName = optarg;
+                break;
+            case 'M':
+                if(g_mergeNames == NULL && (g_mergeNames = calloc(argc, sizeof(char *))) == NULL)
+                {
+                    ERROR("malloc() fail\n");
+                    return -1;
+                }
+                g_mergeNames[g_mergeCnt++] = optarg;
+                break;
+            case 'Y':
+                g_mergeFlags |= INTEL_HEX_MERGE_PRIORITY;
+                break;
+            case 'B':
+                if(addRawBin(optarg, argc) != 0)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'E':
+                g_rawBinFlags |= INTEL_HEX_TRIM_ERASED;
+                break;
+            case 'T':
+                patchName = optarg;
+                break;
+            case 'I':
+                g_patchIndex = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if(patchName != NULL)
+    {
+        if(daemonSocket != NULL || submitSocket != NULL || compilePlanName != NULL)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        if(patch_load(patchName, &g_patchSpec) != 0)
+        {
+            ERROR("Failed to load patch spec file!\n");
+            return -1;
+        }
+    }
+
+    if(daemonSocket != NULL)
+    {
+        if(argc != optind || jobs < 1 || replayName != NULL || captureName != NULL || submitSocket != NULL || g_mergeCnt > 0 || g_rawBinCnt > 0)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        /*jobs stream their output to the client, so progress is always reported*/
+        g_progress = 1;
+        return daemon_run(daemonSocket, jobs, flashFrames);
+    }
+
+    if(fleetImageName != NULL || watchDirectory != NULL)
+    {
+        IntelHex image;
+        PAGECACHE *frames;
+        int failedCnt;
+
+        if((fleetImageName != NULL ? argc == optind : argc - optind != (g_rawBinCnt == 0)) || (fleetImageName != NULL && watchDirectory != NULL) ||
+           jobs < 1 || perHub < 1 || cooldown < 0 || replayName != NULL || captureName != NULL || submitSocket != NULL)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        if(loadImage(fleetImageName != NULL ? fleetImageName : (g_rawBinCnt == 0) ? argv[optind] : NULL, &image) != 0)
+        {
+            ERROR("Failed to open firmware image file!\n");
+            return -1;
+        }
+
+        /*every board is programmed from the same frames, so the parsed image is not kept*/
+        frames = pagecache_create(&image);
+        intelHex_destroyHexInfo(&image);
+        if(frames == NULL)
+        {
+            return -1;
+        }
+
+        if(watchDirectory != NULL)
+        {
+            failedCnt = fleet_watch(frames, watchDirectory, watchPattern, jobs, perHub, cooldown, flashBoard);
+        }
+        else
+        {
+            failedCnt = fleet_run(frames, &argv[optind], argc - optind, jobs, perHub, flashBoard);
+        }
+        pagecache_release(frames);
+        return (failedCnt == 0) ? 0 : -1;
+    }
+
+    if(compilePlanName != NULL)
+    {
+        IntelHex image;
+        int result;
+
+        if(argc - optind != (g_rawBinCnt == 0))
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        if(loadImage((g_rawBinCnt == 0) ? argv[optind] : NULL, &image) != 0)
+        {
+            ERROR("Failed to open firmware image file!\n");
+            return -1;
+        }
+
+        result = compilePlan(&image, compilePlanName);
+        intelHex_destroyHexInfo(&image);
+        return result;
+    }
+
+    if(argc - optind != (replayName == NULL) + (planName == NULL && g_rawBinCnt == 0) || replaySpeed < 0 ||
+       ((planName != NULL || g_mergeCnt > 0 || g_rawBinCnt > 0 || replayName != NULL || captureName != NULL) && submitSocket != NULL) ||
+       (planName != NULL && (g_mergeCnt > 0 || g_rawBinCnt > 0)))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const char *deviceName = (replayName == NULL) ? argv[optind] : replayDevice;
+    const char *imageName = (g_rawBinCnt == 0) ? argv[argc - 1] : NULL;
+
+    if(submitSocket != NULL)
+    {
+        /*the daemon opens the image by its path*/
+        if(strcmp(imageName, "-") == 0)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        return daemon_submit(submitSocket, deviceName, imageName);
+    }
+
+    if(statsText || statsJson != NULL)
+    {
+        stats_enable(statsText, statsJson);
+    }
+
+    if(captureName != NULL)
+    {
+        if(capture_open(captureName) != 0)
+        {
+            return -1;
+        }
+        atexit(capture_close);
+    }
+
+    if(replayName != NULL)
+    {
+        if(replay_open(replayName, replaySpeed, replayDevice, sizeof(replayDevice)) != 0)
+        {
+            return -1;
+        }
+    }
+
+    LOG_DBG("Device: %s\n", deviceName);
+
+    if(planName != NULL)
+    {
+        stats_phase(STATS_PHASE_IMAGE);
+        if(flashplan_open(planName, &g_flashPlan) != 0)
+        {
+            ERROR("Failed to open flash plan file!\n");
+            return -1;
+        }
+
+        LOG("Plan OK, %u pages\n", g_flashPlan.header->frameCnt);
+        if(g_patchSpec.fieldCnt > 0 && startPatches(g_patchIndex, g_flashPlan.frames, g_flashPlan.header->frameCnt, FLASHPLAN_FRAME_SIZE) != 0)
+        {
+            flashplan_close(&g_flashPlan);
+            return -1;
+        }
+
+        if(flashDevice(deviceName, NULL) < 0)
+        {
+            stopPatches();
+            flashplan_close(&g_flashPlan);
+            return -1;
+        }
+
+        LOG("Finished\n");
+        stopPatches();
+        flashplan_close(&g_flashPlan);
+        return 0;
+    }
+
+    LOG_DBG("Firmware: %s\n", inputName(imageName, 0));
+    LOG_DBG("\n");
+
+    if(g_patchSpec.fieldCnt > 0)
+    {
+        /*patches are applied to frames, so the image is framed up front*/
+        stats_phase(STATS_PHASE_IMAGE);
+        IntelHex image;
+        PAGECACHE *frames;
+        int result;
+
+        if(loadImage(imageName, &image) != 0)
+        {
+            ERROR("Failed to open firmware image file!\n");
+            return -1;
+        }
+
+        LOG("Image OK\n");
+        frames = pagecache_create(&image);
+        intelHex_destroyHexInfo(&image);
+        if(frames == NULL)
+        {
+            return -1;
+        }
+
+        result = flashBoard(deviceName, frames, 0);
+        pagecache_release(frames);
+        if(result < 0)
+        {
+            return -1;
+        }
+
+        LOG("Finished\n");
+        return 0;
+    }
+
+    /*the image is parsed on a worker thread while the device is brought up*/
+    IMAGE_LOAD load;
+    int result;
+
+    startImageLoad(&load, imageName);
+    result = flashDevice(deviceName, NULL);
+    stopImageLoad();
+    if(result < 0)
+    {
+        return -1;
+    }
+
+    LOG("Finished\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = run(argc, argv);
+
+    /*a replay that diverged from the capture fails, whatever the session did*/
+    if(stopReplay() > 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
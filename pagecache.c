@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pagecache.h"
+
+#define PREFIX                  "pagecache: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+
+int pagecache_frameRange(const IntelHexMemory *memory, uint32_t startAddress, uint32_t endAddress, PAGECACHE_SINK sink, void *context)
+{
+    static const unsigned char padding[256] = { [0 ... 255] = 0xff };
+    unsigned char header[5]; /*1 byte cmd + 4 byte addr*/
+    unsigned char bounce[256];
+    unsigned char checksum;
+    IntelHexPageIterator iterator;
+    IntelHexPage page;
+
+    if(intelHex_initializePageIterator(&iterator, memory, startAddress, endAddress, 256, bounce, 0xff) != 0)
+    {
+        return -1;
+    }
+
+    header[0] = 0x50;
+    while(intelHex_nextPage(&iterator, &page))
+    {
+        uint32_t trailing = 256 - page.offset - page.size;
+        struct iovec vector[5];
+        int vectorCnt = 0;
+
+        header[1] = (page.address >> 24) & 0xff;
+        header[2] = (page.address >> 16) & 0xff;
+        header[3] = (page.address >> 8) & 0xff;
+        header[4] = page.address & 0xff;
+
+        /*every 0xff padding byte adds -1 to the byte sum, i.e. +1 to the checksum*/
+        checksum = -(intelHex_byteSum(header, sizeof(header)) + intelHex_byteSum(page.data, page.size)) + page.offset + trailing;
+
+        vector[vectorCnt].iov_base = header;
+        vector[vectorCnt++].iov_len = sizeof(header);
+        if(page.offset > 0)
+        {
+            vector[vectorCnt].iov_base = (void *)padding;
+            vector[vectorCnt++].iov_len = page.offset;
+        }
+        vector[vectorCnt].iov_base = (void *)page.data;
+        vector[vectorCnt++].iov_len = page.size;
+        if(trailing > 0)
+        {
+            vector[vectorCnt].iov_base = (void *)padding;
+            vector[vectorCnt++].iov_len = trailing;
+        }
+        vector[vectorCnt].iov_base = &checksum;
+        vector[vectorCnt++].iov_len = 1;
+
+        if(sink(vector, vectorCnt, context) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return iterator.coalescedCount;
+}
+
+/**
+ * sink that gathers a frame into the cache
+ */
+static int addFrame(const struct iovec *vector, int vectorCnt, void *context)
+{
+    PAGECACHE *cache = context;
+    uint8_t *frame = &cache->frames[(size_t)cache->frameCnt * PAGECACHE_FRAME_SIZE];
+    int i;
+
+    for(i = 0; i < vectorCnt; i++)
+    {
+        memcpy(frame, vector[i].iov_base, vector[i].iov_len);
+        frame += vector[i].iov_len;
+    }
+
+    cache->frameCnt++;
+    return 0;
+}
+
+PAGECACHE *pagecache_create(const IntelHex *image)
+{
+    const IntelHexMemory *memory;
+    PAGECACHE *cache;
+    size_t frameCnt = 0;
+    uint32_t lastPage = 0;
+    uint32_t endAddress = 0;
+
+    /*a page shared by two segments is framed once*/
+    for(memory = image->memory; memory != NULL; memory = memory->next)
+    {
+        endAddress = memory->baseAddress + memory->size - 1;
+        frameCnt += (endAddress >> 8) - (memory->baseAddress >> 8) + 1;
+        if(memory != image->memory && (memory->baseAddress >> 8) == lastPage)
+        {
+            frameCnt--;
+        }
+        lastPage = endAddress >> 8;
+    }
+
+    if((cache = calloc(1, sizeof(PAGECACHE))) == NULL || (cache->frames = malloc(frameCnt * PAGECACHE_FRAME_SIZE + 1)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        free(cache);
+        return NULL;
+    }
+    cache->refCnt = 1;
+
+    if(image->memory != NULL)
+    {
+        cache->coalescedCnt = pagecache_frameRange(image->memory, image->memory->baseAddress, endAddress, addFrame, cache);
+    }
+
+    return cache;
+}
+
+int pagecache_save(const PAGECACHE *cache, int file, off_t offset)
+{
+    uint32_t counts[2] = { cache->frameCnt, cache->coalescedCnt };
+    size_t size = (size_t)cache->frameCnt * PAGECACHE_FRAME_SIZE;
+
+    if(pwrite(file, counts, sizeof(counts), offset) != sizeof(counts) || pwrite(file, cache->frames, size, offset + sizeof(counts)) != (ssize_t)size)
+    {
+        ERROR("failed to save frames\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+PAGECACHE *pagecache_load(int file, off_t offset)
+{
+    uint32_t counts[2];
+    PAGECACHE *cache;
+    size_t size;
+
+    if(pread(file, counts, sizeof(counts), offset) != sizeof(counts))
+    {
+        ERROR("failed to load frames\n");
+        return NULL;
+    }
+    size = (size_t)counts[0] * PAGECACHE_FRAME_SIZE;
+
+    if((cache = calloc(1, sizeof(PAGECACHE))) == NULL || (cache->frames = malloc(size + 1)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        free(cache);
+        return NULL;
+    }
+
+    if(pread(file, cache->frames, size, offset + sizeof(counts)) != (ssize_t)size)
+    {
+        ERROR("failed to load frames\n");
+        free(cache->frames);
+        free(cache);
+        return NULL;
+    }
+
+    cache->refCnt = 1;
+    cache->frameCnt = counts[0];
+    cache->coalescedCnt = counts[1];
+    return cache;
+}
+
+PAGECACHE *pagecache_retain(PAGECACHE *cache)
+{
+    __atomic_add_fetch(&cache->refCnt, 1, __ATOMIC_RELAXED);
+    return cache;
+}
+
+void pagecache_release(PAGECACHE *cache)
+{
+    if(cache != NULL && __atomic_sub_fetch(&cache->refCnt, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(cache->frames);
+        free(cache);
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * shared pre-framed pages
+ *
+ * Frames an image once into an array of 256-byte programming commands, each
+ * with its page address, 0xff padding and checksum in place, in address
+ * order. A page shared by several image memory segments is framed once, so
+ * it is never programmed twice. The array is immutable once built, so any number
+ * of sessions read it at the same time without locks; it is freed when the
+ * last reference is released.
+ *
+ * The frames do not depend on the device. Sessions pick the programming
+ * selection of each frame from the flash areas their device reports.
+ */
+
+#ifndef PAGECACHE_H_
+#define PAGECACHE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "intelhex/intelhex.h"
+
+#define PAGECACHE_FRAME_SIZE    262     /*0x50, address, 256 data bytes, checksum*/
+
+/**
+ * receiver of framed pages, each an iovec of PAGECACHE_FRAME_SIZE bytes in
+ * total
+ *
+ * 0 to go on, non-zero to stop framing
+ */
+typedef int (*PAGECACHE_SINK)(const struct iovec *vector, int vectorCnt, void *context);
+
+typedef struct {
+    int refCnt;
+    uint32_t frameCnt;
+    uint8_t *frames;            /*frameCnt * PAGECACHE_FRAME_SIZE bytes*/
+    uint32_t coalescedCnt;      /*frames saved by framing shared pages once*/
+} PAGECACHE;
+
+/**
+ * frame the bytes of memory, and of the segments linked after it, between
+ * startAddress and endAddress and pass every page to sink
+ *
+ * The pages come from the intelhex page iterator, so their data is taken
+ * straight from the memory chunks and only copied into a bounce buffer when
+ * a page spans two chunks or segments. A page shared by several segments is
+ * framed once, with 0xff between them.
+ *
+ * number of pages framed once for several segments, -1 if sink stopped
+ * framing
+ */
+int pagecache_frameRange(const IntelHexMemory *memory, uint32_t startAddress, uint32_t endAddress, PAGECACHE_SINK sink, void *context);
+
+/**
+ * frame a whole image
+ *
+ * the frames with one reference, NULL on error
+ */
+PAGECACHE *pagecache_create(const IntelHex *image);
+
+/**
+ * write the frames to a file at offset, e.g. to hand them to another process
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int pagecache_save(const PAGECACHE *cache, int file, off_t offset);
+
+/**
+ * read frames written by pagecache_save()
+ *
+ * the frames with one reference, NULL on error
+ */
+PAGECACHE *pagecache_load(int file, off_t offset);
+
+PAGECACHE *pagecache_retain(PAGECACHE *cache);
+
+/**
+ * drop a reference, freeing the frames with the last one
+ */
+void pagecache_release(PAGECACHE *cache);
+
+static inline const uint8_t *pagecache_frame(const PAGECACHE *cache, uint32_t index)
+{
+    return &cache->frames[(size_t)index * PAGECACHE_FRAME_SIZE];
+}
+
+static inline uint32_t pagecache_address(const uint8_t *frame)
+{
+    return ((uint32_t)frame[1] << 24) | ((uint32_t)frame[2] << 16) | ((uint32_t)frame[3] << 8) | frame[4];
+}
+
+#endif /* PAGECACHE_H_ */
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "patch.h"
+#include "intelhex/intelhex.h"
+
+#define PREFIX                  "patch: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+
+#define PAGE_SIZE               256
+
+static char *readFile(const char *filename, long *size)
+{
+    FILE *file;
+    char *text = NULL;
+
+    if((file = fopen(filename, "r")) == NULL)
+    {
+        ERROR("failed to open \"%s\" file for reading\n", filename);
+        return NULL;
+    }
+
+    if(fseek(file, 0, SEEK_END) != 0 || (*size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        ERROR("failed to read \"%s\"\n", filename);
+    }
+    else if((text = malloc(*size + 1)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+    }
+    else if(fread(text, 1, *size, file) != (size_t)*size)
+    {
+        ERROR("failed to read \"%s\"\n", filename);
+        free(text);
+        text = NULL;
+    }
+    else
+    {
+        text[*size] = '\0';
+    }
+
+    fclose(file);
+    return text;
+}
+
+/**
+ * split a CSV file into its rows, in place
+ */
+static int loadCsv(PATCH_FIELD *field, const char *filename)
+{
+    char *line;
+    char *next;
+    long size;
+    int capacity = 0;
+
+    if((field->text = readFile(filename, &size)) == NULL)
+    {
+        return -1;
+    }
+
+    for(line = field->text; line != NULL; line = next)
+    {
+        size_t length;
+
+        if((next = strchr(line, '\n')) != NULL)
+        {
+            *next++ = '\0';
+        }
+        length = strlen(line);
+        if(length > 0 && line[length - 1] == '\r')
+        {
+            line[length - 1] = '\0';
+        }
+
+        if(line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        if(field->rowCnt == capacity)
+        {
+            char **rows = realloc(field->rows, (capacity = (capacity == 0) ? 64 : 2 * capacity) * sizeof(char *));
+
+            if(rows == NULL)
+            {
+                ERROR("realloc() fail\n");
+                return -1;
+            }
+            field->rows = rows;
+        }
+        field->rows[field->rowCnt++] = line;
+    }
+
+    return 0;
+}
+
+/**
+ * decode the hex bytes of column of a CSV row
+ */
+static int parseCsvField(const PATCH_FIELD *field, const char *row, uint8_t *data)
+{
+    const char *text = row;
+    uint32_t size = 0;
+    int column;
+
+    for(column = 1; column < field->column; column++)
+    {
+        if((text = strchr(text, ',')) == NULL)
+        {
+            return -1;
+        }
+        text++;
+    }
+
+    while(*text != '\0' && *text != ',')
+    {
+        if(*text == ':' || *text == '-' || *text == '"' || isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+
+        if(!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1]) || size == field->size)
+        {
+            return -1;
+        }
+
+        sscanf(text, "%2hhx", &data[size++]);
+        text += 2;
+    }
+
+    return (size == field->size) ? 0 : -1;
+}
+
+static int compareFields(const void *a, const void *b)
+{
+    const PATCH_FIELD *fieldA = a;
+    const PATCH_FIELD *fieldB = b;
+
+    return (fieldA->address > fieldB->address) - (fieldA->address < fieldB->address);
+}
+
+/**
+ * parse one spec line into a field; CSV file names are taken relative to the
+ * directory of the spec file
+ */
+static int parseField(PATCH_FIELD *field, char *line, const char *specName)
+{
+    char format[16];
+    char argument[256];
+    char *end;
+    unsigned long long address;
+    unsigned int size;
+    int offset;
+
+    if(sscanf(line, "%lli %u %15s %n", &address, &size, format, &offset) != 3 || address > 0xffffffffULL || size < 1 ||
+       size > PATCH_MAX_FIELD_SIZE || address + size - 1 > 0xffffffffULL)
+    {
+        return -1;
+    }
+
+    memset(field, 0, sizeof(PATCH_FIELD));
+    field->address = address;
+    field->size = size;
+    line += offset;
+
+    if(strcmp(format, "counter") == 0 || strcmp(format, "decimal") == 0)
+    {
+        field->format = (format[0] == 'c') ? PATCH_COUNTER : PATCH_DECIMAL;
+        field->first = strtoull(line, &end, 0);
+        if(end == line)
+        {
+            return -1;
+        }
+        field->step = strtoull(end, &line, 0);
+        if(line == end)
+        {
+            field->step = 1;
+        }
+        return (field->format == PATCH_COUNTER && size > 8) || (field->format == PATCH_DECIMAL && size > 20) ? -1 : 0;
+    }
+
+    if(strcmp(format, "csv") == 0)
+    {
+        const char *slash = strrchr(specName, '/');
+        char path[512];
+
+        field->format = PATCH_CSV;
+        if(sscanf(line, "%255s %d", argument, &field->column) != 2 || field->column < 1)
+        {
+            return -1;
+        }
+
+        if(argument[0] == '/' || slash == NULL)
+        {
+            snprintf(path, sizeof(path), "%s", argument);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - specName), specName, argument);
+        }
+        return loadCsv(field, path);
+    }
+
+    return -1;
+}
+
+int patch_load(const char *filename, PATCH_SPEC *spec)
+{
+    char *text;
+    char *line;
+    char *next;
+    long size;
+    int lineNumber = 0;
+    int i;
+
+    memset(spec, 0, sizeof(PATCH_SPEC));
+    if((text = readFile(filename, &size)) == NULL)
+    {
+        return -1;
+    }
+
+    for(line = text; line != NULL; line = next)
+    {
+        char *comment;
+
+        lineNumber++;
+        if((next = strchr(line, '\n')) != NULL)
+        {
+            *next++ = '\0';
+        }
+        if((comment = strchr(line, '#')) != NULL)
+        {
+            *comment = '\0';
+        }
+        if(strspn(line, " \t\r") == strlen(line))
+        {
+            continue;
+        }
+
+        if(spec->fieldCnt == PATCH_MAX_FIELDS)
+        {
+            ERROR("\"%s\" has more than %d fields\n", filename, PATCH_MAX_FIELDS);
+            break;
+        }
+
+        if(parseField(&spec->fields[spec->fieldCnt], line, filename) != 0)
+        {
+            ERROR("\"%s\" line %d is not a valid field\n", filename, lineNumber);
+            spec->fieldCnt++;
+            break;
+        }
+        spec->fieldCnt++;
+    }
+
+    free(text);
+    if(line != NULL)
+    {
+        patch_free(spec);
+        return -1;
+    }
+
+    qsort(spec->fields, spec->fieldCnt, sizeof(PATCH_FIELD), compareFields);
+    for(i = 1; i < spec->fieldCnt; i++)
+    {
+        if(spec->fields[i].address <= spec->fields[i - 1].address + spec->fields[i - 1].size - 1)
+        {
+            ERROR("\"%s\" fields at 0x%.8x and 0x%.8x overlap\n", filename, spec->fields[i - 1].address, spec->fields[i].address);
+            patch_free(spec);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void patch_free(PATCH_SPEC *spec)
+{
+    int i;
+
+    for(i = 0; i < spec->fieldCnt; i++)
+    {
+        free(spec->fields[i].rows);
+        free(spec->fields[i].text);
+    }
+    spec->fieldCnt = 0;
+}
+
+int patch_overlay(const PATCH_SPEC *spec, uint32_t boardIndex, PATCH_OVERLAY *overlay)
+{
+    uint32_t dataSize = 0;
+    uint8_t *data;
+    int i;
+
+    memset(overlay, 0, sizeof(PATCH_OVERLAY));
+    overlay->boardIndex = boardIndex;
+
+    for(i = 0; i < spec->fieldCnt; i++)
+    {
+        const PATCH_FIELD *field = &spec->fields[i];
+
+        dataSize += field->size;
+        overlay->pageCapacity += ((field->address + field->size - 1) / PAGE_SIZE) - (field->address / PAGE_SIZE) + 1;
+    }
+
+    if((overlay->data = malloc(dataSize + 1)) == NULL || (overlay->pages = malloc((overlay->pageCapacity + 1) * sizeof(uint32_t))) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        patch_freeOverlay(overlay);
+        return -1;
+    }
+
+    for(data = overlay->data, i = 0; i < spec->fieldCnt; i++)
+    {
+        const PATCH_FIELD *field = &spec->fields[i];
+        uint64_t value = field->first + boardIndex * field->step;
+        uint32_t j;
+
+        switch(field->format)
+        {
+            case PATCH_COUNTER:
+                for(j = 0; j < field->size; j++)
+                {
+                    data[j] = (value >> (8 * j)) & 0xff;
+                }
+                if(field->size < 8 && (value >> (8 * field->size)) != 0)
+                {
+                    ERROR("counter at 0x%.8x overflows %u bytes for board %u\n", field->address, field->size, boardIndex);
+                    patch_freeOverlay(overlay);
+                    return -1;
+                }
+                break;
+            case PATCH_DECIMAL:
+                for(j = field->size; j > 0; j--)
+                {
+                    data[j - 1] = '0' + value % 10;
+                    value /= 10;
+                }
+                if(value != 0)
+                {
+                    ERROR("counter at 0x%.8x overflows %u digits for board %u\n", field->address, field->size, boardIndex);
+                    patch_freeOverlay(overlay);
+                    return -1;
+                }
+                break;
+            case PATCH_CSV:
+                if(boardIndex >= (uint32_t)field->rowCnt)
+                {
+                    ERROR("no CSV row for board %u of the field at 0x%.8x\n", boardIndex, field->address);
+                    patch_freeOverlay(overlay);
+                    return -1;
+                }
+                if(parseCsvField(field, field->rows[boardIndex], data) != 0)
+                {
+                    ERROR("CSV row %u has no %u bytes in column %d for the field at 0x%.8x\n", boardIndex, field->size, field->column, field->address);
+                    patch_freeOverlay(overlay);
+                    return -1;
+                }
+                break;
+        }
+
+        overlay->ranges[i].address = field->address;
+        overlay->ranges[i].size = field->size;
+        overlay->ranges[i].data = data;
+        data += field->size;
+    }
+    overlay->rangeCnt = spec->fieldCnt;
+
+    return 0;
+}
+
+void patch_freeOverlay(PATCH_OVERLAY *overlay)
+{
+    free(overlay->data);
+    free(overlay->pages);
+    overlay->data = NULL;
+    overlay->pages = NULL;
+    overlay->rangeCnt = 0;
+}
+
+static inline uint32_t frameAddress(const uint8_t *frame)
+{
+    return ((uint32_t)frame[1] << 24) | ((uint32_t)frame[2] << 16) | ((uint32_t)frame[3] << 8) | frame[4];
+}
+
+int patch_check(const PATCH_OVERLAY *overlay, const uint8_t *frames, uint32_t frameCnt, uint32_t frameSize)
+{
+    int i;
+
+    for(i = 0; i < overlay->rangeCnt; i++)
+    {
+        uint64_t page;
+
+        for(page = overlay->ranges[i].address & ~(PAGE_SIZE - 1); page < (uint64_t)overlay->ranges[i].address + overlay->ranges[i].size; page += PAGE_SIZE)
+        {
+            uint32_t j;
+
+            for(j = 0; j < frameCnt && frameAddress(&frames[(size_t)j * frameSize]) != page; j++);
+            if(j == frameCnt)
+            {
+                ERROR("patch at 0x%.8x is outside the image, page 0x%.8x is not programmed\n", overlay->ranges[i].address, (uint32_t)page);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+const uint8_t *patch_frame(PATCH_OVERLAY *overlay, const uint8_t *frame, uint32_t frameSize, uint8_t *buffer)
+{
+    uint64_t page = frameAddress(frame);
+    uint64_t pageEnd = page + frameSize - 6;
+    int isPatched = 0;
+    int isCopied = 0;
+    int i;
+
+    for(i = 0; i < overlay->pageCnt && !isPatched; i++)
+    {
+        isPatched = overlay->pages[i] == page;
+    }
+
+    for(i = 0; i < overlay->rangeCnt && overlay->ranges[i].address < pageEnd; i++)
+    {
+        const PATCH_RANGE *range = &overlay->ranges[i];
+        uint64_t start = (range->address > page) ? range->address : page;
+        uint64_t end = ((uint64_t)range->address + range->size < pageEnd) ? (uint64_t)range->address + range->size : pageEnd;
+
+        if(start >= end)
+        {
+            continue;
+        }
+
+        if(!isCopied)
+        {
+            memcpy(buffer, frame, frameSize);
+            isCopied = 1;
+        }
+
+        if(isPatched)
+        {
+            memset(&buffer[5 + (start - page)], 0xff, end - start);
+        }
+        else
+        {
+            memcpy(&buffer[5 + (start - page)], &range->data[start - range->address], end - start);
+        }
+    }
+
+    if(!isCopied)
+    {
+        return frame;
+    }
+
+    if(!isPatched && overlay->pageCnt < overlay->pageCapacity)
+    {
+        overlay->pages[overlay->pageCnt++] = page;
+    }
+    buffer[frameSize - 1] = -intelHex_byteSum(buffer, frameSize - 1);
+    return buffer;
+}
@@ -0,0 +1,111 @@
+/**
+ * per-board patch overlay
+ *
+ * Replaces a few byte ranges of a shared image for one board, such as a
+ * serial number, a MAC address or a calibration blob, without copying or
+ * re-parsing the image. The overlay is applied to the programming frames as
+ * they are sent: frames outside the patched ranges are sent from the shared
+ * frames as they are, and only the few patched pages are copied, patched and
+ * given a new checksum.
+ *
+ * patch spec file format (text, one field per line, '#' starts a comment)
+ *
+ * address     size  format   arguments        value for board n
+ * --------------------------------------------------------------------
+ * 0x0010ff00  4     counter  <first> [<step>] first + n * step, little-endian
+ * 0x0010ff04  8     decimal  <first> [<step>] first + n * step, ASCII digits
+ * 0x0010ff10  6     csv      <file> <column>  hex bytes in the column of row n
+ * --------------------------------------------------------------------
+ *
+ * CSV rows are counted from 0, skipping empty lines and lines starting with
+ * '#'; columns are counted from 1. The bytes of a CSV field may be separated
+ * by ':', '-' or spaces, e.g. "02:00:5e:10:00:01".
+ */
+
+#ifndef PATCH_H_
+#define PATCH_H_
+
+#include <stdint.h>
+
+#define PATCH_MAX_FIELDS        32
+#define PATCH_MAX_FIELD_SIZE    256
+
+typedef enum {
+    PATCH_COUNTER,
+    PATCH_DECIMAL,
+    PATCH_CSV
+} PATCH_FORMAT;
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    PATCH_FORMAT format;
+    uint64_t first;
+    uint64_t step;
+    char **rows;                /*csv: the lines of the file, rowCnt of them*/
+    int rowCnt;
+    int column;
+    char *text;                 /*csv: contents of the file, which rows point into*/
+} PATCH_FIELD;
+
+typedef struct {
+    int fieldCnt;
+    PATCH_FIELD fields[PATCH_MAX_FIELDS];
+} PATCH_SPEC;
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    uint8_t *data;
+} PATCH_RANGE;
+
+/*patches of one board*/
+typedef struct {
+    uint32_t boardIndex;
+    int rangeCnt;
+    PATCH_RANGE ranges[PATCH_MAX_FIELDS];   /*sorted by address*/
+    uint8_t *data;
+    int pageCnt;
+    uint32_t *pages;            /*pages already patched in this session*/
+    int pageCapacity;
+} PATCH_OVERLAY;
+
+/**
+ * read a patch spec file and the CSV files it names
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int patch_load(const char *filename, PATCH_SPEC *spec);
+
+void patch_free(PATCH_SPEC *spec);
+
+/**
+ * build the patches of the board with the given index
+ *
+ * 0 if successful, non-zero otherwise, e.g. when a CSV file has no row for
+ * the board
+ */
+int patch_overlay(const PATCH_SPEC *spec, uint32_t boardIndex, PATCH_OVERLAY *overlay);
+
+void patch_freeOverlay(PATCH_OVERLAY *overlay);
+
+/**
+ * check that every patched byte falls into one of the frameCnt frames of
+ * frameSize bytes, so no patch is silently dropped
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int patch_check(const PATCH_OVERLAY *overlay, const uint8_t *frames, uint32_t frameCnt, uint32_t frameSize);
+
+/**
+ * apply the overlay to a 0x50 programming frame of frameSize bytes
+ *
+ * When the page of the frame has no patched bytes, the frame is returned as
+ * it is. Otherwise the frame is copied into buffer, patched, given a new
+ * checksum, and buffer is returned. A page framed twice gets the patched
+ * bytes in its first frame only and 0xff, which leaves the flash as it is,
+ * in the others.
+ */
+const uint8_t *patch_frame(PATCH_OVERLAY *overlay, const uint8_t *frame, uint32_t frameSize, uint8_t *buffer);
+
+#endif /* PATCH_H_ */
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "profile.h"
+
+#define PREFIX                  "profile: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+
+int profile_load(const char *filename, PROFILE *profiles, int capacity)
+{
+    uint8_t header[PROFILE_HEADER_SIZE];
+    uint32_t version;
+    uint32_t recordSize;
+    size_t headerSize;
+    FILE *file;
+    int profileCnt = 0;
+
+    if((file = fopen(filename, "rb")) == NULL)
+    {
+        if(errno == ENOENT)
+        {
+            return 0;
+        }
+
+        ERROR("failed to open \"%s\" file for reading\n", filename);
+        return -1;
+    }
+
+    /*an empty file is a cache being created by profile_store()*/
+    if((headerSize = fread(header, 1, sizeof(header), file)) == 0 && feof(file))
+    {
+        fclose(file);
+        return 0;
+    }
+
+    if(headerSize != sizeof(header))
+    {
+        ERROR("\"%s\" is truncated\n", filename);
+        fclose(file);
+        return -1;
+    }
+
+    memcpy(&version, &header[8], 4);
+    memcpy(&recordSize, &header[12], 4);
+
+    /*a cache written by another version is simply rebuilt*/
+    if(memcmp(header, PROFILE_MAGIC, 8) != 0 || version != PROFILE_VERSION || recordSize != sizeof(PROFILE))
+    {
+        fprintf(stderr, PREFIX "warning: ignoring \"%s\", not a version %d profile cache\n", filename, PROFILE_VERSION);
+        fclose(file);
+        return 0;
+    }
+
+    while(profileCnt < capacity && fread(&profiles[profileCnt], sizeof(PROFILE), 1, file) == 1)
+    {
+        profiles[profileCnt].seriesName[PROFILE_NAME_LEN - 1] = '\0';
+        profileCnt++;
+    }
+
+    fclose(file);
+    return profileCnt;
+}
+
+/**
+ * lock a cache file, creating it empty if it does not exist yet
+ *
+ * A store renames a new file over the locked one, so the lock is taken again
+ * until it is held on the file the name points to.
+ *
+ * descriptor of the locked file, -1 on error
+ */
+static int lockCache(const char *filename)
+{
+    struct stat locked;
+    struct stat current;
+    int fd;
+
+    for(;;)
+    {
+        if((fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+        {
+            ERROR("failed to open \"%s\" file for locking\n", filename);
+            return -1;
+        }
+
+        if(flock(fd, LOCK_EX) != 0 || fstat(fd, &locked) != 0)
+        {
+            ERROR("failed to lock \"%s\"\n", filename);
+            close(fd);
+            return -1;
+        }
+
+        if(stat(filename, &current) == 0 && current.st_dev == locked.st_dev && current.st_ino == locked.st_ino)
+        {
+            return fd;
+        }
+
+        close(fd);
+    }
+}
+
+int profile_store(const char *filename, const PROFILE *profile)
+{
+    PROFILE *profiles;
+    uint8_t header[PROFILE_HEADER_SIZE] = PROFILE_MAGIC;
+    uint32_t version = PROFILE_VERSION;
+    uint32_t recordSize = sizeof(PROFILE);
+    char *tempName;
+    FILE *file;
+    int lockFd;
+    int tempFd;
+    int profileCnt;
+    int failed;
+    int i;
+
+    if((profiles = malloc(PROFILE_MAX_COUNT * sizeof(PROFILE))) == NULL || (tempName = malloc(strlen(filename) + 8)) == NULL)
+    {
+        ERROR("malloc() fail\n");
+        free(profiles);
+        return -1;
+    }
+
+    /*sessions forked by a fleet or a daemon store at the same time, so each one adds its profile to the others'*/
+    if((lockFd = lockCache(filename)) < 0)
+    {
+        free(tempName);
+        free(profiles);
+        return -1;
+    }
+
+    if((profileCnt = profile_load(filename, profiles, PROFILE_MAX_COUNT)) < 0)
+    {
+        profileCnt = 0;
+    }
+
+    memcpy(&header[8], &version, 4);
+    memcpy(&header[12], &recordSize, 4);
+
+    /*write a new file and rename it over the old one so a crash never leaves a torn cache*/
+    sprintf(tempName, "%s.XXXXXX", filename);
+    if((tempFd = mkstemp(tempName)) < 0 || (file = fdopen(tempFd, "wb")) == NULL)
+    {
+        ERROR("failed to open \"%s\" file for writing\n", tempName);
+        if(tempFd >= 0)
+        {
+            close(tempFd);
+            remove(tempName);
+        }
+        close(lockFd);
+        free(tempName);
+        free(profiles);
+        return -1;
+    }
+
+    failed = fwrite(header, sizeof(header), 1, file) != 1 || fwrite(profile, sizeof(PROFILE), 1, file) != 1;
+
+    for(i = 0; i < profileCnt && i < PROFILE_MAX_COUNT - 1 && !failed; i++)
+    {
+        if(memcmp(profiles[i].code, profile->code, 4) != 0)
+        {
+            failed = fwrite(&profiles[i], sizeof(PROFILE), 1, file) != 1;
+        }
+    }
+
+    failed |= fclose(file) != 0;
+
+    if(failed || rename(tempName, filename) != 0)
+    {
+        ERROR("failed to write \"%s\"\n", filename);
+        remove(tempName);
+        close(lockFd);
+        free(tempName);
+        free(profiles);
+        return -1;
+    }
+
+    /*the lock goes with the replaced file, and waiting sessions take it again on the new one*/
+    close(lockFd);
+    free(tempName);
+    free(profiles);
+    return 0;
+}
+
+int profile_find(const PROFILE *profiles, int profileCnt, const uint8_t code[4])
+{
+    int i;
+
+    for(i = 0; i < profileCnt; i++)
+    {
+        if(memcmp(profiles[i].code, code, 4) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
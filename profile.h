@@ -0,0 +1,93 @@
+/**
+ * device profile cache
+ *
+ * Keeps what the inquiry commands report about a device, keyed by its
+ * 4-byte device code, so that repeat sessions on the same part can go
+ * straight to the selection commands.
+ *
+ * cache file format (host byte order, the cache is local to the machine)
+ *
+ * offset         size (bytes)    description
+ * --------------------------------------------------------------------
+ * 0              8               magic "RX63NPRF"
+ * 8              4               version (1)
+ * 12             4               sizeof(PROFILE)
+ * 16             sizeof(PROFILE) most recently used profile
+ * ...
+ * --------------------------------------------------------------------
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+#define PROFILE_MAGIC           "RX63NPRF"
+#define PROFILE_VERSION         1
+#define PROFILE_HEADER_SIZE     16
+
+#define PROFILE_MAX_COUNT       32
+#define PROFILE_NAME_LEN        48
+#define PROFILE_MAX_CLOCK_MODES 8
+#define PROFILE_MAX_CLOCK_TYPES 4
+#define PROFILE_MAX_RATIOS      16
+#define PROFILE_MAX_AREAS       16
+
+enum {
+    PROFILE_AREA_USER_BOOT,
+    PROFILE_AREA_USER,
+    PROFILE_AREA_DATA,
+    PROFILE_AREA_COUNT
+};
+
+typedef struct {
+    uint8_t ratioCnt;
+    uint8_t ratios[PROFILE_MAX_RATIOS];
+    uint32_t minimumFrequency;
+    uint32_t maximumFrequency;
+} PROFILE_CLOCK_TYPE;
+
+typedef struct {
+    uint32_t startAddress;
+    uint32_t endAddress;
+} PROFILE_AREA;
+
+typedef struct {
+    uint8_t code[4];
+    char seriesName[PROFILE_NAME_LEN];
+    uint32_t bitRate;
+    uint8_t clockModeCnt;
+    uint8_t clockModes[PROFILE_MAX_CLOCK_MODES];
+    uint8_t clockTypeCnt;
+    PROFILE_CLOCK_TYPE clockTypes[PROFILE_MAX_CLOCK_TYPES];
+    uint8_t areaCnt[PROFILE_AREA_COUNT];
+    PROFILE_AREA areas[PROFILE_AREA_COUNT][PROFILE_MAX_AREAS];
+} PROFILE;
+
+/**
+ * load the profiles of a cache file, most recently used first
+ *
+ * profiles - receives up to capacity profiles
+ *
+ * number of profiles loaded, 0 if the file does not exist yet or is empty,
+ * -1 on error
+ */
+int profile_load(const char *filename, PROFILE *profiles, int capacity);
+
+/**
+ * store a profile as the most recently used one, replacing any profile with
+ * the same device code
+ *
+ * The cache is locked while it is read and replaced, so processes storing at
+ * the same time, e.g. the sessions of a fleet, keep each other's profiles.
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int profile_store(const char *filename, const PROFILE *profile);
+
+/**
+ * index of the profile for a device code, -1 if there is none
+ */
+int profile_find(const PROFILE *profiles, int profileCnt, const uint8_t code[4]);
+
+#endif /* PROFILE_H_ */
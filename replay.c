@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/select.h>
+#include "capture.h"
+#include "replay.h"
+
+#define PREFIX                  "replay: "
+#define ERROR(...)              fprintf(stderr, PREFIX "error: " __VA_ARGS__)
+#define WARNING(...)            fprintf(stderr, PREFIX "warning: " __VA_ARGS__)
+
+/*how long the device side waits for the host to send a recorded burst*/
+#define HOST_TIMEOUT_SEC        5
+
+static int g_master = -1;
+static int g_slave = -1;
+static pthread_t g_device;
+static int g_deviceRunning = 0;
+static volatile int g_deviceStop = 0;
+
+static uint8_t *g_content = NULL;
+static CAPTURE_RECORD *g_records = NULL;
+static size_t g_recordCnt = 0;
+static double g_speed = 1.0;
+static long g_mismatches = 0;
+static size_t g_playedCnt = 0;
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+    struct timespec t = { .tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0 && !g_deviceStop);
+}
+
+/**
+ * read exactly size host bytes, comparing them with the recorded ones
+ */
+static int consumeHostBytes(const uint8_t *expected, uint32_t size)
+{
+    uint8_t buffer[512];
+    uint32_t done = 0;
+    uint64_t deadline = now() + HOST_TIMEOUT_SEC * 1000000000ULL;
+
+    while(done < size && !g_deviceStop)
+    {
+        /*short waits so that replay_close() is not held up by an idle host*/
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+        fd_set set;
+        ssize_t length;
+        ssize_t i;
+        int retVal;
+
+        FD_ZERO(&set);
+        FD_SET(g_master, &set);
+
+        if((retVal = select(g_master + 1, &set, NULL, NULL, &timeout)) < 0)
+        {
+            return -1;
+        }
+
+        if(retVal == 0)
+        {
+            if(now() > deadline)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        length = size - done;
+        if(length > (ssize_t)sizeof(buffer))
+        {
+            length = sizeof(buffer);
+        }
+
+        if((length = read(g_master, buffer, length)) <= 0)
+        {
+            return -1;
+        }
+
+        for(i = 0; i < length; i++)
+        {
+            g_mismatches += (buffer[i] != expected[done + i]);
+        }
+        done += length;
+    }
+
+    return g_deviceStop ? -1 : 0;
+}
+
+static void *device(void *arg)
+{
+    uint64_t anchorReal = now();
+    uint64_t anchorRecorded = g_recordCnt ? g_records[0].timestamp : 0;
+    size_t i;
+
+    (void)arg;
+
+    for(i = 0; i < g_recordCnt && !g_deviceStop; i++)
+    {
+        const CAPTURE_RECORD *record = &g_records[i];
+
+        if(record->direction == CAPTURE_TX)
+        {
+            if(consumeHostBytes(record->data, record->size) != 0)
+            {
+                if(!g_deviceStop)
+                {
+                    WARNING("host stopped sending at record %zu of %zu\n", i, g_recordCnt);
+                }
+                break;
+            }
+
+            /*device timing is relative to the host, which runs at its own pace*/
+            anchorReal = now();
+            anchorRecorded = record->timestamp;
+            continue;
+        }
+
+        if(g_speed > 0)
+        {
+            sleepUntil(anchorReal + (uint64_t)((record->timestamp - anchorRecorded) / g_speed));
+        }
+
+        if(write(g_master, record->data, record->size) != (ssize_t)record->size)
+        {
+            ERROR("failed to send recorded device burst\n");
+            break;
+        }
+    }
+
+    g_playedCnt = i;
+    return NULL;
+}
+
+int replay_open(const char *captureFilename, double speed, char *deviceName, int deviceNameSize)
+{
+    struct termios attributes;
+
+    if(capture_load(captureFilename, &g_content, &g_records, &g_recordCnt) != 0)
+    {
+        return -1;
+    }
+
+    if(openpty(&g_master, &g_slave, NULL, NULL, NULL) != 0)
+    {
+        ERROR("failed to open a pseudo terminal\n");
+        replay_close();
+        return -1;
+    }
+
+    /*the host only sets the control flags, so hand it a raw line*/
+    if(tcgetattr(g_slave, &attributes) == 0)
+    {
+        cfmakeraw(&attributes);
+        tcsetattr(g_slave, TCSANOW, &attributes);
+    }
+
+    if(ttyname_r(g_slave, deviceName, deviceNameSize) != 0)
+    {
+        ERROR("failed to get the pseudo terminal name\n");
+        replay_close();
+        return -1;
+    }
+
+    g_speed = speed;
+    g_mismatches = 0;
+    g_playedCnt = 0;
+    g_deviceStop = 0;
+
+    if(pthread_create(&g_device, NULL, device, NULL) != 0)
+    {
+        ERROR("failed to start the device thread\n");
+        replay_close();
+        return -1;
+    }
+    g_deviceRunning = 1;
+
+    return 0;
+}
+
+long replay_close(void)
+{
+    if(g_deviceRunning)
+    {
+        g_deviceStop = 1;
+        pthread_join(g_device, NULL);
+        g_deviceRunning = 0;
+    }
+
+    if(g_master >= 0)
+    {
+        close(g_master);
+        g_master = -1;
+    }
+
+    if(g_slave >= 0)
+    {
+        close(g_slave);
+        g_slave = -1;
+    }
+
+    free(g_records);
+    free(g_content);
+    g_records = NULL;
+    g_content = NULL;
+    g_recordCnt = 0;
+
+    return g_mismatches;
+}
+
+#ifdef REPLAY_STANDALONE
+
+/******************************************************************************
+ * stand-alone device
+ *
+ * Serves a capture on a pseudo terminal for a host started separately, such
+ * as a watch mode session in the tests. Prints the terminal name, plays the
+ * capture once and fails if the host diverged or stopped early.
+ */
+int main(int argc, char **argv)
+{
+    char deviceName[64];
+    size_t recordCnt;
+    long mismatches;
+
+    if(argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <capture file> [speed]\n", argv[0]);
+        return -1;
+    }
+
+    if(replay_open(argv[1], (argc == 3) ? atof(argv[2]) : 1.0, deviceName, sizeof(deviceName)) != 0)
+    {
+        return -1;
+    }
+
+    printf("%s\n", deviceName);
+    fflush(stdout);
+
+    /*the device thread ends once the capture is played or the host went quiet*/
+    pthread_join(g_device, NULL);
+    g_deviceRunning = 0;
+
+    recordCnt = g_recordCnt;
+    mismatches = replay_close();
+    if(mismatches > 0 || g_playedCnt != recordCnt)
+    {
+        ERROR("%ld host bytes differed, %zu of %zu records played\n", mismatches, g_playedCnt, recordCnt);
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif /* REPLAY_STANDALONE */
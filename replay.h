@@ -0,0 +1,33 @@
+/**
+ * replay transport
+ *
+ * Plays the device side of a capture file (see capture.h) on a pseudo
+ * terminal so that the whole boot mode sequence can run without hardware.
+ * The device thread consumes as many bytes from the host as each recorded
+ * host burst held, and sends each recorded device burst after the recorded
+ * delay since the preceding record, divided by the replay speed.
+ */
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+/**
+ * start replaying a capture file
+ *
+ * captureFilename - capture file recorded with --capture
+ * speed - timing factor: 1 for the recorded timing, 2 for twice as fast, 0 for no delays
+ * deviceName - receives the name of the pseudo terminal to open as the device
+ * deviceNameSize - size of deviceName
+ *
+ * 0 if successful, non-zero otherwise
+ */
+int replay_open(const char *captureFilename, double speed, char *deviceName, int deviceNameSize);
+
+/**
+ * stop the device thread and release the pseudo terminal
+ *
+ * number of host bytes that differed from the capture
+ */
+long replay_close(void);
+
+#endif /* REPLAY_H_ */
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+/*latency histogram bucket i counts samples in [2^i, 2^(i+1)) microseconds; bucket 0 also holds < 1us*/
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    unsigned long count;
+    unsigned long errors;
+    uint64_t sendTotal;
+    uint64_t responseTotal;
+    uint64_t responseMin;
+    uint64_t responseMax;
+    unsigned long histogram[HISTOGRAM_BUCKETS];
+} COMMAND_STATS;
+
+typedef struct {
+    unsigned long count;
+    unsigned long long bytes;
+} SYSCALL_STATS;
+
+int g_statsEnabled = 0;
+
+static COMMAND_STATS g_commandStats[256];
+static SYSCALL_STATS g_syscallStats[STATS_SYSCALL_COUNT];
+static uint64_t g_phaseTime[STATS_PHASE_COUNT];
+static int g_phase = -1;
+static uint64_t g_phaseStart = 0;
+static uint64_t g_start = 0;
+
+static int g_printText = 0;
+static const char *g_jsonFilename = NULL;
+
+static const char *g_phaseNames[STATS_PHASE_COUNT] = {
+    "image",
+    "sync",
+    "inquiry",
+    "bit_rate",
+    "bit_rate_wait",
+    "area_inquiry",
+    "transition",
+    "programming",
+};
+
+static const char *g_syscallNames[STATS_SYSCALL_COUNT] = {
+    "write",
+    "writev",
+    "read",
+    "select",
+};
+
+uint64_t stats_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void printOnExit(void)
+{
+    stats_recordPhase(STATS_PHASE_COUNT);
+
+    if(g_printText)
+    {
+        stats_print(stderr, 0);
+    }
+
+    if(g_jsonFilename != NULL)
+    {
+        FILE *file = (strcmp(g_jsonFilename, "-") == 0) ? stdout : fopen(g_jsonFilename, "w");
+
+        if(file == NULL)
+        {
+            perror("stats: fopen");
+            return;
+        }
+
+        stats_print(file, 1);
+
+        if(file != stdout)
+        {
+            fclose(file);
+        }
+    }
+}
+
+void stats_enable(int text, const char *jsonFilename)
+{
+    if(!g_statsEnabled)
+    {
+        g_statsEnabled = 1;
+        g_start = stats_now();
+        atexit(printOnExit);
+    }
+
+    g_printText = text;
+    g_jsonFilename = jsonFilename;
+}
+
+/**
+ * close the running phase and start the given one; STATS_PHASE_COUNT only
+ * closes the running phase
+ */
+void stats_recordPhase(STATS_PHASE phase)
+{
+    uint64_t now = stats_now();
+
+    if(g_phase >= 0)
+    {
+        g_phaseTime[g_phase] += now - g_phaseStart;
+    }
+
+    g_phase = (phase < STATS_PHASE_COUNT) ? (int)phase : -1;
+    g_phaseStart = now;
+}
+
+void stats_recordSyscall(STATS_SYSCALL syscall, long bytes)
+{
+    g_syscallStats[syscall].count++;
+
+    if(bytes > 0)
+    {
+        g_syscallStats[syscall].bytes += bytes;
+    }
+}
+
+void stats_recordCommand(unsigned char command, uint64_t sendStart, uint64_t sendEnd, uint64_t responseEnd, int ok)
+{
+    COMMAND_STATS *stats = &g_commandStats[command];
+    uint64_t response = responseEnd - sendEnd;
+    uint64_t micros = response / 1000;
+    int bucket = 0;
+
+    while(micros > 1 && bucket < HISTOGRAM_BUCKETS - 1)
+    {
+        micros >>= 1;
+        bucket++;
+    }
+
+    if(stats->count == 0 || response < stats->responseMin)
+    {
+        stats->responseMin = response;
+    }
+
+    if(response > stats->responseMax)
+    {
+        stats->responseMax = response;
+    }
+
+    stats->count++;
+    stats->errors += !ok;
+    stats->sendTotal += sendEnd - sendStart;
+    stats->responseTotal += response;
+    stats->histogram[bucket]++;
+}
+
+/**
+ * approximate percentile from the histogram, as the upper bound of the bucket
+ * holding it, in microseconds
+ */
+static uint64_t percentile(const COMMAND_STATS *stats, int percent)
+{
+    unsigned long target = (stats->count * percent + 99) / 100;
+    unsigned long seen = 0;
+    int i;
+
+    for(i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if((seen += stats->histogram[i]) >= target)
+        {
+            break;
+        }
+    }
+
+    return 2ULL << i;
+}
+
+static void printText(FILE *file, uint64_t total, const struct rusage *usage, uint64_t threadCpu)
+{
+    int i;
+    int j;
+
+    fprintf(file, "\nstats: wall time %.3f ms, cpu time user %ld.%.6ld s, system %ld.%.6ld s, session thread %.3f ms\n",
+            total / 1e6, (long)usage->ru_utime.tv_sec, (long)usage->ru_utime.tv_usec, (long)usage->ru_stime.tv_sec, (long)usage->ru_stime.tv_usec,
+            threadCpu / 1e6);
+
+    fprintf(file, "\n  %-16s %12s %7s\n", "phase", "wall ms", "%");
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+    {
+        if(g_phaseTime[i] > 0)
+        {
+            fprintf(file, "  %-16s %12.3f %6.1f%%\n", g_phaseNames[i], g_phaseTime[i] / 1e6, total ? 100.0 * g_phaseTime[i] / total : 0.0);
+        }
+    }
+
+    fprintf(file, "\n  %-8s %10s %14s\n", "syscall", "count", "bytes");
+    for(i = 0; i < STATS_SYSCALL_COUNT; i++)
+    {
+        fprintf(file, "  %-8s %10lu %14llu\n", g_syscallNames[i], g_syscallStats[i].count, g_syscallStats[i].bytes);
+    }
+
+    fprintf(file, "\n  %-4s %7s %6s %10s %10s %10s %10s %10s %10s\n", "cmd", "count", "errors", "send us", "ack us", "min us", "max us", "p50 us<", "p99 us<");
+    for(i = 0; i < 256; i++)
+    {
+        const COMMAND_STATS *stats = &g_commandStats[i];
+
+        if(stats->count == 0)
+        {
+            continue;
+        }
+
+        fprintf(file, "  0x%.2x %7lu %6lu %10.1f %10.1f %10.1f %10.1f %10llu %10llu\n", i, stats->count, stats->errors,
+                stats->sendTotal / 1e3 / stats->count, stats->responseTotal / 1e3 / stats->count,
+                stats->responseMin / 1e3, stats->responseMax / 1e3,
+                (unsigned long long)percentile(stats, 50), (unsigned long long)percentile(stats, 99));
+
+        fprintf(file, "       ack histogram:");
+        for(j = 0; j < HISTOGRAM_BUCKETS; j++)
+        {
+            if(stats->histogram[j] > 0)
+            {
+                fprintf(file, " <%lluus:%lu", 2ULL << j, stats->histogram[j]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+}
+
+static void printJson(FILE *file, uint64_t total, const struct rusage *usage, uint64_t threadCpu)
+{
+    int first = 1;
+    int i;
+    int j;
+
+    fprintf(file, "{\"wall_ns\":%llu,\"cpu_user_us\":%lld,\"cpu_system_us\":%lld,\"cpu_thread_ns\":%llu,\"phases\":{",
+            (unsigned long long)total,
+            (long long)usage->ru_utime.tv_sec * 1000000 + usage->ru_utime.tv_usec,
+            (long long)usage->ru_stime.tv_sec * 1000000 + usage->ru_stime.tv_usec,
+            (unsigned long long)threadCpu);
+
+    for(i = 0; i < STATS_PHASE_COUNT; i++)
+    {
+        fprintf(file, "%s\"%s\":%llu", i ? "," : "", g_phaseNames[i], (unsigned long long)g_phaseTime[i]);
+    }
+
+    fprintf(file, "},\"syscalls\":{");
+    for(i = 0; i < STATS_SYSCALL_COUNT; i++)
+    {
+        fprintf(file, "%s\"%s\":{\"count\":%lu,\"bytes\":%llu}", i ? "," : "", g_syscallNames[i], g_syscallStats[i].count, g_syscallStats[i].bytes);
+    }
+
+    fprintf(file, "},\"commands\":[");
+    for(i = 0; i < 256; i++)
+    {
+        const COMMAND_STATS *stats = &g_commandStats[i];
+
+        if(stats->count == 0)
+        {
+            continue;
+        }
+
+        fprintf(file, "%s{\"command\":%d,\"count\":%lu,\"errors\":%lu,\"send_ns\":%llu,\"ack_ns\":%llu,\"ack_min_ns\":%llu,\"ack_max_ns\":%llu,\"ack_histogram_us_log2\":[",
+                first ? "" : ",", i, stats->count, stats->errors,
+                (unsigned long long)stats->sendTotal, (unsigned long long)stats->responseTotal,
+                (unsigned long long)stats->responseMin, (unsigned long long)stats->responseMax);
+        first = 0;
+
+        for(j = 0; j < HISTOGRAM_BUCKETS; j++)
+        {
+            fprintf(file, "%s%lu", j ? "," : "", stats->histogram[j]);
+        }
+        fprintf(file, "]}");
+    }
+
+    fprintf(file, "]}\n");
+}
+
+void stats_print(FILE *file, int json)
+{
+    struct rusage usage;
+    struct timespec thread;
+    uint64_t total = stats_now() - g_start;
+
+    /*process time includes the capture writer and replay threads; the thread time is the session alone*/
+    getrusage(RUSAGE_SELF, &usage);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread);
+
+    if(json)
+    {
+        printJson(file, total, &usage, (uint64_t)thread.tv_sec * 1000000000ULL + thread.tv_nsec);
+    }
+    else
+    {
+        printText(file, total, &usage, (uint64_t)thread.tv_sec * 1000000000ULL + thread.tv_nsec);
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ * per-command latency histograms, phase wall times and wire counters
+ *
+ * Everything is off unless stats_enable() is called. The inline hooks below
+ * only test g_statsEnabled when off, so the instrumented paths cost a single
+ * predictable branch and no clock reads.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    STATS_PHASE_IMAGE,
+    STATS_PHASE_SYNC,
+    STATS_PHASE_INQUIRY,
+    STATS_PHASE_BIT_RATE,
+    STATS_PHASE_BIT_RATE_WAIT,
+    STATS_PHASE_AREA_INQUIRY,
+    STATS_PHASE_TRANSITION,
+    STATS_PHASE_PROGRAMMING,
+    STATS_PHASE_COUNT
+} STATS_PHASE;
+
+typedef enum {
+    STATS_SYSCALL_WRITE,
+    STATS_SYSCALL_WRITEV,
+    STATS_SYSCALL_READ,
+    STATS_SYSCALL_SELECT,
+    STATS_SYSCALL_COUNT
+} STATS_SYSCALL;
+
+extern int g_statsEnabled;
+
+/**
+ * enable collection and print the report on exit
+ *
+ * text - print a human-readable report to stderr
+ * jsonFilename - also write a JSON report to this file ("-" for stdout), or NULL
+ */
+void stats_enable(int text, const char *jsonFilename);
+
+uint64_t stats_now(void);
+
+void stats_recordPhase(STATS_PHASE phase);
+void stats_recordSyscall(STATS_SYSCALL syscall, long bytes);
+void stats_recordCommand(unsigned char command, uint64_t sendStart, uint64_t sendEnd, uint64_t responseEnd, int ok);
+
+/**
+ * print the collected report
+ *
+ * json - 0 for the text report, non-zero for the JSON report
+ */
+void stats_print(FILE *file, int json);
+
+#define STATS_NOW()                             (g_statsEnabled ? stats_now() : 0)
+
+static inline void stats_phase(STATS_PHASE phase)
+{
+    if(__builtin_expect(g_statsEnabled, 0))
+        stats_recordPhase(phase);
+}
+
+static inline void stats_syscall(STATS_SYSCALL syscall, long bytes)
+{
+    if(__builtin_expect(g_statsEnabled, 0))
+        stats_recordSyscall(syscall, bytes);
+}
+
+static inline void stats_command(unsigned char command, uint64_t sendStart, uint64_t sendEnd, uint64_t responseEnd, int ok)
+{
+    if(__builtin_expect(g_statsEnabled, 0))
+        stats_recordCommand(command, sendStart, sendEnd, responseEnd, ok);
+}
+
+#endif /* STATS_H_ */
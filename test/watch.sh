@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# watch mode against pseudo terminal nodes
+#
+# Two boards, played by replaydevice from the session capture, appear as
+# symlinks in a temporary directory next to a node that does not match the
+# pattern. One of them appears again within the cooldown. SIGTERM stops
+# watching and the fleet table must show both boards flashed.
+#
+# usage: watch.sh <rx63nprog> <replaydevice> <capture file> <firmware image>
+#
+
+BIN=$1
+DEVICE=$2
+CAPTURE=$3
+IMAGE=$4
+
+DIR=$(mktemp -d) || exit 1
+LOG=$(mktemp) || exit 1
+WATCH=
+DEVICES=
+
+fail()
+{
+    echo "watch test: $*"
+    cat "$LOG"
+    [ -n "$WATCH" ] && kill $WATCH 2> /dev/null
+    [ -n "$DEVICES" ] && kill $DEVICES 2> /dev/null
+    rm -rf "$DIR" "$LOG" "$LOG".*
+    exit 1
+}
+
+# wait up to 10 s for a log line
+waitFor()
+{
+    i=0
+    until grep -q "$1" "$LOG"
+    do
+        i=$((i + 1))
+        [ $i -gt 100 ] && fail "timed out waiting for '$1'"
+        sleep 0.1
+    done
+}
+
+"$BIN" --watch "$DIR" --pattern 'ttyTEST*' --cooldown 5 "$IMAGE" > "$LOG" 2>&1 &
+WATCH=$!
+waitFor "watching $DIR for ttyTEST\*"
+
+for n in 0 1
+do
+    "$DEVICE" "$CAPTURE" 0 > "$LOG.$n" &
+    DEVICES="$DEVICES $!"
+    i=0
+    until [ -s "$LOG.$n" ]
+    do
+        i=$((i + 1))
+        [ $i -gt 100 ] && fail "replay device $n did not start"
+        sleep 0.1
+    done
+done
+
+ln -s "$(cat "$LOG.0")" "$DIR/ttyTEST0"
+ln -s "$(cat "$LOG.1")" "$DIR/ttyTEST1"
+ln -s "$(cat "$LOG.0")" "$DIR/ttyOTHER"
+
+waitFor "$DIR/ttyTEST0 finished"
+waitFor "$DIR/ttyTEST1 finished"
+
+# re-enumeration right after flashing
+rm "$DIR/ttyTEST0"
+ln -s "$(cat "$LOG.0")" "$DIR/ttyTEST0"
+waitFor "$DIR/ttyTEST0 appeared again, ignored"
+
+kill -TERM $WATCH
+wait $WATCH || fail "watch mode failed"
+WATCH=
+for pid in $DEVICES
+do
+    wait $pid || fail "replay device diverged from the capture"
+done
+DEVICES=
+
+grep -q "$DIR/ttyTEST0 appeared, queued on" "$LOG" || fail "ttyTEST0 was not queued"
+grep -q "$DIR/ttyTEST1 appeared, queued on" "$LOG" || fail "ttyTEST1 was not queued"
+grep -q "ttyOTHER" "$LOG" && fail "a node not matching the pattern was picked up"
+[ "$(grep -c "appeared, queued on" "$LOG")" -eq 2 ] || fail "a board was queued twice"
+grep -q "^[^ ]*  *$DIR/ttyTEST0 .* ok " "$LOG" || fail "ttyTEST0 is not ok in the table"
+grep -q "^[^ ]*  *$DIR/ttyTEST1 .* ok " "$LOG" || fail "ttyTEST1 is not ok in the table"
+grep -q "2 boards, 2 ok, 0 failed, 0 not started" "$LOG" || fail "wrong fleet summary"
+
+cat "$LOG"
+rm -rf "$DIR" "$LOG" "$LOG".*